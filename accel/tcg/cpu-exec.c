@@ -1009,6 +1009,11 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             if (tb_page_addr1(tb) != -1) {
                 last_tb = NULL;
             }
+
+            if (unlikely(qatomic_read(&cpu->profile_request))) {
+                tcg_profiler_record(cpu, pc, tb_page_addr0(tb),
+                                    cpu_mmu_index(cpu, true));
+            }
 #endif
             /* See if we can patch the calling TB. */
             if (last_tb) {
@@ -234,12 +234,19 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
 
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
+    int k;
+
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lpindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        desc->lptable[k].addr = -1;
+        desc->lptable[k].mask = 0;
+    }
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -473,13 +480,99 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
+/*
+ * Flush all of the small pages filled from the large page @lp,
+ * and drop @lp from the large page tlb.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_one_large_page_locked(CPUState *cpu, int midx,
+                                            CPUTLBLargePage *lp)
+{
+    CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
+    vaddr lp_addr = lp->addr;
+    vaddr lp_mask = lp->mask;
+    vaddr n_pages = (~lp_mask >> TARGET_PAGE_BITS) + 1;
+    size_t n_entries = tlb_n_entries(f);
+
+    tlb_debug("flush large page midx %d (%016" VADDR_PRIx "/%016"
+              VADDR_PRIx ")\n", midx, lp_addr, lp_mask);
+
+    if (n_pages < n_entries) {
+        for (vaddr i = 0; i < n_pages; i++) {
+            vaddr page = lp_addr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
+    } else {
+        /* Cheaper to scan the whole tlb than every page of the range. */
+        for (size_t i = 0; i < n_entries; i++) {
+            if (tlb_flush_entry_mask_locked(&f->table[i], lp_addr, lp_mask)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
+    }
+    tlb_flush_vtlb_page_mask_locked(cpu, midx, lp_addr, lp_mask);
+
+    lp->addr = -1;
+    lp->mask = 0;
+}
+
+/*
+ * Flush the large pages overlapping [@addr, @addr + @len - 1], where
+ * addresses are compared under @mask.  Return false if the large page
+ * tlb cannot account for every large page that might overlap, in which
+ * case the caller must flush the entire tlb for @midx.
+ * Called with tlb_c.lock held.
+ */
+static bool tlb_flush_large_pages_locked(CPUState *cpu, int midx,
+                                         vaddr addr, vaddr len, vaddr mask)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    vaddr first = addr & mask;
+    vaddr last = first + len - 1;
+    bool remaining = false;
+    int k;
+
+    if (last < first || (last & ~mask)) {
+        return false;
+    }
+
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        CPUTLBLargePage *lp = &d->lptable[k];
+        vaddr lp_last = lp->addr | ~lp->mask;
+
+        if (lp->addr == (vaddr)-1) {
+            continue;
+        }
+        if (lp_last & ~mask) {
+            /* Aliases under @mask are not tracked. */
+            return false;
+        }
+        if (first <= lp_last && last >= lp->addr) {
+            tlb_flush_one_large_page_locked(cpu, midx, lp);
+        } else {
+            remaining = true;
+        }
+    }
+
+    if (!remaining) {
+        /* Nothing left for the region to describe. */
+        d->large_page_addr = -1;
+        d->large_page_mask = -1;
+    }
+    return true;
+}
+
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 {
     vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
     vaddr lp_mask = cpu->neg.tlb.d[midx].large_page_mask;
 
     /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
+    if ((page & lp_mask) == lp_addr &&
+        !tlb_flush_large_pages_locked(cpu, midx, page, TARGET_PAGE_SIZE, -1)) {
         tlb_debug("forcing full flush midx %d (%016"
                   VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, lp_addr, lp_mask);
@@ -721,7 +814,8 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
      * Because large_page_mask contains all 1's from the msb,
      * we only need to test the end of the range.
      */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
+    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr &&
+        !tlb_flush_large_pages_locked(cpu, midx, addr, len, mask)) {
         tlb_debug("forcing full flush midx %d ("
                   "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, d->large_page_addr, d->large_page_mask);
@@ -1060,13 +1154,22 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our TLB does not support large pages, so remember the area covered by
+ * large pages, and record each large page in the large page tlb so that
+ * invalidating one of them only flushes the small pages filled from it.
+ */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
-                               vaddr addr, uint64_t size)
+                               vaddr addr, uint64_t size,
+                               const CPUTLBEntryFull *full)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[mmu_idx].large_page_addr;
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    vaddr lp_addr = desc->large_page_addr;
     vaddr lp_mask = ~(size - 1);
+    vaddr page_addr = addr & lp_mask;
+    vaddr page_mask = lp_mask;
+    CPUTLBLargePage *lp = NULL;
+    int k;
 
     if (lp_addr == (vaddr)-1) {
         /* No previous large page.  */
@@ -1075,13 +1178,40 @@ static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= cpu->neg.tlb.d[mmu_idx].large_page_mask;
+        lp_mask &= desc->large_page_mask;
         while (((lp_addr ^ addr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    cpu->neg.tlb.d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    cpu->neg.tlb.d[mmu_idx].large_page_mask = lp_mask;
+    desc->large_page_addr = lp_addr & lp_mask;
+    desc->large_page_mask = lp_mask;
+
+    /* Refresh the existing entry for this large page, if any. */
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        if (desc->lptable[k].addr == page_addr &&
+            desc->lptable[k].mask == page_mask) {
+            lp = &desc->lptable[k];
+            break;
+        }
+    }
+    if (lp == NULL) {
+        lp = &desc->lptable[desc->lpindex++ % CPU_LPTLB_SIZE];
+        if (lp->addr != (vaddr)-1) {
+            /*
+             * Small pages filled from the evicted entry could no longer
+             * be found when it is invalidated, so drop them now.
+             */
+            qemu_spin_lock(&cpu->neg.tlb.c.lock);
+            tlb_flush_one_large_page_locked(cpu, mmu_idx, lp);
+            qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+        }
+    }
+
+    lp->addr = page_addr;
+    lp->mask = page_mask;
+    lp->full = *full;
+    lp->full.phys_addr = (full->phys_addr & TARGET_PAGE_MASK)
+                         - (addr & ~page_mask & TARGET_PAGE_MASK);
 }
 
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
@@ -1105,7 +1235,8 @@ static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
 /*
  * Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is only used by tlb_flush_page and to refill other
+ * pages of the same large page without calling tlb_fill.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1130,7 +1261,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
         sz = TARGET_PAGE_SIZE;
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
-        tlb_add_large_page(cpu, mmu_idx, addr, sz);
+        tlb_add_large_page(cpu, mmu_idx, addr, sz, full);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1386,6 +1517,60 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
     return false;
 }
 
+/*
+ * Return true if the large page tlb covers @addr with the protection
+ * required by @access_type, in which case the small page containing
+ * @addr has been added to the tlb without a page table walk.  Anything
+ * that the target wants to see on every access (PAGE_WRITE_INV for
+ * stores, or a forced TLB_INVALID_MASK) is left to tlb_fill.
+ */
+static bool large_page_tlb_hit(CPUState *cpu, int mmu_idx,
+                               MMUAccessType access_type, vaddr addr)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    int need;
+    int k;
+
+    assert_cpu_is_self(cpu);
+
+    if ((addr & desc->large_page_mask) != desc->large_page_addr) {
+        return false;
+    }
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need = PAGE_EXEC;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        CPUTLBLargePage *lp = &desc->lptable[k];
+
+        if ((addr & lp->mask) == lp->addr) {
+            CPUTLBEntryFull full = lp->full;
+
+            if (!(full.prot & need) ||
+                (full.tlb_fill_flags & TLB_INVALID_MASK) ||
+                (access_type == MMU_DATA_STORE &&
+                 (full.prot & PAGE_WRITE_INV))) {
+                return false;
+            }
+            full.phys_addr += addr & ~lp->mask & TARGET_PAGE_MASK;
+            tlb_set_page_full(cpu, mmu_idx, addr, &full);
+            return true;
+        }
+    }
+    return false;
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
@@ -1425,7 +1610,8 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     CPUTLBEntryFull *full;
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
+        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr) &&
+            !large_page_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             if (!cpu->cc->tcg_ops->tlb_fill(cpu, addr, fault_size, access_type,
                                             mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1705,7 +1891,8 @@ static bool mmu_lookup1(CPUState *cpu, MMULookupPageData *data,
     /* If the TLB entry is for a different page, reload and try again.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, access_type,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_page_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             tlb_fill(cpu, addr, data->size, access_type, mmu_idx, ra);
             maybe_resized = true;
             index = tlb_index(cpu, mmu_idx, addr);
@@ -1907,7 +2094,8 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
     tlb_addr = tlb_addr_write(tlbe);
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, MMU_DATA_STORE,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_page_tlb_hit(cpu, mmu_idx, MMU_DATA_STORE, addr)) {
             tlb_fill(cpu, addr, size,
                      MMU_DATA_STORE, mmu_idx, retaddr);
             index = tlb_index(cpu, mmu_idx, addr);
@@ -23,4 +23,18 @@ static inline bool cpu_in_serial_context(CPUState *cs)
     return !(cs->tcg_cflags & CF_PARALLEL) || cpu_in_exclusive_context(cs);
 }
 
+/**
+ * tcg_profiler_record:
+ * @cpu: the vCPU that was asked for a sample
+ * @pc: guest virtual address of the next translation block
+ * @ram_addr: RAM address (ram_addr_t) of the next translation block,
+ *     or -1 if its code is not in RAM
+ * @mmu_idx: MMU index used to fetch the translation block
+ *
+ * Record a sample for the TCG sampling profiler and clear the
+ * pending request of @cpu.
+ */
+void tcg_profiler_record(CPUState *cpu, vaddr pc, uint64_t ram_addr,
+                         int mmu_idx);
+
 #endif
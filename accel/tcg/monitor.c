@@ -235,10 +235,16 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+static HumanReadableText *hmp_query_tcg_profile(Error **errp)
+{
+    return qmp_x_query_tcg_profile(false, TCG_PROFILE_FORMAT_TEXT, errp);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
+    monitor_register_hmp_info_hrt("tcgprofile", hmp_query_tcg_profile);
 }
 
 type_init(hmp_tcg_register);
@@ -76,6 +76,7 @@ enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_UDATA_R,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND_UDATA,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -151,6 +152,16 @@ static void gen_empty_inline_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
+/*
+ * Conditional callbacks need a branch around the call, and thus a label
+ * per callback, which cannot be reproduced by copying ops.  They are
+ * generated directly by plugin_gen_inject instead, so the empty
+ * callback only marks the insertion point.
+ */
+static void gen_empty_cond_cb(void)
+{
+}
+
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -216,6 +227,7 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb_no_rwg);
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA_R, gen_empty_udata_cb_no_wg);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND_UDATA, gen_empty_cond_cb);
         break;
     default:
         g_assert_not_reached();
@@ -479,6 +491,100 @@ static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER are resolved at registration time. */
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Emit, at the current insertion point, a comparison of the scoreboard
+ * entry of the running vCPU against the immediate, and a call to the
+ * plugin's callback that is skipped when the condition is false.
+ */
+static void gen_cond_udata_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    GArray *score = cb->cond.entry.score->data;
+    char *base = score->data + cb->cond.entry.offset;
+    size_t elem_size = g_array_get_element_size(score);
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+    TCGOp *before = tcg_ctx->emit_before_op;
+    TCGOp *call;
+    bool no_wg = cb->cond.flags == QEMU_PLUGIN_CB_R_REGS ||
+                 cb->cond.flags == QEMU_PLUGIN_CB_RW_REGS;
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, elem_size);
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_gen_addi_ptr(ptr, ptr, (intptr_t)base);
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(tcg_invert_cond(plugin_cond_to_tcgcond(cb->cond.cond)),
+                        val, cb->cond.imm, after_cb);
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    if (no_wg) {
+        gen_helper_plugin_vcpu_udata_cb_no_wg(cpu_index,
+                                              tcg_constant_ptr(cb->userp));
+    } else {
+        gen_helper_plugin_vcpu_udata_cb_no_rwg(cpu_index,
+                                               tcg_constant_ptr(cb->userp));
+    }
+
+    /* Redirect the stub helper to the plugin, as copy_call does. */
+    call = before ? QTAILQ_PREV(before, link) : tcg_last_op();
+    tcg_debug_assert(call->opc == INDEX_op_call);
+    call->args[TCGOP_CALLO(call) + TCGOP_CALLI(call)] =
+        (uintptr_t)cb->f.vcpu_udata;
+
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    TCGOp *end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    int i;
+
+    tcg_debug_assert(end_op);
+
+    if (cbs && cbs->len) {
+        /*
+         * Emit after end_op: the removed range keeps its links, so the
+         * walk in plugin_gen_inject carries on through the new ops.
+         */
+        tcg_ctx->emit_before_op = QTAILQ_NEXT(end_op, link);
+        for (i = 0; i < cbs->len; i++) {
+            gen_cond_udata_cb(&g_array_index(cbs, struct qemu_plugin_dyn_cb,
+                                             i));
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+    rm_ops_range(begin_op, end_op);
+}
+
 typedef TCGOp *(*inject_fn)(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *intp);
 typedef bool (*op_ok_fn)(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb);
@@ -655,6 +761,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond_udata(const struct qemu_plugin_tb *ptb,
+                                     TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -679,6 +791,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond_udata(const struct qemu_plugin_tb *ptb,
+                                       TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -745,6 +865,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND_UDATA:
+                type = "cond udata";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -796,6 +919,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_COND_UDATA:
+                    plugin_gen_tb_cond_udata(plugin_tb, op);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -815,6 +941,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_COND_UDATA:
+                    plugin_gen_insn_cond_udata(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
                     break;
@@ -0,0 +1,257 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * TCG sampling profiler
+ *
+ * A timer in the main loop periodically asks every running vCPU to
+ * leave its chain of translation blocks, using the same mechanism as
+ * cpu_exit().  The vCPU then records the guest program counter of the
+ * next translation block it is about to execute.  This attributes host
+ * time to guest code without any instrumentation of the generated code
+ * and without tools inside the guest.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/type-helpers.h"
+#include "qapi/qapi-commands-machine.h"
+#include "hw/core/cpu.h"
+#include "sysemu/runstate.h"
+#include "sysemu/tcg.h"
+#include "internal-common.h"
+
+/* Bound the memory used by a long running profile. */
+#define TCG_PROFILER_MAX_ENTRIES   (64 * 1024)
+#define TCG_PROFILER_TEXT_ENTRIES  40
+
+typedef struct TCGProfileEntry {
+    vaddr pc;
+    /* ram_addr_t of the code, not a guest physical address */
+    uint64_t ram_addr;
+    int mmu_idx;
+    uint64_t count;
+} TCGProfileEntry;
+
+static struct {
+    QemuMutex lock;
+    /* The fields below are protected by @lock. */
+    GHashTable *entries;
+    uint64_t samples;
+    uint64_t dropped;
+    /* The fields below are only accessed with the BQL held. */
+    QEMUTimer *timer;
+    uint32_t interval;
+    uint64_t idle;
+} profiler;
+
+static void __attribute__((constructor)) tcg_profiler_init(void)
+{
+    qemu_mutex_init(&profiler.lock);
+}
+
+static guint tcg_profile_entry_hash(gconstpointer p)
+{
+    const TCGProfileEntry *e = p;
+
+    return g_int64_hash(&e->pc) ^ g_int64_hash(&e->ram_addr) ^ e->mmu_idx;
+}
+
+static gboolean tcg_profile_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TCGProfileEntry *ea = a, *eb = b;
+
+    return ea->pc == eb->pc && ea->ram_addr == eb->ram_addr &&
+           ea->mmu_idx == eb->mmu_idx;
+}
+
+void tcg_profiler_record(CPUState *cpu, vaddr pc, uint64_t ram_addr,
+                         int mmu_idx)
+{
+    TCGProfileEntry key = {
+        .pc = pc,
+        .ram_addr = ram_addr,
+        .mmu_idx = mmu_idx,
+    };
+    TCGProfileEntry *e;
+
+    qatomic_set(&cpu->profile_request, false);
+
+    QEMU_LOCK_GUARD(&profiler.lock);
+    if (!profiler.entries) {
+        return;
+    }
+    e = g_hash_table_lookup(profiler.entries, &key);
+    if (!e) {
+        if (g_hash_table_size(profiler.entries) >= TCG_PROFILER_MAX_ENTRIES) {
+            profiler.dropped++;
+            return;
+        }
+        e = g_memdup2(&key, sizeof(key));
+        g_hash_table_add(profiler.entries, e);
+    }
+    e->count++;
+    profiler.samples++;
+}
+
+static void tcg_profiler_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    if (runstate_is_running()) {
+        CPU_FOREACH(cpu) {
+            if (qatomic_read(&cpu->halted)) {
+                profiler.idle++;
+                continue;
+            }
+            qatomic_set(&cpu->profile_request, true);
+            /*
+             * Pairs with the barrier in cpu_handle_interrupt: once the
+             * vCPU has observed the exit request, it sees profile_request.
+             */
+            smp_wmb();
+            qatomic_set(&cpu->neg.icount_decr.u16.high, -1);
+        }
+    }
+    timer_mod(profiler.timer,
+              qemu_clock_get_us(QEMU_CLOCK_REALTIME) + profiler.interval);
+}
+
+void qmp_x_tcg_profiler_start(bool has_interval, uint32_t interval,
+                              Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "The profiler is only available with accel=tcg");
+        return;
+    }
+    if (profiler.timer) {
+        error_setg(errp, "The profiler is already running");
+        return;
+    }
+    if (has_interval && interval == 0) {
+        error_setg(errp, "The sampling interval must be non-zero");
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&profiler.lock) {
+        if (profiler.entries) {
+            g_hash_table_destroy(profiler.entries);
+        }
+        profiler.entries = g_hash_table_new_full(tcg_profile_entry_hash,
+                                                 tcg_profile_entry_equal,
+                                                 g_free, NULL);
+        profiler.samples = 0;
+        profiler.dropped = 0;
+    }
+    profiler.idle = 0;
+    profiler.interval = has_interval ? interval : 1000;
+    profiler.timer = timer_new_us(QEMU_CLOCK_REALTIME, tcg_profiler_tick,
+                                  NULL);
+    timer_mod(profiler.timer,
+              qemu_clock_get_us(QEMU_CLOCK_REALTIME) + profiler.interval);
+}
+
+void qmp_x_tcg_profiler_stop(Error **errp)
+{
+    if (!profiler.timer) {
+        error_setg(errp, "The profiler is not running");
+        return;
+    }
+    timer_free(profiler.timer);
+    profiler.timer = NULL;
+}
+
+static gint tcg_profile_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const TCGProfileEntry *ea = *(TCGProfileEntry **)a;
+    const TCGProfileEntry *eb = *(TCGProfileEntry **)b;
+
+    if (ea->count != eb->count) {
+        return ea->count > eb->count ? -1 : 1;
+    }
+    return ea->pc < eb->pc ? -1 : ea->pc > eb->pc;
+}
+
+static void tcg_profile_dump_text(GString *buf, GPtrArray *sorted,
+                                  uint64_t samples, uint64_t dropped)
+{
+    guint i;
+
+    g_string_append_printf(buf, "Profiler            %s, interval %u us\n",
+                           profiler.timer ? "running" : "stopped",
+                           profiler.interval);
+    g_string_append_printf(buf, "Samples             %" PRIu64
+                           " (idle %" PRIu64 ", dropped %" PRIu64 ")\n",
+                           samples, profiler.idle, dropped);
+    g_string_append_printf(buf, "Distinct locations  %u\n\n", sorted->len);
+    if (!sorted->len) {
+        return;
+    }
+
+    g_string_append_printf(buf, "%8s %7s %4s %18s %18s\n",
+                           "samples", "%", "mmu", "pc", "ram-addr");
+    for (i = 0; i < sorted->len && i < TCG_PROFILER_TEXT_ENTRIES; i++) {
+        TCGProfileEntry *e = g_ptr_array_index(sorted, i);
+
+        g_string_append_printf(buf, "%8" PRIu64 " %6.2f%% %4d "
+                               "0x%016" VADDR_PRIx " 0x%016" PRIx64 "\n",
+                               e->count, (double)e->count * 100 / samples,
+                               e->mmu_idx, e->pc, e->ram_addr);
+    }
+}
+
+static void tcg_profile_dump_folded(GString *buf, GPtrArray *sorted)
+{
+    guint i;
+
+    for (i = 0; i < sorted->len; i++) {
+        TCGProfileEntry *e = g_ptr_array_index(sorted, i);
+
+        g_string_append_printf(buf, "mmu%d;0x%" VADDR_PRIx "@0x%" PRIx64
+                               " %" PRIu64 "\n",
+                               e->mmu_idx, e->pc, e->ram_addr, e->count);
+    }
+    if (profiler.idle) {
+        g_string_append_printf(buf, "idle %" PRIu64 "\n", profiler.idle);
+    }
+}
+
+HumanReadableText *qmp_x_query_tcg_profile(bool has_format,
+                                           TcgProfileFormat format,
+                                           Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    g_autoptr(GPtrArray) sorted = g_ptr_array_new_with_free_func(g_free);
+    uint64_t samples = 0, dropped = 0;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "The profiler is only available with accel=tcg");
+        return NULL;
+    }
+
+    /* Snapshot the entries so that vCPUs are not blocked while printing. */
+    WITH_QEMU_LOCK_GUARD(&profiler.lock) {
+        if (profiler.entries) {
+            GHashTableIter iter;
+            gpointer e;
+
+            g_hash_table_iter_init(&iter, profiler.entries);
+            while (g_hash_table_iter_next(&iter, &e, NULL)) {
+                g_ptr_array_add(sorted, g_memdup2(e, sizeof(TCGProfileEntry)));
+            }
+        }
+        samples = profiler.samples;
+        dropped = profiler.dropped;
+    }
+    g_ptr_array_sort(sorted, tcg_profile_entry_cmp);
+
+    if (has_format && format == TCG_PROFILE_FORMAT_FOLDED) {
+        tcg_profile_dump_folded(buf, sorted);
+    } else {
+        tcg_profile_dump_text(buf, sorted, samples, dropped);
+    }
+
+    return human_readable_text_from_str(buf);
+}
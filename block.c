@@ -426,8 +426,8 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->block_status_cache.lock);
+    QTAILQ_INIT(&bs->block_status_cache.lru);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -5137,8 +5137,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
-    bs->block_status_cache = NULL;
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5526,6 +5525,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    qemu_mutex_destroy(&bs->block_status_cache.lock);
 
     g_free(bs);
 }
@@ -6839,6 +6839,9 @@ int bdrv_activate(BlockDriverState *bs, Error **errp)
      * of the image is tried.
      */
     if (bs->open_flags & BDRV_O_INACTIVE) {
+        /* The image may have been written to while we didn't own it */
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
         bs->open_flags &= ~BDRV_O_INACTIVE;
         ret = bdrv_refresh_perms(bs, NULL, errp);
         if (ret < 0) {
@@ -6980,6 +6983,9 @@ static int GRAPH_RDLOCK bdrv_inactivate_recurse(BlockDriverState *bs)
 
     bs->open_flags |= BDRV_O_INACTIVE;
 
+    /* Someone else may write to the image now, forget what we know about it */
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
     /*
      * Update permissions, they may differ for inactive nodes.
      * We only tried to loosen restrictions, so errors are not fatal, ignore
@@ -8335,41 +8341,85 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
-/**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
- */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+/* Bound the memory used by the block-status cache of each node */
+#define BDRV_BSC_MAX_ENTRIES 4096
+
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBlockStatusCacheEntry *e)
+{
+    interval_tree_remove(&e->node, &bsc->ranges);
+    QTAILQ_REMOVE(&bsc->lru, e, lru);
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries - 1);
+    g_free(e);
+}
+
+static BdrvBlockStatusCacheEntry *
+bdrv_bsc_insert_locked(BdrvBlockStatusCache *bsc,
+                       uint64_t start, uint64_t last, int status)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCacheEntry *e = g_new(BdrvBlockStatusCacheEntry, 1);
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    e->node.start = start;
+    e->node.last = last;
+    e->status = status;
+    interval_tree_insert(&e->node, &bsc->ranges);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, lru);
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries + 1);
+    return e;
+}
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+/*
+ * Remove [start, last] from the cached region @e, which overlaps it.  This
+ * may leave nothing, a head, a tail, or both of @e.
+ */
+static void bdrv_bsc_cut_locked(BdrvBlockStatusCache *bsc,
+                                BdrvBlockStatusCacheEntry *e,
+                                uint64_t start, uint64_t last)
+{
+    if (e->node.start < start && e->node.last > last) {
+        bdrv_bsc_insert_locked(bsc, last + 1, e->node.last, e->status);
+    }
+    if (e->node.start < start) {
+        /* Changing the end of a node requires reinserting it */
+        interval_tree_remove(&e->node, &bsc->ranges);
+        e->node.last = start - 1;
+        interval_tree_insert(&e->node, &bsc->ranges);
+    } else if (e->node.last > last) {
+        interval_tree_remove(&e->node, &bsc->ranges);
+        e->node.start = last + 1;
+        interval_tree_insert(&e->node, &bsc->ranges);
+    } else {
+        bdrv_bsc_remove_locked(bsc, e);
     }
-
-    return overlaps;
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
+int bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t *pnum,
+                    unsigned int *generation)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    BdrvBlockStatusCacheEntry *e;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    node = interval_tree_iter_first(&bsc->ranges, offset, offset);
+    if (!node) {
+        bsc->misses++;
+        *generation = qatomic_read(&bsc->generation);
+        return 0;
+    }
+
+    e = container_of(node, BdrvBlockStatusCacheEntry, node);
+    QTAILQ_REMOVE(&bsc->lru, e, lru);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, lru);
+    bsc->hits++;
+
+    *pnum = e->node.last + 1 - offset;
+    return e->status;
 }
 
 /**
@@ -8378,34 +8428,119 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    uint32_t align = MAX(bs->bl.request_alignment, 1);
+    uint64_t start, last;
+    IntervalTreeNode *node, *next;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (!bytes) {
+        return;
+    }
+
+    /*
+     * This is called for every write, so avoid taking the lock if nothing
+     * is cached, which is always the case for format and filter nodes.
+     * A concurrent bdrv_bsc_fill() either sees the new generation, or
+     * inserted its entry early enough for us to see it; see there.
+     */
+    qatomic_inc(&bsc->generation);
+    smp_mb__after_rmw();
+    if (!qatomic_read(&bsc->nb_entries)) {
+        return;
+    }
+
+    /*
+     * Cached regions must stay aligned to request_alignment, so drop all of
+     * every block touched by a (for example, discard) request.
+     */
+    start = QEMU_ALIGN_DOWN((uint64_t)offset, align);
+    last = QEMU_ALIGN_UP((uint64_t)offset + bytes, align) - 1;
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    for (node = interval_tree_iter_first(&bsc->ranges, start, last);
+         node; node = next) {
+        next = interval_tree_iter_next(node, start, last);
+        bdrv_bsc_cut_locked(bsc,
+                            container_of(node, BdrvBlockStatusCacheEntry, node),
+                            start, last);
     }
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
-{
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                   int status, unsigned int generation)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+    uint64_t iter_start = offset ? offset - 1 : 0;
+    uint64_t iter_last = last + 1;
+    IntervalTreeNode *node, *next;
+    BdrvBlockStatusCacheEntry *new_entry;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
+    assert(status == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) ||
+           status == (BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID));
+
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    if (generation != qatomic_read(&bsc->generation)) {
+        /* A write may have changed the status while the driver was asked */
+        return;
+    }
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    /*
+     * Merge with overlapping and adjacent regions of the same status, and
+     * cut overlapping regions of a different status (which must be stale).
+     */
+    for (node = interval_tree_iter_first(&bsc->ranges, iter_start, iter_last);
+         node; node = next) {
+        BdrvBlockStatusCacheEntry *e =
+            container_of(node, BdrvBlockStatusCacheEntry, node);
+
+        next = interval_tree_iter_next(node, iter_start, iter_last);
+        if (e->status == status) {
+            start = MIN(start, e->node.start);
+            last = MAX(last, e->node.last);
+            bdrv_bsc_remove_locked(bsc, e);
+        } else if (ranges_overlap(e->node.start,
+                                  e->node.last - e->node.start + 1,
+                                  offset, bytes)) {
+            bdrv_bsc_cut_locked(bsc, e, offset, offset + bytes - 1);
+        }
     }
+    new_entry = bdrv_bsc_insert_locked(bsc, start, last, status);
+
+    /*
+     * An invalidation that bumped the generation after the check above may
+     * have seen an empty cache and skipped the lock, so check again now
+     * that the entry is visible.  Pairs with smp_mb__after_rmw() in
+     * bdrv_bsc_invalidate_range().
+     */
+    smp_mb();
+    if (generation != qatomic_read(&bsc->generation)) {
+        bdrv_bsc_remove_locked(bsc, new_entry);
+        return;
+    }
+
+    while (bsc->nb_entries > BDRV_BSC_MAX_ENTRIES) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->lru));
+    }
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_bsc_get_stats(BlockDriverState *bs, uint64_t *hits,
+                        uint64_t *misses)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+    *hits = bsc->hits;
+    *misses = bsc->misses;
 }
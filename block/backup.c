@@ -46,6 +46,8 @@ typedef struct BackupBlockJob {
     BackupPerf perf;
 
     BlockCopyState *bcs;
+    /* Bytes copied with copy offloading, saved when bcs goes away */
+    uint64_t offloaded_bytes;
 
     bool wait;
     BlockCopyCallState *bg_bcs_call;
@@ -102,6 +104,8 @@ static void backup_clean(Job *job)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
     block_job_remove_all_bdrv(&s->common);
+    s->offloaded_bytes = block_copy_offloaded_bytes(s->bcs);
+    s->bcs = NULL;
     bdrv_cbw_drop(s->cbw);
 }
 
@@ -328,6 +332,16 @@ static void backup_set_speed(BlockJob *job, int64_t speed)
     }
 }
 
+static void backup_query(BlockJob *job, BlockJobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    info->u.backup = (BlockJobInfoBackup) {
+        .offloaded_bytes = s->bcs ? block_copy_offloaded_bytes(s->bcs) :
+                                    s->offloaded_bytes,
+    };
+}
+
 static bool backup_cancel(Job *job, bool force)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
@@ -350,6 +364,7 @@ static const BlockJobDriver backup_job_driver = {
         .cancel                 = backup_cancel,
     },
     .set_speed = backup_set_speed,
+    .query = backup_query,
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
@@ -491,7 +506,9 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->len = len;
     job->perf = *perf;
 
-    block_copy_set_copy_opts(bcs, perf->use_copy_range, compress);
+    block_copy_set_copy_opts(bcs, !perf->has_use_copy_range ? ON_OFF_AUTO_AUTO :
+                             perf->use_copy_range ? ON_OFF_AUTO_ON :
+                             ON_OFF_AUTO_OFF, compress);
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
 
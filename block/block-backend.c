@@ -2879,6 +2879,44 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+/* To be called between exactly one pair of blk_inc/dec_in_flight() */
+static int64_t coroutine_fn
+blk_co_do_sendfile(BlockBackend *blk, int64_t offset, int64_t bytes, int fd)
+{
+    int r;
+    IO_CODE();
+
+    blk_wait_while_drained(blk);
+    GRAPH_RDLOCK_GUARD();
+
+    r = blk_check_byte_request(blk, offset, bytes);
+    if (r) {
+        return r;
+    }
+    if (blk->public.throttle_group_member.throttle_state) {
+        return -ENOTSUP;
+    }
+
+    return bdrv_co_sendfile(blk->root, offset, bytes, fd);
+}
+
+/*
+ * See bdrv_co_sendfile().  Throttled BlockBackends are not supported, since
+ * the request size is not known in advance.
+ */
+int64_t coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset,
+                                     int64_t bytes, int fd)
+{
+    int64_t ret;
+    IO_OR_GS_CODE();
+
+    blk_inc_in_flight(blk);
+    ret = blk_co_do_sendfile(blk, offset, bytes, fd);
+    blk_dec_in_flight(blk);
+
+    return ret;
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     GLOBAL_STATE_CODE();
@@ -28,6 +28,7 @@
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -129,6 +130,7 @@ typedef struct BlockCopyState {
     int64_t max_transfer;
     uint64_t len;
     BdrvRequestFlags write_flags;
+    bool offload_capable;
 
     /*
      * Fields whose state changes throughout the execution
@@ -159,6 +161,7 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+    Stat64 offloaded_bytes;
 } BlockCopyState;
 
 /* Called with lock held */
@@ -281,7 +284,7 @@ static uint32_t block_copy_max_transfer(BdrvChild *source, BdrvChild *target)
                                      target->bs->bl.max_transfer));
 }
 
-void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
+void block_copy_set_copy_opts(BlockCopyState *s, OnOffAuto use_copy_range,
                               bool compress)
 {
     /* Keep BDRV_REQ_SERIALISING set (or not set) in block_copy_state_new() */
@@ -299,13 +302,49 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     } else if (compress) {
         /* Compression supports only cluster-size writes and no copy-range. */
         s->method = COPY_READ_WRITE_CLUSTER;
-    } else {
+    } else if (use_copy_range == ON_OFF_AUTO_ON ||
+               (use_copy_range == ON_OFF_AUTO_AUTO && s->offload_capable)) {
         /*
          * If copy range enabled, start with COPY_RANGE_SMALL, until first
          * successful copy_range (look at block_copy_do_copy).
          */
-        s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
+        s->method = COPY_RANGE_SMALL;
+    } else {
+        s->method = COPY_READ_WRITE;
+    }
+}
+
+/*
+ * Return the driver of the node at the bottom of @bs, following the primary
+ * children, if all nodes on the way can pass down copy_range requests.
+ */
+static GRAPH_RDLOCK BlockDriver *
+block_copy_offload_driver(BlockDriverState *bs)
+{
+    for (; bs; bs = bdrv_primary_bs(bs)) {
+        if (!bs->drv || !bs->drv->bdrv_co_copy_range_from ||
+            !bs->drv->bdrv_co_copy_range_to) {
+            return NULL;
+        }
+        if (!bdrv_primary_bs(bs)) {
+            return bs->drv;
+        }
     }
+    return NULL;
+}
+
+/*
+ * Copy offloading is used by default if source and target end up in the
+ * same protocol driver, e.g. two files where the kernel can share extents
+ * or copy the data without a round trip through QEMU.  Whether the kernel
+ * actually manages is only found out by the first request.
+ */
+static bool GRAPH_RDLOCK block_copy_offload_capable(BdrvChild *source,
+                                                    BdrvChild *target)
+{
+    BlockDriver *drv = block_copy_offload_driver(source->bs);
+
+    return drv && drv == block_copy_offload_driver(target->bs);
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -359,6 +398,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     int64_t cluster_size;
     BdrvDirtyBitmap *copy_bitmap;
     bool is_fleecing;
+    bool offload_capable;
 
     GLOBAL_STATE_CODE();
 
@@ -401,6 +441,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
      */
     bdrv_graph_rdlock_main_loop();
     is_fleecing = bdrv_chain_contains(target->bs, source->bs);
+    offload_capable = block_copy_offload_capable(source, target);
     bdrv_graph_rdunlock_main_loop();
 
     s = g_new(BlockCopyState, 1);
@@ -411,13 +452,14 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .cluster_size = cluster_size,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = (is_fleecing ? BDRV_REQ_SERIALISING : 0),
+        .offload_capable = offload_capable,
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
     };
 
-    block_copy_set_copy_opts(s, false, false);
+    block_copy_set_copy_opts(s, ON_OFF_AUTO_AUTO, false);
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
@@ -476,11 +518,13 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
  * @method is an in-out argument, so that copy_range can be either extended to
  * a full-size buffer or disabled if the copy_range attempt fails.  The output
  * value of @method should be used for subsequent tasks.
+ * @offloaded is set to true if the data was copied with copy_range.
  * Returns 0 on success.
  */
 static int coroutine_fn GRAPH_RDLOCK
 block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
-                   BlockCopyMethod *method, bool *error_is_read)
+                   BlockCopyMethod *method, bool *offloaded,
+                   bool *error_is_read)
 {
     int ret;
     int64_t nbytes = MIN(offset + bytes, s->len) - offset;
@@ -511,11 +555,20 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
         if (ret >= 0) {
             /* Successful copy-range, increase chunk size.  */
             *method = COPY_RANGE_FULL;
+            *offloaded = true;
             return 0;
         }
 
         trace_block_copy_copy_range_fail(s, offset, ret);
-        *method = COPY_READ_WRITE;
+        if (*method == COPY_RANGE_SMALL) {
+            /*
+             * copy_range never worked, most likely it is not supported for
+             * this pair of nodes.  Once it has worked, a failure only means
+             * that this chunk cannot be offloaded (e.g. it crosses
+             * compressed clusters) and later chunks still try.
+             */
+            *method = COPY_READ_WRITE;
+        }
         /* Fall through to read+write with allocated buffer */
 
     case COPY_READ_WRITE_CLUSTER:
@@ -563,12 +616,16 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     BlockCopyState *s = t->s;
     bool error_is_read = false;
+    bool offloaded = false;
     BlockCopyMethod method = t->method;
     int ret;
 
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
-                                 &error_is_read);
+                                 &offloaded, &error_is_read);
+    }
+    if (offloaded) {
+        stat64_add(&s->offloaded_bytes, t->req.bytes);
     }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
@@ -1029,6 +1086,11 @@ int64_t block_copy_cluster_size(BlockCopyState *s)
     return s->cluster_size;
 }
 
+uint64_t block_copy_offloaded_bytes(BlockCopyState *s)
+{
+    return stat64_get(&s->offloaded_bytes);
+}
+
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     qatomic_set(&s->skip_unallocated, skip);
@@ -79,8 +79,11 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
     BlockExport *exp = NULL;
     BlockDriverState *bs;
     BlockBackend *blk = NULL;
+    IOThread **iothreads = NULL;
+    unsigned int num_iothreads = 0;
     AioContext *ctx;
     uint64_t perm;
+    unsigned int i;
     int ret;
 
     GLOBAL_STATE_CODE();
@@ -115,7 +118,41 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
 
     ctx = bdrv_get_aio_context(bs);
 
-    if (export->iothread) {
+    if (export->iothread && export->iothreads) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
+        goto fail;
+    }
+
+    if (export->iothreads) {
+        strList *node;
+
+        if (!drv->supports_iothreads) {
+            error_setg(errp, "Export type '%s' does not support iothreads",
+                       BlockExportType_str(export->type));
+            goto fail;
+        }
+        for (node = export->iothreads; node; node = node->next) {
+            IOThread *iothread = iothread_by_id(node->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", node->value);
+                goto fail;
+            }
+            iothreads = g_renew(IOThread *, iothreads, num_iothreads + 1);
+            iothreads[num_iothreads++] = iothread;
+        }
+
+        /*
+         * The queues run in all of the iothreads at the same time, so the
+         * node cannot follow any single one of them. Keep it in the first.
+         */
+        ctx = iothread_get_aio_context(iothreads[0]);
+        ret = bdrv_try_change_aio_context(bs, ctx, NULL, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+        fixed_iothread = true;
+    } else if (export->iothread) {
         IOThread *iothread;
         AioContext *new_ctx;
         Error **set_context_errp;
@@ -178,7 +215,12 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
         .id         = g_strdup(export->id),
         .ctx        = ctx,
         .blk        = blk,
+        .iothreads  = iothreads,
+        .num_iothreads = num_iothreads,
     };
+    for (i = 0; i < num_iothreads; i++) {
+        object_ref(OBJECT(iothreads[i]));
+    }
 
     ret = drv->create(exp, export, errp);
     if (ret < 0) {
@@ -196,12 +238,49 @@ fail:
         blk_unref(blk);
     }
     if (exp) {
+        for (i = 0; i < exp->num_iothreads; i++) {
+            object_unref(OBJECT(exp->iothreads[i]));
+        }
+        g_free(exp->queues);
         g_free(exp->id);
         g_free(exp);
     }
+    g_free(iothreads);
     return NULL;
 }
 
+/*
+ * Sets up @num_queues queues for the export. If the export was created with
+ * a list of iothreads, the queues are distributed over them round-robin.
+ * Called by drivers from .create.
+ */
+void blk_exp_init_queues(BlockExport *exp, unsigned int num_queues)
+{
+    unsigned int i;
+
+    assert(!exp->queues && num_queues > 0);
+
+    exp->queues = g_new0(BlockExportQueue, num_queues);
+    exp->num_queues = num_queues;
+    for (i = 0; i < num_queues; i++) {
+        if (exp->num_iothreads) {
+            exp->queues[i].iothread = exp->iothreads[i % exp->num_iothreads];
+        }
+        stat64_init(&exp->queues[i].requests, 0);
+    }
+}
+
+/* Returns the AioContext in which queue @idx is processed */
+AioContext *blk_exp_queue_ctx(BlockExport *exp, unsigned int idx)
+{
+    assert(idx < exp->num_queues);
+
+    if (exp->queues[idx].iothread) {
+        return iothread_get_aio_context(exp->queues[idx].iothread);
+    }
+    return exp->ctx;
+}
+
 void blk_exp_ref(BlockExport *exp)
 {
     assert(qatomic_read(&exp->refcount) > 0);
@@ -212,6 +291,7 @@ void blk_exp_ref(BlockExport *exp)
 static void blk_exp_delete_bh(void *opaque)
 {
     BlockExport *exp = opaque;
+    unsigned int i;
 
     assert(exp->refcount == 0);
     QLIST_REMOVE(exp, next);
@@ -219,6 +299,11 @@ static void blk_exp_delete_bh(void *opaque)
     blk_set_dev_ops(exp->blk, NULL, NULL);
     blk_unref(exp->blk);
     qapi_event_send_block_export_deleted(exp->id);
+    for (i = 0; i < exp->num_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
+    g_free(exp->queues);
     g_free(exp->id);
     g_free(exp);
 }
@@ -350,6 +435,21 @@ BlockExportInfoList *qmp_query_block_exports(Error **errp)
             .shutting_down  = !exp->user_owned,
         };
 
+        if (exp->queues) {
+            BlockExportQueueInfoList **queues_tail = &info->queues;
+            unsigned int i;
+
+            for (i = 0; i < exp->num_queues; i++) {
+                BlockExportQueueInfo *queue = g_new0(BlockExportQueueInfo, 1);
+
+                queue->requests = stat64_get(&exp->queues[i].requests);
+                if (exp->queues[i].iothread) {
+                    queue->iothread = iothread_get_id(exp->queues[i].iothread);
+                }
+                QAPI_LIST_APPEND(queues_tail, queue);
+            }
+        }
+
         QAPI_LIST_APPEND(tail, info);
     }
 
@@ -59,6 +59,19 @@ static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
     }
 }
 
+static unsigned int vduse_blk_queue_index(VduseBlkExport *vblk_exp,
+                                          VduseVirtq *vq)
+{
+    unsigned int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+            return i;
+        }
+    }
+    g_assert_not_reached();
+}
+
 static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
 {
     vduse_queue_push(req->vq, &req->elem, in_len);
@@ -95,6 +108,7 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
 static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    unsigned int idx = vduse_blk_queue_index(vblk_exp, vq);
 
     while (1) {
         VduseBlkReq *req;
@@ -104,6 +118,7 @@ static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
             break;
         }
         req->vq = vq;
+        blk_exp_queue_add_request(&vblk_exp->export, idx);
 
         Coroutine *co =
             qemu_coroutine_create(vduse_blk_virtio_process_req, req);
@@ -131,13 +146,16 @@ static void on_vduse_vq_kick(void *opaque)
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    AioContext *ctx;
 
     if (!vblk_exp->vqs_started) {
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
-                       on_vduse_vq_kick, NULL, NULL, NULL, vq);
+    ctx = blk_exp_queue_ctx(&vblk_exp->export,
+                            vduse_blk_queue_index(vblk_exp, vq));
+    aio_set_fd_handler(ctx, vduse_queue_get_fd(vq), on_vduse_vq_kick,
+                       NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
 }
@@ -146,13 +164,15 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
     int fd = vduse_queue_get_fd(vq);
+    AioContext *ctx;
 
     if (fd < 0) {
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
-                       NULL, NULL, NULL, NULL, NULL);
+    ctx = blk_exp_queue_ctx(&vblk_exp->export,
+                            vduse_blk_queue_index(vblk_exp, vq));
+    aio_set_fd_handler(ctx, fd, NULL, NULL, NULL, NULL, NULL);
 }
 
 static const VduseOps vduse_blk_ops = {
@@ -305,6 +325,7 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         }
     }
     vblk_exp->num_queues = num_queues;
+    blk_exp_init_queues(exp, num_queues);
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
     vblk_exp->handler.logical_block_size = logical_block_size;
@@ -416,6 +437,7 @@ static void vduse_blk_exp_request_shutdown(BlockExport *exp)
 const BlockExportDriver blk_exp_vduse_blk = {
     .type               = BLOCK_EXPORT_TYPE_VDUSE_BLK,
     .instance_size      = sizeof(VduseBlkExport),
+    .supports_iothreads = true,
     .create             = vduse_blk_exp_create,
     .delete             = vduse_blk_exp_delete,
     .request_shutdown   = vduse_blk_exp_request_shutdown,
@@ -38,6 +38,7 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+    AioContext **queue_ctx; /* only with multiple iothreads */
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -82,6 +83,7 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 {
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
     VuVirtq *vq = vu_get_queue(vu_dev, idx);
 
     while (1) {
@@ -94,6 +96,7 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        blk_exp_queue_add_request(&vexp->export, idx);
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
@@ -322,6 +325,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     Error *local_err = NULL;
     uint64_t logical_block_size;
     uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
+    uint16_t i;
 
     vexp->blkcfg.wce = 0;
 
@@ -344,6 +348,15 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    blk_exp_init_queues(exp, num_queues);
+    if (exp->num_iothreads) {
+        vexp->queue_ctx = g_new(AioContext *, num_queues);
+        for (i = 0; i < num_queues; i++) {
+            vexp->queue_ctx[i] = blk_exp_queue_ctx(exp, i);
+        }
+    }
+
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -358,10 +371,12 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     blk_set_dev_ops(exp->blk, &vu_blk_dev_ops, vexp);
 
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
-                                 num_queues, &vu_blk_iface, errp)) {
+                                 num_queues, vexp->queue_ctx, &vu_blk_iface,
+                                 errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        g_free(vexp->queue_ctx);
         return -EADDRNOTAVAIL;
     }
 
@@ -375,11 +390,13 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    g_free(vexp->queue_ctx);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
     .type               = BLOCK_EXPORT_TYPE_VHOST_USER_BLK,
     .instance_size      = sizeof(VuBlkExport),
+    .supports_iothreads = true,
     .create             = vu_blk_exp_create,
     .delete             = vu_blk_exp_delete,
     .request_shutdown   = vu_blk_exp_request_shutdown,
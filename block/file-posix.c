@@ -66,6 +66,7 @@
 #ifdef __linux__
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <sys/sendfile.h>
 #include <sys/syscall.h>
 #include <sys/vfs.h>
 #if defined(CONFIG_BLKZONED)
@@ -162,6 +163,7 @@ typedef struct BDRVRawState {
     bool use_linux_io_uring:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
+    bool has_clone_range;
     bool needs_alignment;
     bool force_alignment;
     bool drop_cache;
@@ -215,6 +217,9 @@ typedef struct RawPosixAIOData {
             int aio_fd2;
             off_t aio_offset2;
         } copy_range;
+        struct {
+            int out_fd;
+        } sendfile;
         struct {
             PreallocMode prealloc;
             Error **errp;
@@ -738,6 +743,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_clone_range = true;
 
     if (fstat(s->fd, &st) < 0) {
         ret = -errno;
@@ -2154,6 +2160,48 @@ static int handle_aiocb_zone_mgmt(void *opaque)
 }
 #endif
 
+/*
+ * Share the extents of the source with the destination instead of copying
+ * the data.  This only works within a filesystem that supports reflinks
+ * (e.g. XFS or btrfs) and for ranges aligned to its block size; in all other
+ * cases the caller falls back to copy_file_range().
+ */
+static int do_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!s->has_clone_range) {
+        return -ENOTSUP;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret != 0 && errno == EINTR);
+    trace_file_clone_range(aiocb->bs, range.src_fd, range.src_offset,
+                           aiocb->copy_range.aio_fd2, range.dest_offset,
+                           range.src_length, ret < 0 ? -errno : 0);
+
+    if (ret == 0) {
+        return 0;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOTTY) {
+        /* The filesystem of the destination cannot share extents at all */
+        s->has_clone_range = false;
+    }
+    return -errno;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2161,6 +2209,10 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    if (do_clone_range(aiocb) == 0) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2188,6 +2240,32 @@ static int handle_aiocb_copy_range(void *opaque)
     return 0;
 }
 
+#ifdef CONFIG_LINUX
+static int handle_aiocb_sendfile(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    off_t in_off = aiocb->aio_offset;
+    ssize_t ret;
+
+    do {
+        ret = sendfile(aiocb->sendfile.out_fd, aiocb->aio_fildes, &in_off,
+                       aiocb->aio_nbytes);
+    } while (ret < 0 && errno == EINTR);
+    trace_file_sendfile(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                        aiocb->sendfile.out_fd, aiocb->aio_nbytes,
+                        ret < 0 ? -errno : ret);
+
+    if (ret < 0) {
+        return -errno;
+    }
+    if (ret == 0) {
+        /* The file was truncated under our feet */
+        return -EIO;
+    }
+    return ret;
+}
+#endif
+
 static int handle_aiocb_discard(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -3242,6 +3320,18 @@ static int coroutine_fn raw_co_block_status(BlockDriverState *bs,
     return ret | BDRV_BLOCK_OFFSET_VALID;
 }
 
+/*
+ * Without image locking, another process may fill holes behind our back, so
+ * they cannot be cached. The same goes for inactive images, which we don't
+ * hold the write lock for (e.g. while the migration destination owns them).
+ */
+static bool raw_block_status_may_cache_zero(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    return s->use_lock && !(bdrv_get_flags(bs) & BDRV_O_INACTIVE);
+}
+
 #if defined(__linux__)
 /* Verify that the file is not in the page cache */
 static void check_cache_dropped(BlockDriverState *bs, Error **errp)
@@ -3324,6 +3414,9 @@ raw_co_invalidate_cache(BlockDriverState *bs, Error **errp)
         return;
     }
 
+    /* Another process may have written to the image */
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
     if (!s->drop_cache) {
         return;
     }
@@ -3872,6 +3965,42 @@ raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(handle_aiocb_copy_range, &acb);
 }
 
+#ifdef CONFIG_LINUX
+static int64_t coroutine_fn
+raw_co_sendfile(BlockDriverState *bs, int64_t offset, int64_t bytes, int fd)
+{
+    BDRVRawState *s = bs->opaque;
+    RawPosixAIOData acb;
+
+    /*
+     * cache.direct=on asks for the host page cache to be bypassed, which
+     * sendfile() cannot do.
+     */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+    if (fd < 0 || !bytes) {
+        return 0;
+    }
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+
+    acb = (RawPosixAIOData) {
+        .bs             = bs,
+        .aio_type       = QEMU_AIO_SENDFILE,
+        .aio_fildes     = s->fd,
+        .aio_offset     = offset,
+        .aio_nbytes     = bytes,
+        .sendfile       = {
+            .out_fd         = fd,
+        },
+    };
+
+    return raw_thread_pool_submit(handle_aiocb_sendfile, &acb);
+}
+#endif
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3888,6 +4017,7 @@ BlockDriver bdrv_file = {
     .bdrv_co_create_opts = raw_co_create_opts,
     .bdrv_has_zero_init = bdrv_has_zero_init_1,
     .bdrv_co_block_status = raw_co_block_status,
+    .bdrv_block_status_may_cache_zero = raw_block_status_may_cache_zero,
     .bdrv_co_invalidate_cache = raw_co_invalidate_cache,
     .bdrv_co_pwrite_zeroes = raw_co_pwrite_zeroes,
     .bdrv_co_delete_file = raw_co_delete_file,
@@ -3898,6 +4028,9 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+#ifdef CONFIG_LINUX
+    .bdrv_co_sendfile       = raw_co_sendfile,
+#endif
     .bdrv_refresh_limits = raw_refresh_limits,
 
     .bdrv_co_truncate                   = raw_co_truncate,
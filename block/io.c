@@ -2017,6 +2017,14 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    /*
+     * Writes can turn cached zero regions into data.  Invalidating only now
+     * that the request is complete makes sure that block-status queries
+     * which ran concurrently with it do not fill the cache with stale
+     * results.
+     */
+    bdrv_bsc_invalidate_range(bs, offset, bytes);
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2354,6 +2362,28 @@ int bdrv_flush_all(void)
     return result;
 }
 
+/*
+ * Zero regions of a protocol node may only be cached if nothing can write to
+ * the image behind our back, i.e. the driver declares that other writers
+ * are kept out (for file-posix, only while image locking is enabled) and
+ * none of our parents allows them.
+ */
+static bool GRAPH_RDLOCK bdrv_bsc_may_cache_zero(BlockDriverState *bs)
+{
+    BdrvChild *c;
+
+    if (!bs->drv->bdrv_block_status_may_cache_zero ||
+        !bs->drv->bdrv_block_status_may_cache_zero(bs)) {
+        return false;
+    }
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        if (c->shared_perm & BLK_PERM_WRITE) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2443,31 +2473,40 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
     if (bs->drv->bdrv_co_block_status) {
+        unsigned int bsc_generation = 0;
+        int bsc_status = 0;
+
         /*
          * Use the block-status cache only for protocol nodes: Format
          * drivers are generally quick to inquire the status, but protocol
          * drivers often need to get information from outside of qemu, so
          * we do not have control over the actual implementation.  There
          * have been cases where inquiring the status took an unreasonably
-         * long time, and we can do nothing in qemu to fix it.
-         * This is especially problematic for images with large data areas,
-         * because finding the few holes in them and giving them special
-         * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * long time, and we can do nothing in qemu to fix it.  Even where
+         * it is quick, like lseek(SEEK_DATA/SEEK_HOLE) for file-posix, jobs
+         * and exports query the same regions over and over again, and on
+         * fragmented images every query costs system calls.  Therefore,
+         * we cache the data (and, where safe, zero) regions identified so
+         * far.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
-         * the block status for data regions to be DATA | OFFSET_VALID, and
-         * that the host offset is the same as the guest offset.
+         * the block status for cached regions to be DATA | OFFSET_VALID or
+         * ZERO | OFFSET_VALID, and that the host offset is the same as the
+         * guest offset.
          *
          * Note that it is possible that external writers zero parts of
          * the cached regions without the cache being invalidated, and so
          * we may report zeroes as data.  This is not catastrophic,
-         * however, because reporting zeroes as data is fine.
+         * however, because reporting zeroes as data is fine.  The other
+         * way around is not, which is why zero regions are only cached
+         * when no other writer is permitted (see bdrv_bsc_may_cache_zero()).
          */
-        if (QLIST_EMPTY(&bs->children) &&
-            bdrv_bsc_is_data(bs, aligned_offset, pnum))
-        {
-            ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+        if (QLIST_EMPTY(&bs->children)) {
+            bsc_status = bdrv_bsc_lookup(bs, aligned_offset, pnum,
+                                         &bsc_generation);
+        }
+        if (bsc_status) {
+            ret = bsc_status;
             local_file = bs;
             local_map = aligned_offset;
         } else {
@@ -2480,14 +2519,16 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
              * the cache is queried above.  Technically, we do not need to check
              * it here; the worst that can happen is that we fill the cache for
              * non-protocol nodes, and then it is never used.  However, filling
-             * the cache requires an RCU update, so double check here to avoid
-             * such an update if possible.
+             * the cache takes a lock, so double check here to avoid that if
+             * possible.
              *
              * Check want_zero, because we only want to update the cache when we
              * have accurate information about what is zero and what is data.
              */
             if (want_zero &&
-                ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
+                (ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) ||
+                 (ret == (BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID) &&
+                  bdrv_bsc_may_cache_zero(bs))) &&
                 QLIST_EMPTY(&bs->children))
             {
                 /*
@@ -2503,7 +2544,7 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
                  */
                 assert(local_file == bs);
                 assert(local_map == aligned_offset);
-                bdrv_bsc_fill(bs, aligned_offset, *pnum);
+                bdrv_bsc_fill(bs, aligned_offset, *pnum, ret, bsc_generation);
             }
         }
     } else {
@@ -3465,6 +3506,50 @@ static int coroutine_fn GRAPH_RDLOCK bdrv_co_copy_range_internal(
     return ret;
 }
 
+int64_t coroutine_fn
+bdrv_co_sendfile(BdrvChild *child, int64_t offset, int64_t bytes, int fd)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvTrackedRequest req;
+    int64_t ret;
+    IO_CODE();
+    assert_bdrv_graph_readable();
+
+    if (!bs || !bdrv_co_is_inserted(bs)) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_request32(offset, bytes, NULL, 0);
+    if (ret) {
+        return ret;
+    }
+
+    /*
+     * Copy-on-read and request alignment are implemented by copying through
+     * a buffer, so leave them to the caller's fallback path.  Any alignment
+     * requirement rules out sendfile, because a partial write leaves the
+     * rest of the request at an arbitrary offset.
+     */
+    if (!bs->drv->bdrv_co_sendfile || bs->encrypted ||
+        qatomic_read(&bs->copy_on_read) || bs->bl.request_alignment > 1) {
+        return -ENOTSUP;
+    }
+
+    if (fd < 0) {
+        return bs->drv->bdrv_co_sendfile(bs, offset, bytes, -1);
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    bdrv_wait_serialising_requests(&req);
+
+    ret = bs->drv->bdrv_co_sendfile(bs, offset, bytes, fd);
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
 /* Copy range from @src to @dst.
  *
  * See the comment of bdrv_co_copy_range for the parameter and return value
@@ -3644,6 +3729,10 @@ int coroutine_fn bdrv_co_truncate(BdrvChild *child, int64_t offset, bool exact,
         goto out;
     }
 
+    /* Whatever lies past the old or the new end of the image has changed */
+    bdrv_bsc_invalidate_range(bs, MIN(offset, old_size),
+                              INT64_MAX - MIN(offset, old_size));
+
     ret = bdrv_co_refresh_total_sectors(bs, offset >> BDRV_SECTOR_BITS);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not refresh total sector count");
@@ -24,11 +24,22 @@
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/*
+ * The number of requests in flight and their size adapt to the throughput
+ * and latency of the target.  They start at MAX_IN_FLIGHT and at
+ * buf_size / MAX_IN_FLIGHT (but at least MAX_IO_BYTES), and are reevaluated
+ * every ADAPT_INTERVAL_NS.
+ */
+#define MIN_IN_FLIGHT 2
+#define MAX_IN_FLIGHT_LIMIT 64
+#define ADAPT_INTERVAL_NS (100 * SCALE_MS)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -82,6 +93,9 @@ typedef struct MirrorBlockJob {
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
     unsigned in_flight;
+    /* Adaptive limits, max_in_flight is also read by mirror_query() */
+    unsigned max_in_flight;
+    int64_t max_io_bytes;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
@@ -93,6 +107,23 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+
+    /* Measurements of the current adaptation interval */
+    int64_t adapt_start_ns;
+    uint64_t adapt_bytes;
+    uint64_t adapt_latency_ns;
+    unsigned adapt_ops;
+    bool adapt_saturated;
+    int64_t adapt_dirty_count;
+    uint64_t adapt_cleared;
+    /* Lowest average write latency, rises slowly to follow the target */
+    uint64_t min_latency_ns;
+    uint64_t last_rate;
+
+    /* Published for query-block-jobs at the end of each interval */
+    Stat64 transfer_rate;
+    Stat64 dirty_rate;
+    Stat64 io_bytes;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -250,6 +281,7 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
+    int64_t start_ns;
 
     if (ret < 0) {
         BlockErrorAction action;
@@ -264,7 +296,14 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0) {
+        s->adapt_bytes += op->qiov.size;
+        s->adapt_latency_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                               start_ns;
+        s->adapt_ops++;
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -479,6 +518,45 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/*
+ * Return the length of the clean area starting at @offset if copying it
+ * merges the dirty areas on both of its sides into one request, or 0.  The
+ * area and the dirty chunk that follows it are at most @limit bytes long.
+ *
+ * Clean areas are only merged for sync=full.  With a base, they may be
+ * unallocated above it and would needlessly be allocated in the target;
+ * with sync=none, they are not meant to be copied at all.
+ *
+ * Called with the dirty bitmap lock held.
+ */
+static int64_t mirror_gap_to_merge(MirrorBlockJob *s, int64_t offset,
+                                   int64_t limit)
+{
+    int64_t max_gap = MIN(s->max_io_bytes / 8, limit - s->granularity);
+    int64_t next_dirty;
+
+    if (s->is_none_mode || s->base) {
+        return 0;
+    }
+
+    max_gap = QEMU_ALIGN_DOWN(MIN(max_gap, s->bdev_length - offset),
+                              s->granularity);
+    if (max_gap <= 0) {
+        return 0;
+    }
+
+    next_dirty = bdrv_dirty_bitmap_next_dirty(s->dirty_bitmap, offset,
+                                              max_gap + s->granularity);
+    if (next_dirty < 0 ||
+        find_next_bit(s->in_flight_bitmap, next_dirty / s->granularity + 1,
+                      offset / s->granularity) <=
+        next_dirty / s->granularity) {
+        return 0;
+    }
+
+    return next_dirty - offset;
+}
+
 static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source;
@@ -487,7 +565,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->max_io_bytes;
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -514,17 +592,29 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 
     job_pause_point(&s->common.job);
 
-    /* Find the number of consecutive dirty chunks following the first dirty
-     * one, and wait for in flight requests in them. */
+    /*
+     * Find the number of consecutive dirty chunks following the first dirty
+     * one, and wait for in flight requests in them.  Short clean gaps are
+     * included so that the target sees fewer and larger writes.
+     */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     while (nb_chunks * s->granularity < s->buf_size) {
         int64_t next_dirty;
         int64_t next_offset = offset + nb_chunks * s->granularity;
         int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
+        if (next_offset >= s->bdev_length) {
             break;
         }
+        if (!bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
+            int64_t gap = mirror_gap_to_merge(s, next_offset,
+                                              s->buf_size -
+                                              nb_chunks * s->granularity);
+            if (!gap) {
+                break;
+            }
+            nb_chunks += gap / s->granularity;
+            continue;
+        }
         if (test_bit(next_chunk, s->in_flight_bitmap)) {
             break;
         }
@@ -546,6 +636,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     bdrv_reset_dirty_bitmap_locked(s->dirty_bitmap, offset,
                                    nb_chunks * s->granularity);
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
+    s->adapt_cleared += nb_chunks * s->granularity;
 
     /* Before claiming an area in the in-flight bitmap, we have to
      * create a MirrorOp for it so that conflicting requests can wait
@@ -599,8 +690,9 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
+            s->adapt_saturated = true;
             mirror_wait_for_free_in_flight_slot(s);
         }
 
@@ -628,6 +720,64 @@ fail:
     g_free(pseudo_op);
 }
 
+/*
+ * Reevaluate the number and size of requests in flight based on the
+ * throughput and latency of the target writes since the last call, and
+ * publish the rates for query-block-jobs.  @cnt is the current dirty count.
+ *
+ * More concurrency is only tried while the job is limited by it and the
+ * throughput keeps improving; it is backed off as soon as the latency of
+ * the target grows well above the lowest value seen.  The request size
+ * follows the bandwidth-delay product of the target.
+ */
+static void mirror_adapt(MirrorBlockJob *s, int64_t cnt, int64_t now)
+{
+    int64_t elapsed = now - s->adapt_start_ns;
+    uint64_t rate = (double)s->adapt_bytes * NANOSECONDS_PER_SECOND / elapsed;
+    int64_t dirtied = cnt - s->adapt_dirty_count + s->adapt_cleared;
+    int64_t min_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    unsigned max_in_flight = s->max_in_flight;
+    int64_t max_io_bytes;
+
+    stat64_set(&s->transfer_rate, rate);
+    stat64_set(&s->dirty_rate,
+               (double)MAX(dirtied, 0) * NANOSECONDS_PER_SECOND / elapsed);
+
+    if (s->adapt_ops) {
+        uint64_t latency = s->adapt_latency_ns / s->adapt_ops;
+
+        s->min_latency_ns = s->min_latency_ns ?
+            MIN(latency, s->min_latency_ns + s->min_latency_ns / 16) :
+            latency;
+
+        if (latency > 2 * s->min_latency_ns) {
+            max_in_flight = MAX(MIN_IN_FLIGHT, max_in_flight * 3 / 4);
+        } else if (s->adapt_saturated && rate >= s->last_rate) {
+            max_in_flight = MIN(MAX_IN_FLIGHT_LIMIT,
+                                max_in_flight + MAX(1, max_in_flight / 4));
+        }
+
+        max_io_bytes = (double)rate * 2 * s->min_latency_ns /
+                       NANOSECONDS_PER_SECOND / max_in_flight;
+        max_io_bytes = QEMU_ALIGN_DOWN(max_io_bytes, s->granularity);
+        s->max_io_bytes = MIN(MAX(max_io_bytes, min_io_bytes),
+                              MAX(s->buf_size / 2, min_io_bytes));
+
+        trace_mirror_adapt(s, rate, latency, max_in_flight, s->max_io_bytes);
+        qatomic_set(&s->max_in_flight, max_in_flight);
+        stat64_set(&s->io_bytes, s->max_io_bytes);
+        s->last_rate = rate;
+    }
+
+    s->adapt_start_ns = now;
+    s->adapt_bytes = 0;
+    s->adapt_latency_ns = 0;
+    s->adapt_ops = 0;
+    s->adapt_saturated = false;
+    s->adapt_dirty_count = cnt;
+    s->adapt_cleared = 0;
+}
+
 static void mirror_free_init(MirrorBlockJob *s)
 {
     int granularity = s->granularity;
@@ -861,7 +1011,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1014,6 +1164,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     mirror_free_init(s);
 
+    qatomic_set(&s->max_in_flight, MAX_IN_FLIGHT);
+    s->max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    stat64_set(&s->io_bytes, s->max_io_bytes);
+
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
@@ -1030,8 +1184,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    s->adapt_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->adapt_dirty_count = bdrv_get_dirty_count(s->dirty_bitmap);
     for (;;) {
-        int64_t cnt, delta;
+        int64_t cnt, delta, now;
         bool should_complete;
 
         if (s->ret < 0) {
@@ -1054,6 +1210,11 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                                    s->bytes_in_flight + cnt +
                                    s->active_write_bytes_in_flight);
 
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (now - s->adapt_start_ns >= ADAPT_INTERVAL_NS) {
+            mirror_adapt(s, cnt, now);
+        }
+
         /* Note that even when no rate limit is applied we need to yield
          * periodically with no pending I/O so that bdrv_drain_all() returns.
          * We do so every BLKOCK_JOB_SLICE_TIME nanoseconds, or when there is
@@ -1064,9 +1225,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
+                s->adapt_saturated |= s->in_flight >= s->max_in_flight;
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
             } else if (cnt != 0) {
@@ -1293,6 +1455,27 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
     };
+
+    /* The rates are only meaningful while the job is still converging */
+    if (!info->ready && qatomic_read(&s->max_in_flight)) {
+        uint64_t rate = stat64_get(&s->transfer_rate);
+        uint64_t dirty_rate = stat64_get(&s->dirty_rate);
+
+        info->u.mirror.has_transfer_rate = true;
+        info->u.mirror.transfer_rate = rate;
+        info->u.mirror.has_dirty_rate = true;
+        info->u.mirror.dirty_rate = dirty_rate;
+        info->u.mirror.has_max_in_flight = true;
+        info->u.mirror.max_in_flight = qatomic_read(&s->max_in_flight);
+        info->u.mirror.has_chunk_size = true;
+        info->u.mirror.chunk_size = stat64_get(&s->io_bytes);
+        if (rate > dirty_rate && info->len >= info->offset) {
+            info->u.mirror.has_convergence_time = true;
+            info->u.mirror.convergence_time =
+                (double)(info->len - info->offset) * 1000 /
+                (rate - dirty_rate);
+        }
+    }
 }
 
 static const BlockJobDriver mirror_job_driver = {
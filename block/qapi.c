@@ -615,6 +615,14 @@ bdrv_query_bds_stats(BlockDriverState *bs, bool blk_level)
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    bdrv_bsc_get_stats(bs, &s->stats->block_status_cache_hits,
+                       &s->stats->block_status_cache_misses);
+    if (s->stats->block_status_cache_hits ||
+        s->stats->block_status_cache_misses) {
+        s->stats->has_block_status_cache_hits = true;
+        s->stats->has_block_status_cache_misses = true;
+    }
+
     s->driver_specific = bdrv_get_specific_stats(bs);
 
     parent_child = bdrv_primary_child(bs);
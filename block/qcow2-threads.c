@@ -38,24 +38,34 @@
 #include "block/thread-pool.h"
 #include "crypto.h"
 
+/*
+ * Run @func in a worker thread.  Compression and decompression are limited
+ * by the compress-threads option, encryption by the number of ciphers that
+ * the QCryptoBlock was opened with.
+ */
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg,
+                 bool compress)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
+    CoQueue *queue = compress ? &s->compress_task_queue :
+                                &s->thread_task_queue;
+    int *nb_threads = compress ? &s->nb_compress_threads : &s->nb_threads;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
-        qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+    while (*nb_threads >= (compress ? s->compress_threads :
+                                      QCOW2_MAX_THREADS)) {
+        qemu_co_queue_wait(queue, &s->lock);
     }
-    s->nb_threads++;
+    (*nb_threads)++;
     qemu_co_mutex_unlock(&s->lock);
 
     ret = thread_pool_submit_co(func, arg);
 
     qemu_co_mutex_lock(&s->lock);
-    s->nb_threads--;
-    qemu_co_queue_next(&s->thread_task_queue);
+    (*nb_threads)--;
+    qemu_co_queue_next(queue);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -347,7 +357,7 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    qcow2_co_process(bs, qcow2_compress_pool_func, &arg, true);
 
     return arg.ret;
 }
@@ -475,7 +485,8 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg,
+                                             false);
 }
 
 /*
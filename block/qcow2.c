@@ -701,6 +701,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_COMPRESS_THREADS,
     NULL
 };
 
@@ -817,6 +818,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of threads compressing or decompressing "
+                    "clusters in parallel",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -979,6 +986,7 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    int compress_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +999,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t compress_threads;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1079,6 +1088,16 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    compress_threads = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                                           QCOW2_MAX_THREADS);
+    if (compress_threads < 1 || compress_threads > INT_MAX) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS " must be between 1 "
+                   "and %d", INT_MAX);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compress_threads = compress_threads;
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1238,6 +1257,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->compress_threads = r->compress_threads;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1874,6 +1894,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->compress_task_queue);
+    qemu_co_queue_init(&s->compress_alloc_queue);
 
     return ret;
 
@@ -4663,14 +4685,22 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
+    int ret = 0;
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    unsigned int seq;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
+    /*
+     * Take a ticket before the first yield, so that the clusters end up in
+     * the image file in the order in which the writes were submitted even
+     * though they are compressed in parallel.
+     */
+    seq = qatomic_fetch_inc(&s->compress_seq_next);
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
@@ -4682,6 +4712,23 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
+
+    qemu_co_mutex_lock(&s->lock);
+    while (s->compress_seq_alloc != seq) {
+        qemu_co_queue_wait(&s->compress_alloc_queue, &s->lock);
+    }
+    if (out_len >= 0) {
+        ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
+                                                    &cluster_offset);
+        if (ret == 0) {
+            ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset,
+                                                out_len, true);
+        }
+    }
+    s->compress_seq_alloc++;
+    qemu_co_queue_restart_all(&s->compress_alloc_queue);
+    qemu_co_mutex_unlock(&s->lock);
+
     if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
@@ -4693,17 +4740,6 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         ret = -EINVAL;
         goto fail;
     }
-
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
-
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
         goto fail;
     }
@@ -4780,7 +4816,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS,
+                                        s->compress_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -5230,6 +5267,7 @@ qcow2_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     bdi->subcluster_size = s->subcluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     bdi->is_dirty = s->incompatible_features & QCOW2_INCOMPAT_DIRTY;
+    bdi->compressed_writes_ordered = true;
     return 0;
 }
 
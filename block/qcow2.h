@@ -150,6 +150,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESS_THREADS "compress-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -411,6 +412,25 @@ typedef struct BDRVQcow2State {
     CoQueue thread_task_queue;
     int nb_threads;
 
+    /*
+     * Compression and decompression run in their own group of worker threads
+     * whose size is configurable, unlike encryption, which is limited by the
+     * number of QCryptoBlock ciphers.
+     */
+    CoQueue compress_task_queue;
+    int nb_compress_threads;
+    int compress_threads;
+
+    /*
+     * Compressed clusters are allocated in the order in which the writes
+     * were submitted, even though the data is compressed in parallel.
+     * compress_seq_next is accessed atomically, compress_seq_alloc is
+     * protected by lock.
+     */
+    CoQueue compress_alloc_queue;
+    unsigned int compress_seq_next;
+    unsigned int compress_seq_alloc;
+
     BdrvChild *data_file;
 
     bool metadata_preallocation_checked;
@@ -0,0 +1,791 @@
+/*
+ * readahead filter driver
+ *
+ * The driver detects sequential read streams and prefetches the data ahead
+ * of them into a memory cache. It is intended to be inserted above an image
+ * that is read by many guests at the same time, typically a backing file
+ * shared by the qcow2 overlays of many VMs that boot at once: all overlays
+ * then share the prefetched data, and the small guest-sized reads of a boot
+ * are served from memory instead of each going to the image file.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+/* Granularity of the cache, and alignment of prefetch requests */
+#define READAHEAD_CHUNK_SIZE (64 * KiB)
+
+/* Maximum number of chunks read by a single prefetch request */
+#define READAHEAD_MAX_BATCH 32
+
+/* Number of sequential streams that are tracked at the same time */
+#define READAHEAD_MAX_STREAMS 16
+
+/* Number of sequential reads after which a stream is prefetched */
+#define READAHEAD_MIN_SEQUENTIAL 2
+
+typedef struct ReadaheadOpts {
+    int64_t prefetch_size;
+    int64_t cache_size;
+} ReadaheadOpts;
+
+typedef struct ReadaheadChunk {
+    int64_t index; /* offset / READAHEAD_CHUNK_SIZE, key in chunks */
+    int64_t bytes; /* READAHEAD_CHUNK_SIZE except at the end of the image */
+    void *buf;
+
+    /* A prefetch request is reading the data into @buf */
+    bool loading;
+
+    /* Removed from the cache while loading, to be freed by the prefetch */
+    bool stale;
+
+    /* Entry in lru, only for chunks that are not loading */
+    QTAILQ_ENTRY(ReadaheadChunk) next;
+} ReadaheadChunk;
+
+typedef struct ReadaheadStream {
+    /* Where the next read of the stream is expected */
+    int64_t next_offset;
+
+    /* End of the data that was prefetched for the stream */
+    int64_t prefetch_end;
+
+    unsigned int sequential;
+    uint64_t last_used;
+} ReadaheadStream;
+
+typedef struct BDRVReadaheadState {
+    ReadaheadOpts opts;
+
+    /*
+     * Requests can come from several threads at the same time, protect
+     * everything below.
+     */
+    QemuMutex lock;
+
+    /* int64_t chunk index -> ReadaheadChunk */
+    GHashTable *chunks;
+
+    /* Loaded chunks, least recently used first */
+    QTAILQ_HEAD(, ReadaheadChunk) lru;
+
+    /* Memory used by chunks, including those that are still loading */
+    int64_t cached_bytes;
+
+    /* Woken up whenever a prefetch request completes */
+    CoQueue chunk_loaded;
+
+    ReadaheadStream streams[READAHEAD_MAX_STREAMS];
+    uint64_t stream_clock;
+
+    /*
+     * Writes invalidate the cache when they start. Prefetch requests that
+     * overlap with a write in flight don't know whether they read the old or
+     * the new data, so they compare @write_gen to drop their result.
+     */
+    unsigned int writes_in_flight;
+    uint64_t write_gen;
+} BDRVReadaheadState;
+
+typedef struct ReadaheadPrefetch {
+    BlockDriverState *bs;
+    int64_t offset;
+    int64_t bytes;
+} ReadaheadPrefetch;
+
+#define READAHEAD_OPT_PREFETCH_SIZE "prefetch-size"
+#define READAHEAD_OPT_CACHE_SIZE "cache-size"
+static QemuOptsList runtime_opts = {
+    .name = "readahead",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READAHEAD_OPT_PREFETCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "how far ahead of a sequential stream to read, "
+                "default 1M",
+        },
+        {
+            .name = READAHEAD_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "memory used for prefetched data, default 64M",
+        },
+        { /* end of list */ }
+    },
+};
+
+static bool readahead_absorb_opts(ReadaheadOpts *dest, QDict *options,
+                                  Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return false;
+    }
+
+    dest->prefetch_size =
+        qemu_opt_get_size(opts, READAHEAD_OPT_PREFETCH_SIZE, 1 * MiB);
+    dest->cache_size =
+        qemu_opt_get_size(opts, READAHEAD_OPT_CACHE_SIZE, 64 * MiB);
+
+    qemu_opts_del(opts);
+
+    if (dest->prefetch_size < READAHEAD_CHUNK_SIZE ||
+        dest->prefetch_size > INT32_MAX) {
+        error_setg(errp, "prefetch-size parameter of readahead filter must "
+                   "be between %d and %d", READAHEAD_CHUNK_SIZE, INT32_MAX);
+        return false;
+    }
+
+    if (dest->cache_size < dest->prefetch_size) {
+        error_setg(errp, "cache-size parameter of readahead filter must not "
+                   "be smaller than prefetch-size");
+        return false;
+    }
+
+    return true;
+}
+
+static void readahead_chunk_free(ReadaheadChunk *chunk)
+{
+    qemu_vfree(chunk->buf);
+    g_free(chunk);
+}
+
+/*
+ * Accounts for the removal of @chunk from s->chunks and frees it, unless a
+ * prefetch request is still loading it. Called with s->lock held.
+ */
+static void readahead_drop_chunk_locked(BDRVReadaheadState *s,
+                                        ReadaheadChunk *chunk)
+{
+    s->cached_bytes -= chunk->bytes;
+    if (chunk->loading) {
+        chunk->stale = true;
+    } else {
+        QTAILQ_REMOVE(&s->lru, chunk, next);
+        readahead_chunk_free(chunk);
+    }
+}
+
+static void readahead_remove_chunk_locked(BDRVReadaheadState *s,
+                                          ReadaheadChunk *chunk)
+{
+    g_hash_table_remove(s->chunks, &chunk->index);
+    readahead_drop_chunk_locked(s, chunk);
+}
+
+typedef struct ReadaheadRange {
+    BDRVReadaheadState *s;
+    int64_t first;
+    int64_t last;
+} ReadaheadRange;
+
+static gboolean readahead_chunk_in_range(gpointer key, gpointer value,
+                                         gpointer opaque)
+{
+    ReadaheadChunk *chunk = value;
+    ReadaheadRange *range = opaque;
+
+    if (chunk->index < range->first || chunk->index > range->last) {
+        return false;
+    }
+    readahead_drop_chunk_locked(range->s, chunk);
+    return true;
+}
+
+/*
+ * Drops the cached data for [@offset, @offset + @bytes). Called with s->lock
+ * held.
+ */
+static void readahead_invalidate_locked(BDRVReadaheadState *s,
+                                        int64_t offset, int64_t bytes)
+{
+    ReadaheadRange range = {
+        .s      = s,
+        .first  = offset / READAHEAD_CHUNK_SIZE,
+        .last   = (offset + MAX(bytes, 1) - 1) / READAHEAD_CHUNK_SIZE,
+    };
+    int64_t i;
+
+    if (range.last - range.first >= g_hash_table_size(s->chunks)) {
+        g_hash_table_foreach_remove(s->chunks, readahead_chunk_in_range,
+                                    &range);
+        return;
+    }
+
+    for (i = range.first; i <= range.last; i++) {
+        ReadaheadChunk *chunk = g_hash_table_lookup(s->chunks, &i);
+
+        if (chunk) {
+            readahead_remove_chunk_locked(s, chunk);
+        }
+    }
+}
+
+/*
+ * Evicts the least recently used chunks until @bytes more bytes fit into the
+ * cache. Returns false if this is not possible because the rest of the cache
+ * is still loading. Called with s->lock held.
+ */
+static bool readahead_make_room_locked(BDRVReadaheadState *s, int64_t bytes)
+{
+    while (s->cached_bytes + bytes > s->opts.cache_size) {
+        ReadaheadChunk *chunk = QTAILQ_FIRST(&s->lru);
+
+        if (!chunk) {
+            return false;
+        }
+        readahead_remove_chunk_locked(s, chunk);
+    }
+    return true;
+}
+
+/*
+ * Updates the sequential streams for a read of [@offset, @offset + @bytes).
+ * Returns true and the range to prefetch in @pf_offset and @pf_bytes if the
+ * read belongs to a stream that needs more data. Called with s->lock held.
+ */
+static bool readahead_update_streams_locked(BDRVReadaheadState *s,
+                                            int64_t offset, int64_t bytes,
+                                            int64_t *pf_offset,
+                                            int64_t *pf_bytes)
+{
+    ReadaheadStream *stream = NULL;
+    ReadaheadStream *oldest = &s->streams[0];
+    int64_t end = offset + bytes;
+    int i;
+
+    for (i = 0; i < READAHEAD_MAX_STREAMS; i++) {
+        ReadaheadStream *st = &s->streams[i];
+
+        /*
+         * Guests usually have several sequential reads in flight, so they
+         * can arrive slightly out of order.
+         */
+        if (st->last_used &&
+            offset >= st->next_offset - READAHEAD_CHUNK_SIZE &&
+            offset <= st->next_offset + READAHEAD_CHUNK_SIZE) {
+            stream = st;
+            break;
+        }
+        if (st->last_used < oldest->last_used) {
+            oldest = st;
+        }
+    }
+
+    if (!stream) {
+        *oldest = (ReadaheadStream) {
+            .next_offset    = end,
+            .prefetch_end   = end,
+            .last_used      = ++s->stream_clock,
+        };
+        return false;
+    }
+
+    stream->next_offset = MAX(stream->next_offset, end);
+    stream->sequential++;
+    stream->last_used = ++s->stream_clock;
+
+    if (stream->sequential < READAHEAD_MIN_SEQUENTIAL) {
+        return false;
+    }
+
+    /* Stay a whole window ahead, refilling half a window at a time */
+    if (stream->prefetch_end >= end + s->opts.prefetch_size / 2) {
+        return false;
+    }
+
+    *pf_offset = MAX(stream->prefetch_end, end);
+    *pf_bytes = end + s->opts.prefetch_size - *pf_offset;
+    stream->prefetch_end = end + s->opts.prefetch_size;
+    return true;
+}
+
+/*
+ * Prefetches the chunks in [@offset, @offset + @bytes) that are not cached
+ * yet, in batches of up to READAHEAD_MAX_BATCH contiguous chunks.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+readahead_co_prefetch(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    ReadaheadChunk *batch[READAHEAD_MAX_BATCH];
+    int64_t len, idx, end_idx;
+
+    len = bdrv_co_getlength(bs->file->bs);
+    if (len < 0 || offset >= len) {
+        return;
+    }
+
+    idx = offset / READAHEAD_CHUNK_SIZE;
+    end_idx = DIV_ROUND_UP(MIN(offset + bytes, len), READAHEAD_CHUNK_SIZE);
+
+    while (idx < end_idx) {
+        QEMUIOVector qiov;
+        uint64_t write_gen;
+        bool valid;
+        int i, n = 0;
+        int ret;
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            if (s->writes_in_flight) {
+                return;
+            }
+            write_gen = s->write_gen;
+
+            while (idx < end_idx && g_hash_table_contains(s->chunks, &idx)) {
+                idx++;
+            }
+            while (idx < end_idx && n < READAHEAD_MAX_BATCH &&
+                   !g_hash_table_contains(s->chunks, &idx))
+            {
+                int64_t chunk_bytes = MIN(READAHEAD_CHUNK_SIZE,
+                                          len - idx * READAHEAD_CHUNK_SIZE);
+                ReadaheadChunk *chunk;
+                void *buf;
+
+                if (!readahead_make_room_locked(s, chunk_bytes)) {
+                    break;
+                }
+                buf = qemu_try_blockalign(bs->file->bs, chunk_bytes);
+                if (!buf) {
+                    break;
+                }
+
+                chunk = g_new(ReadaheadChunk, 1);
+                *chunk = (ReadaheadChunk) {
+                    .index      = idx,
+                    .bytes      = chunk_bytes,
+                    .buf        = buf,
+                    .loading    = true,
+                };
+                g_hash_table_insert(s->chunks, &chunk->index, chunk);
+                s->cached_bytes += chunk_bytes;
+                batch[n++] = chunk;
+                idx++;
+            }
+        }
+
+        if (!n) {
+            /* Either done, or out of memory */
+            return;
+        }
+
+        qemu_iovec_init(&qiov, n);
+        for (i = 0; i < n; i++) {
+            qemu_iovec_add(&qiov, batch[i]->buf, batch[i]->bytes);
+        }
+        ret = bdrv_co_preadv(bs->file, batch[0]->index * READAHEAD_CHUNK_SIZE,
+                             qiov.size, &qiov, 0);
+        trace_readahead_prefetch(bs, batch[0]->index * READAHEAD_CHUNK_SIZE,
+                                 qiov.size, ret);
+        qemu_iovec_destroy(&qiov);
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            valid = ret >= 0 && !s->writes_in_flight &&
+                    s->write_gen == write_gen;
+
+            for (i = 0; i < n; i++) {
+                ReadaheadChunk *chunk = batch[i];
+
+                chunk->loading = false;
+                if (chunk->stale) {
+                    readahead_chunk_free(chunk);
+                } else if (valid) {
+                    QTAILQ_INSERT_TAIL(&s->lru, chunk, next);
+                } else {
+                    g_hash_table_remove(s->chunks, &chunk->index);
+                    s->cached_bytes -= chunk->bytes;
+                    readahead_chunk_free(chunk);
+                }
+            }
+            qemu_co_queue_restart_all(&s->chunk_loaded);
+        }
+
+        if (!valid) {
+            return;
+        }
+    }
+}
+
+static void coroutine_fn readahead_prefetch_entry(void *opaque)
+{
+    ReadaheadPrefetch *pf = opaque;
+    BlockDriverState *bs = pf->bs;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        readahead_co_prefetch(bs, pf->offset, pf->bytes);
+    }
+
+    g_free(pf);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Starts prefetching in the background. The prefetch request runs in the
+ * current thread, after the calling coroutine has yielded.
+ */
+static void coroutine_fn
+readahead_start_prefetch(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    ReadaheadPrefetch *pf = g_new(ReadaheadPrefetch, 1);
+    Coroutine *co;
+
+    *pf = (ReadaheadPrefetch) {
+        .bs     = bs,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+
+    /* Keeps drain waiting until the prefetch request has completed */
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(readahead_prefetch_entry, pf);
+    aio_co_enter(qemu_get_current_aio_context(), co);
+}
+
+/*
+ * Returns true if [@offset, @offset + @bytes) is completely in the cache and
+ * no part of it is still loading. If a part is missing, *@loading tells
+ * whether waiting for a prefetch request can help. Called with s->lock held.
+ */
+static bool readahead_lookup_locked(BDRVReadaheadState *s, int64_t offset,
+                                    int64_t bytes, bool *loading)
+{
+    int64_t end = offset + bytes;
+    int64_t i;
+
+    *loading = false;
+    for (i = offset / READAHEAD_CHUNK_SIZE;
+         i * READAHEAD_CHUNK_SIZE < end;
+         i++)
+    {
+        ReadaheadChunk *chunk = g_hash_table_lookup(s->chunks, &i);
+
+        if (!chunk ||
+            (chunk->bytes < READAHEAD_CHUNK_SIZE &&
+             i * READAHEAD_CHUNK_SIZE + chunk->bytes < end)) {
+            *loading = false;
+            return false;
+        }
+        if (chunk->loading) {
+            *loading = true;
+        }
+    }
+    return !*loading;
+}
+
+/*
+ * Copies [@offset, @offset + @bytes) into @qiov if it is cached. Waits for
+ * prefetch requests that are loading the data.
+ */
+static bool coroutine_fn
+readahead_co_read_cached(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                         QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    bool loading;
+    int64_t i;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    if (!g_hash_table_size(s->chunks)) {
+        return false;
+    }
+
+    while (!readahead_lookup_locked(s, offset, bytes, &loading)) {
+        if (!loading) {
+            return false;
+        }
+        qemu_co_queue_wait(&s->chunk_loaded, &s->lock);
+    }
+
+    for (i = offset / READAHEAD_CHUNK_SIZE;
+         i * READAHEAD_CHUNK_SIZE < end;
+         i++)
+    {
+        ReadaheadChunk *chunk = g_hash_table_lookup(s->chunks, &i);
+        int64_t chunk_offset = i * READAHEAD_CHUNK_SIZE;
+        int64_t from = MAX(offset, chunk_offset);
+        int64_t to = MIN(end, chunk_offset + chunk->bytes);
+
+        qemu_iovec_from_buf(qiov, qiov_offset + (from - offset),
+                            chunk->buf + (from - chunk_offset), to - from);
+
+        QTAILQ_REMOVE(&s->lru, chunk, next);
+        QTAILQ_INSERT_TAIL(&s->lru, chunk, next);
+    }
+
+    trace_readahead_cache_hit(bs, offset, bytes);
+    return true;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                         QEMUIOVector *qiov, size_t qiov_offset,
+                         BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t pf_offset, pf_bytes;
+    bool prefetch;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        prefetch = readahead_update_streams_locked(s, offset, bytes,
+                                                   &pf_offset, &pf_bytes);
+    }
+    if (prefetch) {
+        readahead_start_prefetch(bs, pf_offset, pf_bytes);
+    }
+
+    if (readahead_co_read_cached(bs, offset, bytes, qiov, qiov_offset)) {
+        return 0;
+    }
+
+    return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+}
+
+static void readahead_write_begin(BDRVReadaheadState *s, int64_t offset,
+                                  int64_t bytes)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    s->writes_in_flight++;
+    readahead_invalidate_locked(s, offset, bytes);
+}
+
+static void readahead_write_end(BDRVReadaheadState *s)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    s->writes_in_flight--;
+    s->write_gen++;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_write_begin(s, offset, bytes);
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    readahead_write_end(s);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
+                           int64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_write_begin(s, offset, bytes);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    readahead_write_end(s);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_write_begin(s, offset, bytes);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    readahead_write_end(s);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                      PreallocMode prealloc, BdrvRequestFlags flags,
+                      Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t start = MIN(offset, bs->total_sectors * BDRV_SECTOR_SIZE);
+    int ret;
+
+    /* Drop everything after the new or old end, including short chunks */
+    start = QEMU_ALIGN_DOWN(start, READAHEAD_CHUNK_SIZE);
+    readahead_write_begin(s, start, INT64_MAX - start);
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    readahead_write_end(s);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK readahead_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+readahead_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static int readahead_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    if (!readahead_absorb_opts(&s->opts, options, errp)) {
+        return -EINVAL;
+    }
+
+    if (bs->file->bs->bl.request_alignment > READAHEAD_CHUNK_SIZE) {
+        error_setg(errp, "readahead filter does not support a request "
+                   "alignment larger than %d", READAHEAD_CHUNK_SIZE);
+        return -EINVAL;
+    }
+
+    qemu_mutex_init(&s->lock);
+    s->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    qemu_co_queue_init(&s->chunk_loaded);
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void readahead_close(BlockDriverState *bs)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    ReadaheadChunk *chunk, *next;
+
+    GLOBAL_STATE_CODE();
+
+    /* Drained before closing, so no chunk is loading any more */
+    QTAILQ_FOREACH_SAFE(chunk, &s->lru, next, next) {
+        readahead_chunk_free(chunk);
+    }
+    g_hash_table_destroy(s->chunks);
+    qemu_mutex_destroy(&s->lock);
+}
+
+static int readahead_reopen_prepare(BDRVReopenState *reopen_state,
+                                    BlockReopenQueue *queue, Error **errp)
+{
+    ReadaheadOpts *opts = g_new0(ReadaheadOpts, 1);
+
+    GLOBAL_STATE_CODE();
+
+    if (!readahead_absorb_opts(opts, reopen_state->options, errp)) {
+        g_free(opts);
+        return -EINVAL;
+    }
+
+    reopen_state->opaque = opts;
+
+    return 0;
+}
+
+static void readahead_reopen_commit(BDRVReopenState *state)
+{
+    BDRVReadaheadState *s = state->bs->opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    s->opts = *(ReadaheadOpts *)state->opaque;
+    readahead_make_room_locked(s, 0);
+
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void readahead_reopen_abort(BDRVReopenState *state)
+{
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void readahead_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                 BdrvChildRole role,
+                                 BlockReopenQueue *reopen_queue,
+                                 uint64_t perm, uint64_t shared,
+                                 uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+
+    /*
+     * The cache is only invalidated by writes through this node, so nobody
+     * else may change the data underneath.
+     */
+    *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+static const char *const readahead_strong_runtime_opts[] = {
+    READAHEAD_OPT_PREFETCH_SIZE,
+    READAHEAD_OPT_CACHE_SIZE,
+
+    NULL
+};
+
+static BlockDriver bdrv_readahead_filter = {
+    .format_name            = "readahead",
+    .instance_size          = sizeof(BDRVReadaheadState),
+
+    .bdrv_open              = readahead_open,
+    .bdrv_close             = readahead_close,
+    .bdrv_co_getlength      = readahead_co_getlength,
+
+    .bdrv_reopen_prepare    = readahead_reopen_prepare,
+    .bdrv_reopen_commit     = readahead_reopen_commit,
+    .bdrv_reopen_abort      = readahead_reopen_abort,
+
+    .bdrv_co_preadv_part    = readahead_co_preadv_part,
+    .bdrv_co_pwritev_part   = readahead_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes  = readahead_co_pwrite_zeroes,
+    .bdrv_co_pdiscard       = readahead_co_pdiscard,
+    .bdrv_co_flush          = readahead_co_flush,
+    .bdrv_co_truncate       = readahead_co_truncate,
+
+    .bdrv_child_perm        = readahead_child_perm,
+
+    .is_filter              = true,
+    .strong_runtime_opts    = readahead_strong_runtime_opts,
+};
+
+static void bdrv_readahead_init(void)
+{
+    bdrv_register(&bdrv_readahead_filter);
+}
+
+block_init(bdrv_readahead_init);
@@ -456,7 +456,11 @@ static void replication_start(ReplicationState *rs, ReplicationMode mode,
     BdrvChild *active_disk, *hidden_disk, *secondary_disk;
     int64_t active_length, hidden_length, disk_length;
     Error *local_err = NULL;
-    BackupPerf perf = { .use_copy_range = true, .max_workers = 1 };
+    BackupPerf perf = {
+        .has_use_copy_range = true,
+        .use_copy_range = true,
+        .max_workers = 1,
+    };
 
     GLOBAL_STATE_CODE();
 
@@ -32,6 +32,7 @@
 #include "sysemu/qtest.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-block-core.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
@@ -39,6 +40,15 @@ static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
 
+/* Fixed cost of a request for the weighted scheduler, in bytes */
+#define THROTTLE_GROUP_REQ_COST 4096
+
+/* A throttled request of a ThrottleGroupMember */
+typedef struct ThrottleGroupWaiter {
+    int64_t start_ns;
+    QTAILQ_ENTRY(ThrottleGroupWaiter) next;
+} ThrottleGroupWaiter;
+
 /* The ThrottleGroup structure (with its ThrottleState) is shared
  * among different ThrottleGroupMembers and it's independent from
  * AioContext, so in order to use it from different threads it needs
@@ -70,12 +80,17 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
+    ThrottleGroupScheduler scheduler;
+    /* Virtual time of the request that was dispatched last */
+    uint64_t vclock[THROTTLE_MAX];
+    /* Sum of dispatched_bytes of the current members */
+    uint64_t dispatched_bytes[THROTTLE_MAX];
 
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
@@ -206,6 +221,50 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
     return tgm->pending_reqs[direction];
 }
 
+/*
+ * Return the ThrottleGroupMember with pending requests that the weighted
+ * scheduler runs next: the one whose oldest request has exceeded its latency
+ * target by the longest time, or else the one with the lowest virtual time.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ * @ret:       the next ThrottleGroupMember, or NULL if no member has pending
+ *             requests.
+ */
+static ThrottleGroupMember *next_weighted_token(ThrottleGroup *tg,
+                                                ThrottleDirection direction)
+{
+    ThrottleGroupMember *token, *best = NULL, *late = NULL;
+    int64_t now = qemu_clock_get_ns(tg->clock_type);
+    int64_t late_deadline = INT64_MAX;
+
+    QLIST_FOREACH(token, &tg->head, round_robin) {
+        if (!tgm_has_pending_reqs(token, direction)) {
+            continue;
+        }
+        if (token->latency_target_ns &&
+            !QTAILQ_EMPTY(&token->waiters[direction])) {
+            ThrottleGroupWaiter *oldest;
+            int64_t deadline;
+
+            oldest = QTAILQ_FIRST(&token->waiters[direction]);
+            deadline = oldest->start_ns + token->latency_target_ns;
+
+            if (deadline <= now && deadline < late_deadline) {
+                late = token;
+                late_deadline = deadline;
+            }
+        }
+        if (!best || token->vtime[direction] < best->vtime[direction]) {
+            best = token;
+        }
+    }
+
+    return late ?: best;
+}
+
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
  * I/O requests.
  *
@@ -232,6 +291,11 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
         return tgm;
     }
 
+    if (tg->scheduler == THROTTLE_GROUP_SCHEDULER_WEIGHTED) {
+        token = next_weighted_token(tg, direction);
+        return token ?: tgm;
+    }
+
     start = token = tg->tokens[direction];
 
     /* get next bs round in round robin style */
@@ -336,8 +400,13 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
 
     /* If it doesn't have to wait, queue it for immediate execution */
     if (!must_wait) {
-        /* Give preference to requests from the current tgm */
+        /*
+         * Give preference to requests from the current tgm, unless the
+         * weighted scheduler picked another one
+         */
         if (qemu_in_coroutine() &&
+            (tg->scheduler != THROTTLE_GROUP_SCHEDULER_WEIGHTED ||
+             token == tgm) &&
             throttle_group_co_restart_queue(tgm, direction)) {
             token = tgm;
         } else {
@@ -350,6 +419,27 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/*
+ * Account a request that is about to be executed to the weighted scheduler.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the ThrottleGroupMember that issued the request
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_charge(ThrottleGroupMember *tgm, int64_t bytes,
+                                  ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    uint64_t cost = bytes + THROTTLE_GROUP_REQ_COST;
+
+    tg->vclock[direction] = MAX(tg->vclock[direction], tgm->vtime[direction]);
+    tgm->vtime[direction] += cost * THROTTLE_GROUP_DEFAULT_WEIGHT / tgm->weight;
+    tgm->dispatched_bytes[direction] += bytes;
+    tg->dispatched_bytes[direction] += bytes;
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -371,24 +461,37 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     qemu_mutex_lock(&tg->lock);
 
+    /* A member that was idle must not have accumulated any credit */
+    if (!tgm->pending_reqs[direction]) {
+        tgm->vtime[direction] = MAX(tgm->vtime[direction],
+                                    tg->vclock[direction]);
+    }
+
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(tgm, direction);
     must_wait = throttle_group_schedule_timer(token, direction);
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
+        ThrottleGroupWaiter waiter = {
+            .start_ns = qemu_clock_get_ns(tg->clock_type),
+        };
+
         tgm->pending_reqs[direction]++;
+        QTAILQ_INSERT_TAIL(&tgm->waiters[direction], &waiter, next);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
+        QTAILQ_REMOVE(&tgm->waiters[direction], &waiter, next);
         tgm->pending_reqs[direction]--;
     }
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, direction, bytes);
+    throttle_group_charge(tgm, bytes, direction);
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
@@ -465,6 +568,63 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm)
     }
 }
 
+/*
+ * Set the weight and the latency target of a ThrottleGroupMember for the
+ * weighted scheduler.
+ *
+ * @tgm:               a ThrottleGroupMember that is a member of a group
+ * @weight:            the weight, between 1 and THROTTLE_GROUP_MAX_WEIGHT
+ * @latency_target_ns: the latency target in nanoseconds, or 0 for none
+ */
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned weight,
+                               int64_t latency_target_ns)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    assert(weight >= 1 && weight <= THROTTLE_GROUP_MAX_WEIGHT);
+    assert(latency_target_ns >= 0);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    tgm->weight = weight;
+    tgm->latency_target_ns = latency_target_ns;
+}
+
+/*
+ * Fill in the statistics of a ThrottleGroupMember.
+ *
+ * @tgm:   a ThrottleGroupMember that is a member of a group
+ * @stats: the statistics will be written here
+ */
+void throttle_group_get_member_stats(ThrottleGroupMember *tgm,
+                                     BlockStatsSpecificThrottle *stats)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleGroupMember *iter;
+    uint64_t total_weight = 0, total_bytes;
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    QLIST_FOREACH(iter, &tg->head, round_robin) {
+        total_weight += iter->weight;
+    }
+    total_bytes = tg->dispatched_bytes[THROTTLE_READ] +
+                  tg->dispatched_bytes[THROTTLE_WRITE];
+
+    *stats = (BlockStatsSpecificThrottle) {
+        .scheduler = tg->scheduler,
+        .weight = tgm->weight,
+        .has_latency_target = tgm->latency_target_ns != 0,
+        .latency_target = tgm->latency_target_ns / SCALE_US,
+        .share = (double)tgm->weight / total_weight,
+        .usage = total_bytes ?
+            (double)(tgm->dispatched_bytes[THROTTLE_READ] +
+                     tgm->dispatched_bytes[THROTTLE_WRITE]) / total_bytes : 0,
+        .queue_depth_read = tgm->pending_reqs[THROTTLE_READ],
+        .queue_depth_write = tgm->pending_reqs[THROTTLE_WRITE],
+        .bytes_read = tgm->dispatched_bytes[THROTTLE_READ],
+        .bytes_write = tgm->dispatched_bytes[THROTTLE_WRITE],
+    };
+}
+
 /* Update the throttle configuration for a particular group. Similar
  * to throttle_config(), but guarantees atomicity within the
  * throttling group.
@@ -553,12 +713,17 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qatomic_set(&tgm->restart_pending, 0);
 
     QEMU_LOCK_GUARD(&tg->lock);
+    tgm->weight = THROTTLE_GROUP_DEFAULT_WEIGHT;
+    tgm->latency_target_ns = 0;
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
     for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
         if (!tg->tokens[dir]) {
             tg->tokens[dir] = tgm;
         }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
+        QTAILQ_INIT(&tgm->waiters[dir]);
+        tgm->vtime[dir] = tg->vclock[dir];
+        tgm->dispatched_bytes[dir] = 0;
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -610,6 +775,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
                 }
                 tg->tokens[dir] = token;
             }
+            tg->dispatched_bytes[dir] -= tgm->dispatched_bytes[dir];
         }
 
         /* remove the current tgm from the list */
@@ -929,6 +1095,22 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static int throttle_group_get_scheduler(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    return tg->scheduler;
+}
+
+static void throttle_group_set_scheduler(Object *obj, int value, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    tg->scheduler = value;
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -958,6 +1140,12 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    object_class_property_add_enum(klass,
+                                   "scheduler", "ThrottleGroupScheduler",
+                                   &ThrottleGroupScheduler_lookup,
+                                   throttle_group_get_scheduler,
+                                   throttle_group_set_scheduler);
 }
 
 static const TypeInfo throttle_group_info = {
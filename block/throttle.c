@@ -25,6 +25,16 @@
 #include "qemu/option.h"
 #include "qemu/throttle-options.h"
 #include "qapi/error.h"
+#include "qemu/timer.h"
+
+#define THROTTLE_OPT_WEIGHT "weight"
+#define THROTTLE_OPT_LATENCY_TARGET "latency-target"
+
+typedef struct BDRVThrottleReopenState {
+    char *group;
+    unsigned weight;
+    int64_t latency_target_ns;
+} BDRVThrottleReopenState;
 
 static QemuOptsList throttle_opts = {
     .name = "throttle",
@@ -35,19 +45,31 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = THROTTLE_OPT_WEIGHT,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Weight in the throttle group",
+        },
+        {
+            .name = THROTTLE_OPT_LATENCY_TARGET,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Latency target in the throttle group (in microseconds)",
+        },
         { /* end of list */ }
     },
 };
 
 /*
- * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * If this function succeeds then the options are stored in @r and the
+ * throttle group name must be freed by the caller.
+ * If there's an error then @r remains unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, BDRVThrottleReopenState *r,
+                                  Error **errp)
 {
     int ret;
     const char *group_name;
+    uint64_t weight, latency_target;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -66,7 +88,25 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
-    *group = g_strdup(group_name);
+    weight = qemu_opt_get_number(opts, THROTTLE_OPT_WEIGHT,
+                                 THROTTLE_GROUP_DEFAULT_WEIGHT);
+    if (weight < 1 || weight > THROTTLE_GROUP_MAX_WEIGHT) {
+        error_setg(errp, "The weight must be between 1 and %d",
+                   THROTTLE_GROUP_MAX_WEIGHT);
+        ret = -EINVAL;
+        goto fin;
+    }
+
+    latency_target = qemu_opt_get_number(opts, THROTTLE_OPT_LATENCY_TARGET, 0);
+    if (latency_target > INT64_MAX / SCALE_US) {
+        error_setg(errp, "The latency target is too big");
+        ret = -EINVAL;
+        goto fin;
+    }
+
+    r->group = g_strdup(group_name);
+    r->weight = weight;
+    r->latency_target_ns = latency_target * SCALE_US;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -77,7 +117,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
                          int flags, Error **errp)
 {
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group;
+    BDRVThrottleReopenState r;
     int ret;
 
     ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
@@ -92,11 +132,12 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &r, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
-        g_free(group);
+        throttle_group_register_tgm(tgm, r.group, bdrv_get_aio_context(bs));
+        throttle_group_set_weight(tgm, r.weight, r.latency_target_ns);
+        g_free(r.group);
     }
 
     return ret;
@@ -185,13 +226,13 @@ static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
     int ret;
-    char *group = NULL;
+    BDRVThrottleReopenState *r = g_new0(BDRVThrottleReopenState, 1);
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    ret = throttle_parse_options(reopen_state->options, r, errp);
+    reopen_state->opaque = r;
     return ret;
 }
 
@@ -199,24 +240,42 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    BDRVThrottleReopenState *r = reopen_state->opaque;
 
-    assert(group);
+    assert(r->group);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(r->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_register_tgm(tgm, r->group, bdrv_get_aio_context(bs));
     }
-    g_free(reopen_state->opaque);
+    throttle_group_set_weight(tgm, r->weight, r->latency_target_ns);
+    g_free(r->group);
+    g_free(r);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    BDRVThrottleReopenState *r = reopen_state->opaque;
+
+    if (r) {
+        g_free(r->group);
+        g_free(r);
+    }
     reopen_state->opaque = NULL;
 }
 
+static BlockStatsSpecific *throttle_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    ThrottleGroupMember *tgm = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_THROTTLE;
+    throttle_group_get_member_stats(tgm, &stats->u.throttle);
+
+    return stats;
+}
+
 static void throttle_drain_begin(BlockDriverState *bs)
 {
     ThrottleGroupMember *tgm = bs->opaque;
@@ -267,6 +326,8 @@ static BlockDriver bdrv_throttle = {
     .bdrv_drain_begin                   =   throttle_drain_begin,
     .bdrv_drain_end                     =   throttle_drain_end,
 
+    .bdrv_get_specific_stats            =   throttle_get_specific_stats,
+
     .is_filter                          =   true,
     .strong_runtime_opts                =   throttle_strong_runtime_opts,
 };
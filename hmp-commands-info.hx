@@ -283,6 +283,21 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcgprofile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show dynamic compiler sampling profile",
+    },
+#endif
+
+SRST
+  ``info tcgprofile``
+    Show the guest code locations sampled by the dynamic compiler
+    profiler (see ``x-tcg-profiler-start``).
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
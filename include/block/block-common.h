@@ -148,6 +148,12 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if concurrent compressed writes are laid out in the image file in
+     * the order in which they were submitted, so that callers do not need to
+     * wait for one compressed write to complete before issuing the next one
+     */
+    bool compressed_writes_ordered;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
@@ -28,8 +28,12 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
                                      const BdrvDirtyBitmap *bitmap,
                                      Error **errp);
 
-/* Function should be called prior any actual copy request */
-void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
+/*
+ * Function should be called prior any actual copy request.  With
+ * @use_copy_range set to auto, copy offloading is used if source and target
+ * are stored by the same protocol driver.
+ */
+void block_copy_set_copy_opts(BlockCopyState *s, OnOffAuto use_copy_range,
                               bool compress);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
@@ -96,6 +100,8 @@ void block_copy_call_cancel(BlockCopyCallState *call_state);
 
 BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
+/* Number of bytes that were copied with copy offloading so far */
+uint64_t block_copy_offloaded_bytes(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
 #endif /* BLOCK_COPY_H */
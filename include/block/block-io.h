@@ -328,6 +328,32 @@ bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
                    int64_t bytes, BdrvRequestFlags read_flags,
                    BdrvRequestFlags write_flags);
 
+/**
+ *
+ * bdrv_co_sendfile:
+ *
+ * Write data from @child directly to the non-blocking file descriptor @fd
+ * (usually a socket), without copying it through a buffer in QEMU.  As
+ * much as can be written without blocking on @fd is written.
+ *
+ * Like for bdrv_co_copy_range(), the block layer does not fall back to a
+ * bounce buffer: if the driver or the node (e.g. because it has an
+ * alignment requirement) does not allow it, -ENOTSUP is returned and the
+ * caller must read the data itself.
+ *
+ * @child: Child to read data from
+ * @offset: offset in @child image to read data
+ * @bytes: maximum number of bytes to write
+ * @fd: file descriptor to write to; if negative, nothing is written and
+ *      only the whole request of @bytes at @offset is checked
+ *
+ * Returns: the number of bytes written (0 for a check that succeeded);
+ * -EAGAIN if @fd is not writable; -ENOTSUP if not supported, in which case
+ * nothing has been written; other negative error codes on failure.
+ **/
+int64_t coroutine_fn GRAPH_RDLOCK
+bdrv_co_sendfile(BdrvChild *child, int64_t offset, int64_t bytes, int fd);
+
 /*
  * "I/O or GS" API functions. These functions can run without
  * the BQL, but only in one specific iothread/main loop.
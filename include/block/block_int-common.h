@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -605,6 +606,17 @@ struct BlockDriver {
         BdrvChild *dst, int64_t dst_offset, int64_t bytes,
         BdrvRequestFlags read_flags, BdrvRequestFlags write_flags);
 
+    /*
+     * Map [offset, offset + bytes) onto a child of @bs and invoke
+     * bdrv_co_sendfile() on it, or, if @bs is the leaf, write the data
+     * directly from the image to @fd.
+     *
+     * See the comment of bdrv_co_sendfile for the parameter and return value
+     * semantics.
+     */
+    int64_t coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_sendfile)(
+        BlockDriverState *bs, int64_t offset, int64_t bytes, int fd);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -635,6 +647,15 @@ struct BlockDriver {
         bool want_zero, int64_t offset, int64_t bytes, int64_t *pnum,
         int64_t *map, BlockDriverState **file);
 
+    /*
+     * Return true if zero regions reported by .bdrv_co_block_status() can
+     * only become data through writes to this node as long as no other
+     * user is allowed to write to the image, for example because image
+     * locking is in effect.  bdrv_co_block_status() then caches them like
+     * it caches data regions.  If NULL, zero regions are not cached.
+     */
+    bool (*bdrv_block_status_may_cache_zero)(BlockDriverState *bs);
+
     /*
      * Snapshot-access API.
      *
@@ -1052,21 +1073,43 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * One region in the block-status cache of a protocol node.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @node: The cached interval [node.start, node.last]
+ * @status: The cached status, either BDRV_BLOCK_DATA or BDRV_BLOCK_ZERO,
+ *          always together with BDRV_BLOCK_OFFSET_VALID
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+typedef struct BdrvBlockStatusCacheEntry {
+    IntervalTreeNode node;
+    int status;
+    QTAILQ_ENTRY(BdrvBlockStatusCacheEntry) lru;
+} BdrvBlockStatusCacheEntry;
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+/*
+ * Allows bdrv_co_block_status() to cache the data and zero regions
+ * reported by a protocol node.
+ *
+ * All fields are protected by @lock.  @nb_entries and @generation are
+ * also accessed atomically, so that invalidating a range of an empty cache
+ * needs no lock.
+ *
+ * @ranges: The cached regions.  They never overlap, and adjacent regions
+ *          always have different status.
+ * @lru: All entries in @ranges, least recently used first
+ * @nb_entries: Number of entries in @ranges
+ * @generation: Incremented by every invalidation, so that results of
+ *              queries that raced with a write are not cached
+ * @hits: Number of lookups answered from the cache
+ * @misses: Number of lookups that had to ask the driver
+ */
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot ranges;
+    QTAILQ_HEAD(, BdrvBlockStatusCacheEntry) lru;
+    unsigned int nb_entries;
+    unsigned int generation;
+    uint64_t hits;
+    uint64_t misses;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1250,10 +1293,8 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
-    BdrvBlockStatusCache *block_status_cache;
+    /* Only used for protocol nodes, see bdrv_bsc_lookup() */
+    BdrvBlockStatusCache block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
@@ -166,29 +166,42 @@ bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
- * region.
+ * Look up the given offset in the block-status cache.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
- * Otherwise, *pnum is not touched.
+ * If it is in a cached region, return that region's status (either
+ * BDRV_BLOCK_DATA or BDRV_BLOCK_ZERO, together with
+ * BDRV_BLOCK_OFFSET_VALID) and set *pnum to how many bytes, starting from
+ * @offset, have this status (according to the cache).
+ * Otherwise, return 0 and store the cache generation in *generation; it
+ * must be passed to bdrv_bsc_fill() for the result of the query that
+ * follows.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
+int bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t *pnum,
+                    unsigned int *generation);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Drop [offset, offset + bytes) from the block-status cache.
  *
- * (To be used by I/O paths that cause data regions to be zero or
- * holes.)
+ * (To be used by I/O paths that change what is data and what is zero.)
  */
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
 /**
- * Mark the range [offset, offset + bytes) as a data region.
+ * Mark the range [offset, offset + bytes) as having @status, which is
+ * BDRV_BLOCK_DATA or BDRV_BLOCK_ZERO together with BDRV_BLOCK_OFFSET_VALID.
+ *
+ * Nothing is cached if the range was invalidated after @generation was
+ * returned by bdrv_bsc_lookup().
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                   int status, unsigned int generation);
+
+/**
+ * Return how many lookups the block-status cache answered (*hits) and
+ * how many it could not answer (*misses).
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
+void bdrv_bsc_get_stats(BlockDriverState *bs, uint64_t *hits,
+                        uint64_t *misses);
 
 #endif /* BLOCK_INT_IO_H */
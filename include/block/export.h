@@ -16,6 +16,8 @@
 
 #include "qapi/qapi-types-block-export.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
+#include "sysemu/iothread.h"
 
 typedef struct BlockExport BlockExport;
 
@@ -29,6 +31,13 @@ typedef struct BlockExportDriver {
      */
     size_t instance_size;
 
+    /*
+     * True if the driver maps its queues to the AioContexts returned by
+     * blk_exp_queue_ctx(), so that the export can be created with a list of
+     * iothreads.
+     */
+    bool supports_iothreads;
+
     /* Creates and starts a new block export */
     int (*create)(BlockExport *, BlockExportOptions *, Error **);
 
@@ -47,6 +56,15 @@ typedef struct BlockExportDriver {
     void (*request_shutdown)(BlockExport *);
 } BlockExportDriver;
 
+/* Per-queue state of an export, see blk_exp_init_queues() */
+typedef struct BlockExportQueue {
+    /* The iothread that processes the queue, or NULL for BlockExport.ctx */
+    IOThread *iothread;
+
+    /* Number of requests taken from the queue */
+    Stat64 requests;
+} BlockExportQueue;
+
 struct BlockExport {
     const BlockExportDriver *drv;
 
@@ -76,6 +94,17 @@ struct BlockExport {
     /* The block device to export */
     BlockBackend *blk;
 
+    /*
+     * The iothreads given with @iothreads on creation. The block node is
+     * fixed in the AioContext of the first one.
+     */
+    IOThread **iothreads;
+    unsigned int num_iothreads;
+
+    /* Set up by drivers with multiple queues, see blk_exp_init_queues() */
+    BlockExportQueue *queues;
+    unsigned int num_queues;
+
     /* List entry for block_exports */
     QLIST_ENTRY(BlockExport) next;
 };
@@ -88,4 +117,17 @@ void blk_exp_request_shutdown(BlockExport *exp);
 void blk_exp_close_all(void);
 void blk_exp_close_all_type(BlockExportType type);
 
+void blk_exp_init_queues(BlockExport *exp, unsigned int num_queues);
+AioContext *blk_exp_queue_ctx(BlockExport *exp, unsigned int idx);
+
+/*
+ * Accounts a request taken from queue @idx. May be called from the queue's
+ * AioContext.
+ */
+static inline void blk_exp_queue_add_request(BlockExport *exp,
+                                             unsigned int idx)
+{
+    stat64_add(&exp->queues[idx].requests, 1);
+}
+
 #endif
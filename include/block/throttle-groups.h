@@ -27,6 +27,7 @@
 
 #include "qemu/coroutine.h"
 #include "qemu/throttle.h"
+#include "qapi/qapi-types-block-core.h"
 #include "qom/object.h"
 
 /* The ThrottleGroupMember structure indicates membership in a ThrottleGroup
@@ -57,8 +58,23 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[THROTTLE_MAX];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /*
+     * State of the weighted scheduler, also protected by the ThrottleGroup
+     * lock.  vtime is the virtual time at which the next request of this
+     * member starts, it advances inversely proportional to the weight.
+     * waiters lists the throttled requests, oldest first.
+     */
+    unsigned       weight;
+    int64_t        latency_target_ns;
+    uint64_t       vtime[THROTTLE_MAX];
+    uint64_t       dispatched_bytes[THROTTLE_MAX];
+    QTAILQ_HEAD(, ThrottleGroupWaiter) waiters[THROTTLE_MAX];
+
 } ThrottleGroupMember;
 
+#define THROTTLE_GROUP_DEFAULT_WEIGHT 100
+#define THROTTLE_GROUP_MAX_WEIGHT 10000
+
 #define TYPE_THROTTLE_GROUP "throttle-group"
 OBJECT_DECLARE_SIMPLE_TYPE(ThrottleGroup, THROTTLE_GROUP)
 
@@ -76,6 +92,11 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
 void throttle_group_unregister_tgm(ThrottleGroupMember *tgm);
 void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
 
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned weight,
+                               int64_t latency_target_ns);
+void throttle_group_get_member_stats(ThrottleGroupMember *tgm,
+                                     BlockStatsSpecificThrottle *stats);
+
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
                                                         int64_t bytes,
                                                         ThrottleDirection direction);
@@ -239,7 +239,8 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
  *
  * At most one entry for a given virtual address is permitted. Only a
  * single TARGET_PAGE_SIZE region is mapped; @full->lg_page_size is only
- * used by tlb_flush_page.
+ * used by tlb_flush_page, and to refill the other TARGET_PAGE_SIZE pages
+ * of a large page from a copy of @full without calling tlb_fill again.
  */
 void tlb_set_page_full(CPUState *cpu, int mmu_idx, vaddr addr,
                        CPUTLBEntryFull *full);
@@ -818,6 +818,9 @@ struct MemoryRegion {
     uint8_t vga_logging_count;
     MemoryRegion *alias;
     hwaddr alias_offset;
+    /* Aliases of this region, to find where changes to it are visible */
+    QTAILQ_HEAD(, MemoryRegion) aliased_by;
+    QTAILQ_ENTRY(MemoryRegion) aliased_by_link;
     int32_t priority;
     QTAILQ_HEAD(, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
@@ -1139,6 +1142,7 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    hwaddr root_addr; /* address of @root when the view was rendered */
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
@@ -2515,7 +2519,8 @@ MemoryRegionSection memory_region_find(MemoryRegion *mr,
 /**
  * memory_global_dirty_log_sync: synchronize the dirty log for all memory
  *
- * Synchronizes the dirty page log for all address spaces.
+ * Synchronizes the dirty page log for all address spaces, including the
+ * writes done by the emulation that were batched per thread.
  *
  * @last_stage: whether this is the last stage of live migration
  */
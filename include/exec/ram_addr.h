@@ -334,6 +334,13 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
     xen_hvm_modified_memory(start, length);
 }
 
+/*
+ * Set the migration dirty bits for the writes done by the emulation that
+ * were batched in per-thread buffers.  Must be called before syncing the
+ * dirty bitmap of the migration client.
+ */
+void cpu_physical_memory_dirty_log_flush(void);
+
 #if !defined(_WIN32)
 
 /*
@@ -79,6 +79,18 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Dirty page rate of the block, used on the migration source to
+     * predict the switchover when the predictive-switchover capability
+     * is enabled.  They are only accessed by the thread that syncs the
+     * dirty bitmap: `dirty_pages_period' counts the pages dirtied since
+     * the last sample, `dirty_rate' is the moving average of the dirty
+     * rate in pages per second and `dirty_rate_dev' its mean deviation.
+     */
+    uint64_t dirty_pages_period;
+    double dirty_rate;
+    double dirty_rate_dev;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -198,6 +198,9 @@ struct CPUClass {
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/* Use a fully associative large page tlb of 8 entries. */
+#define CPU_LPTLB_SIZE 8
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -261,6 +264,19 @@ typedef struct CPUTLBEntryFull {
     } extra;
 } CPUTLBEntryFull;
 
+/*
+ * A guest large page, as installed by tlb_set_page_full.  The entry
+ * is matched if (addr & mask) == addr; an unused entry has addr == -1
+ * and mask == 0.  @full is the template from which the small pages
+ * within the large page are filled; its @phys_addr is the physical
+ * address of the start of the large page.
+ */
+typedef struct CPUTLBLargePage {
+    vaddr addr;
+    vaddr mask;
+    CPUTLBEntryFull full;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -269,8 +285,8 @@ typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
      * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * we must consult the large page tlb below.  The region is
+     * matched if (addr & large_page_mask) == large_page_addr.
      */
     vaddr large_page_addr;
     vaddr large_page_mask;
@@ -284,6 +300,10 @@ typedef struct CPUTLBDesc {
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    /* The next index to use in the large page tlb.  */
+    size_t lpindex;
+    /* The large page tlb.  */
+    CPUTLBLargePage lptable[CPU_LPTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -348,6 +368,15 @@ typedef union IcountDecr {
  * via small negative offsets.
  */
 typedef struct CPUNegativeOffsetState {
+#ifdef CONFIG_PLUGIN
+    /*
+     * The value of the last memory access, stored by generated code and
+     * by the load/store helpers for qemu_plugin_mem_get_value.  Placed
+     * first so as not to move the tlb any further from env.
+     */
+    uint64_t plugin_mem_value_low;
+    uint64_t plugin_mem_value_high;
+#endif
     CPUTLB tlb;
     IcountDecr icount_decr;
     bool can_do_io;
@@ -417,6 +446,7 @@ struct qemu_work_item;
  * @stop: Indicates a pending stop request.
  * @stopped: Indicates the CPU has been artificially stopped.
  * @unplug: Indicates a pending CPU unplug request.
+ * @profile_request: Indicates a pending TCG profiler sample request.
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
@@ -479,6 +509,7 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    bool profile_request;
     int exclusive_context_count;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
@@ -198,6 +198,14 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * Set this if saving and loading the state of this VMSD, including
+     * all its callbacks, only touches the state of its own device.  With
+     * the concurrent-device-state capability, the state is then saved and
+     * loaded in a worker thread, concurrently with other such devices.
+     * The callbacks are called without the BQL, which they must not take.
+     */
+    bool independent;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
@@ -329,6 +329,31 @@ bool hbitmap_next_dirty_area(const HBitmap *hb, int64_t start, int64_t end,
                              int64_t max_dirty_count,
                              int64_t *dirty_start, int64_t *dirty_count);
 
+typedef struct HBitmapRange {
+    int64_t start;
+    int64_t count;
+} HBitmapRange;
+
+/*
+ * hbitmap_dirty_areas:
+ * @hb: The HBitmap to operate on
+ * @start: the offset to start from
+ * @end: end of requested area
+ * @areas: array that receives the dirty areas
+ * @max_areas: number of elements in @areas
+ *
+ * Store up to @max_areas dirty areas within [@start, @end) in @areas, in
+ * ascending order.  Each area is as large as possible within the range; to
+ * continue, call again with @start set to the end of the last area.
+ *
+ * This is equivalent to calling hbitmap_next_dirty_area() in a loop, but
+ * scans the bitmap a word at a time.
+ *
+ * Returns the number of areas that were found.
+ */
+size_t hbitmap_dirty_areas(const HBitmap *hb, int64_t start, int64_t end,
+                           HBitmapRange *areas, size_t max_areas);
+
 /*
  * hbitmap_status:
  * @hb: The HBitmap to operate on
@@ -22,6 +22,7 @@
 typedef struct VuFdWatch {
     VuDev *vu_dev;
     int fd; /*kick fd*/
+    AioContext *ctx; /* queue AioContext, or NULL for VuServer->ctx */
     void *pvt;
     vu_watch_cb cb;
     QTAILQ_ENTRY(VuFdWatch) next;
@@ -31,21 +32,25 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless a
+ * separate AioContext is given for each virtqueue in queue_ctx.
  */
 typedef struct {
     QIONetListener *listener;
     QEMUBH *restart_listener_bh;
     AioContext *ctx;
+    AioContext **queue_ctx; /* max_queues elements or NULL, owned by caller */
     int max_queues;
     const VuDevIface *vu_iface;
 
     unsigned int in_flight; /* atomic */
 
+    bool wait_idle; /* atomic */
+
     /* Protected by ctx lock */
     bool in_qio_channel_yield;
-    bool wait_idle;
     bool quiescing;
+    bool queues_quiesced; /* kick fds in queue_ctx are not monitored */
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -58,6 +63,7 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctx,
                              const VuDevIface *vu_iface,
                              Error **errp);
 
@@ -21,6 +21,7 @@
 #include "gdbstub/syscalls.h"
 #include "qemu.h"
 #include "user-internals.h"
+#include "strace.h"
 #include "qemu/plugin.h"
 
 #ifdef CONFIG_GCOV
@@ -32,6 +33,9 @@ void preexit_cleanup(CPUArchState *env, int code)
 #ifdef CONFIG_GCOV
         __gcov_dump();
 #endif
+        if (qemu_loglevel_mask(LOG_STRACE)) {
+            print_syscall_stats();
+        }
         gdb_exit(code);
         qemu_plugin_user_exit();
         perf_exit();
@@ -14,6 +14,8 @@
 #include <linux/in6.h>
 #include <linux/netlink.h>
 #include <sched.h>
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #include "qemu.h"
 #include "user-internals.h"
 #include "strace.h"
@@ -4178,6 +4180,17 @@ static const struct syscallname scnames[] = {
 
 static int nsyscalls = ARRAY_SIZE(scnames);
 
+/*
+ * Latency accounting, indexed like scnames.  Updated concurrently by all
+ * guest threads, printed by print_syscall_stats when the process exits.
+ */
+static struct syscall_stats {
+    Stat64 calls;
+    Stat64 errors;
+    Stat64 total_ns;
+    Stat64 max_ns;
+} syscall_stats[ARRAY_SIZE(scnames)];
+
 /*
  * The public interface to this module.
  */
@@ -4252,6 +4265,80 @@ print_syscall_ret(CPUArchState *cpu_env, int num, abi_long ret,
     qemu_log_unlock(f);
 }
 
+void record_syscall_latency(int num, abi_long ret, int64_t elapsed_ns)
+{
+    int i;
+
+    for (i = 0; i < nsyscalls; i++) {
+        if (scnames[i].nr == num) {
+            struct syscall_stats *s = &syscall_stats[i];
+
+            stat64_add(&s->calls, 1);
+            if (is_error(ret)) {
+                stat64_add(&s->errors, 1);
+            }
+            stat64_add(&s->total_ns, elapsed_ns);
+            stat64_max(&s->max_ns, elapsed_ns);
+            return;
+        }
+    }
+}
+
+static int syscall_stats_cmp(const void *a, const void *b)
+{
+    uint64_t ta = stat64_get(&syscall_stats[*(const int *)a].total_ns);
+    uint64_t tb = stat64_get(&syscall_stats[*(const int *)b].total_ns);
+
+    return ta > tb ? -1 : ta < tb;
+}
+
+void print_syscall_stats(void)
+{
+    g_autofree int *order = g_new(int, nsyscalls);
+    uint64_t total_ns = 0, total_calls = 0, total_errors = 0;
+    int i, n = 0;
+    FILE *f;
+
+    for (i = 0; i < nsyscalls; i++) {
+        if (stat64_get(&syscall_stats[i].calls)) {
+            order[n++] = i;
+            total_ns += stat64_get(&syscall_stats[i].total_ns);
+            total_calls += stat64_get(&syscall_stats[i].calls);
+            total_errors += stat64_get(&syscall_stats[i].errors);
+        }
+    }
+    if (!n) {
+        return;
+    }
+    qsort(order, n, sizeof(int), syscall_stats_cmp);
+
+    f = qemu_log_trylock();
+    if (!f) {
+        return;
+    }
+    fprintf(f, "%d %6s %11s %11s %11s %9s %9s %s\n", getpid(),
+            "% time", "seconds", "usecs/call", "max usecs",
+            "calls", "errors", "syscall");
+    for (i = 0; i < n; i++) {
+        struct syscall_stats *s = &syscall_stats[order[i]];
+        uint64_t calls = stat64_get(&s->calls);
+        uint64_t ns = stat64_get(&s->total_ns);
+
+        fprintf(f, "%d %6.2f %11.6f %11" PRIu64 " %11" PRIu64
+                " %9" PRIu64 " %9" PRIu64 " %s\n", getpid(),
+                total_ns ? (double)ns * 100 / total_ns : 0.0,
+                (double)ns / NANOSECONDS_PER_SECOND,
+                ns / calls / SCALE_US, stat64_get(&s->max_ns) / SCALE_US,
+                calls, stat64_get(&s->errors), scnames[order[i]].name);
+    }
+    fprintf(f, "%d %6.2f %11.6f %11" PRIu64 " %11s %9" PRIu64
+            " %9" PRIu64 " %s\n", getpid(), 100.0,
+            (double)total_ns / NANOSECONDS_PER_SECOND,
+            total_ns / total_calls / SCALE_US, "",
+            total_calls, total_errors, "total");
+    qemu_log_unlock(f);
+}
+
 void print_taken_signal(int target_signum, const target_siginfo_t *tinfo)
 {
     /* Print the strace output for a signal being taken:
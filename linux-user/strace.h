@@ -24,6 +24,24 @@ void print_syscall(CPUArchState *cpu_env, int num,
 void print_syscall_ret(CPUArchState *cpu_env, int num, abi_long ret,
                        abi_long arg1, abi_long arg2, abi_long arg3,
                        abi_long arg4, abi_long arg5, abi_long arg6);
+/**
+ * record_syscall_latency:
+ * @num: syscall number
+ * @ret: value returned to the guest
+ * @elapsed_ns: time spent emulating the syscall, in nanoseconds
+ *
+ * Account one completed syscall for the summary printed by
+ * print_syscall_stats().
+ */
+void record_syscall_latency(int num, abi_long ret, int64_t elapsed_ns);
+/**
+ * print_syscall_stats:
+ *
+ * Print strace output summarising, for each syscall made by the guest,
+ * the number of calls and errors and the time spent emulating it,
+ * in a format similar to "strace -c".
+ */
+void print_syscall_stats(void);
 /**
  * print_taken_signal:
  * @target_signum: target signal being taken
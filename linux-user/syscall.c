@@ -23,6 +23,7 @@
 #include "qemu/memfd.h"
 #include "qemu/queue.h"
 #include "qemu/plugin.h"
+#include "qemu/timer.h"
 #include "tcg/startup.h"
 #include "target_mman.h"
 #include <elf.h>
@@ -8746,6 +8747,30 @@ static int do_getdents(abi_long dirfd, abi_long arg2, abi_long count)
 #endif /* TARGET_NR_getdents */
 
 #if defined(TARGET_NR_getdents64) && defined(__NR_getdents64)
+#if HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN
+/*
+ * The kernel pads every record to 8 bytes, and struct target_dirent64
+ * has the same field offsets as struct linux_dirent64.  With no byte
+ * swapping needed, the host records are valid guest records as they
+ * are and can be read directly into guest memory.
+ */
+static int do_getdents64(abi_long dirfd, abi_long arg2, abi_long count)
+{
+    void *tdirp;
+    int ret;
+
+    QEMU_BUILD_BUG_ON(offsetof(struct target_dirent64, d_name) !=
+                      offsetof(struct linux_dirent64, d_name));
+
+    tdirp = lock_user(VERIFY_WRITE, arg2, count, 0);
+    if (!tdirp) {
+        return -TARGET_EFAULT;
+    }
+    ret = get_errno(sys_getdents64(dirfd, tdirp, count));
+    unlock_user(tdirp, arg2, is_error(ret) ? 0 : ret);
+    return ret;
+}
+#else
 static int do_getdents64(abi_long dirfd, abi_long arg2, abi_long count)
 {
     g_autofree void *hdirp = NULL;
@@ -8809,6 +8834,7 @@ static int do_getdents64(abi_long dirfd, abi_long arg2, abi_long count)
     unlock_user(tdirp, arg2, toff);
     return toff;
 }
+#endif
 #endif /* TARGET_NR_getdents64 */
 
 #if defined(TARGET_NR_riscv_hwprobe)
@@ -11767,8 +11793,24 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 /*
                  * It is assumed that struct statx is architecture independent.
                  */
-                struct target_statx host_stx;
                 int mask = arg4;
+#if HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN
+                /*
+                 * With no byte swapping the layouts are identical, so
+                 * let the host fill in the guest buffer directly.
+                 */
+                QEMU_BUILD_BUG_ON(sizeof(struct target_statx) != 256);
+                target_stx = lock_user(VERIFY_WRITE, arg5,
+                                       sizeof(*target_stx), 0);
+                if (!target_stx) {
+                    unlock_user(p, arg2, 0);
+                    return -TARGET_EFAULT;
+                }
+                ret = get_errno(sys_statx(dirfd, p, flags, mask, target_stx));
+                unlock_user(target_stx, arg5,
+                            is_error(ret) ? 0 : sizeof(*target_stx));
+#else
+                struct target_statx host_stx;
 
                 ret = get_errno(sys_statx(dirfd, p, flags, mask, &host_stx));
                 if (!is_error(ret)) {
@@ -11777,6 +11819,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                         return -TARGET_EFAULT;
                     }
                 }
+#endif
 
                 if (ret != -TARGET_ENOSYS) {
                     unlock_user(p, arg2, 0);
@@ -13760,6 +13803,7 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                     abi_long arg8)
 {
     CPUState *cpu = env_cpu(cpu_env);
+    int64_t start_ns = 0;
     abi_long ret;
 
 #ifdef DEBUG_ERESTARTSYS
@@ -13781,12 +13825,14 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6);
+        start_ns = get_clock();
     }
 
     ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                       arg5, arg6, arg7, arg8);
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
+        record_syscall_latency(num, ret, get_clock() - start_ns);
         print_syscall_ret(cpu_env, num, ret, arg1, arg2,
                           arg3, arg4, arg5, arg6);
     }
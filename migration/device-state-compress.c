@@ -0,0 +1,229 @@
+/*
+ * Encoding of the device state saved while the guest is stopped
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "device-state-compress.h"
+
+/*
+ * The zero-run encoding is a sequence of runs, each one made of a 32-bit
+ * big endian header holding the length of the run.  If ZERO_RUN_FLAG is
+ * set in the header, the run is made of zeroes and has no data; otherwise
+ * the data of the run follows the header.
+ *
+ * Runs are detected in blocks of ZERO_RUN_BLOCK bytes, which keeps the
+ * encoding cheap and makes it never grow the data by more than a few
+ * headers.
+ */
+#define ZERO_RUN_FLAG       0x80000000U
+#define ZERO_RUN_BLOCK      64
+#define ZERO_RUN_MAX_LEN    (1U << 30)
+
+size_t zero_run_encode_bound(size_t len)
+{
+    return len + (len / ZERO_RUN_MAX_LEN + 2) * sizeof(uint32_t);
+}
+
+static bool zero_run_block_is_zero(const uint8_t *in, size_t len, size_t pos)
+{
+    return buffer_is_zero(in + pos, MIN(ZERO_RUN_BLOCK, len - pos));
+}
+
+/**
+ * zero_run_encode: zero-run encode a buffer
+ *
+ * Returns the size of the encoded data
+ *
+ * @in: buffer to encode
+ * @len: size of @in
+ * @out: buffer for the encoded data, of zero_run_encode_bound(@len) bytes
+ */
+size_t zero_run_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t pos = 0;
+    size_t out_len = 0;
+
+    while (pos < len) {
+        size_t start = pos;
+        bool zero = zero_run_block_is_zero(in, len, pos);
+        uint32_t run;
+
+        do {
+            pos += MIN(ZERO_RUN_BLOCK, len - pos);
+        } while (pos < len && pos - start < ZERO_RUN_MAX_LEN &&
+                 zero_run_block_is_zero(in, len, pos) == zero);
+
+        run = pos - start;
+        stl_be_p(out + out_len, zero ? run | ZERO_RUN_FLAG : run);
+        out_len += sizeof(uint32_t);
+        if (!zero) {
+            memcpy(out + out_len, in + start, run);
+            out_len += run;
+        }
+    }
+
+    return out_len;
+}
+
+/**
+ * zero_run_decode: decode a zero-run encoded buffer
+ *
+ * Returns 0 for success or -EINVAL if the encoded data is invalid
+ *
+ * @in: encoded data
+ * @in_len: size of @in
+ * @out: buffer for the decoded data
+ * @out_len: expected size of the decoded data
+ */
+int zero_run_decode(const uint8_t *in, size_t in_len,
+                    uint8_t *out, size_t out_len)
+{
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+
+    while (in_pos < in_len) {
+        uint32_t header, run;
+
+        if (in_len - in_pos < sizeof(uint32_t)) {
+            return -EINVAL;
+        }
+        header = ldl_be_p(in + in_pos);
+        in_pos += sizeof(uint32_t);
+
+        run = header & ~ZERO_RUN_FLAG;
+        if (run > out_len - out_pos) {
+            return -EINVAL;
+        }
+        if (header & ZERO_RUN_FLAG) {
+            memset(out + out_pos, 0, run);
+        } else {
+            if (run > in_len - in_pos) {
+                return -EINVAL;
+            }
+            memcpy(out + out_pos, in + in_pos, run);
+            in_pos += run;
+        }
+        out_pos += run;
+    }
+
+    return out_pos == out_len ? 0 : -EINVAL;
+}
+
+size_t device_state_compress_bound(MultiFDCompression method, size_t len)
+{
+    switch (method) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        return compressBound(len);
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        return ZSTD_compressBound(len);
+#endif
+    default:
+        return len;
+    }
+}
+
+/**
+ * device_state_compress: compress a buffer of device state
+ *
+ * Returns the size of the compressed data, or -1 for error
+ *
+ * @method: compression method
+ * @level: compression level for @method
+ * @in: buffer to compress
+ * @len: size of @in
+ * @out: buffer for the compressed data
+ * @out_len: size of @out, at least device_state_compress_bound(@len)
+ * @errp: pointer to an error
+ */
+ssize_t device_state_compress(MultiFDCompression method, int level,
+                              const uint8_t *in, size_t len,
+                              uint8_t *out, size_t out_len, Error **errp)
+{
+    switch (method) {
+    case MULTIFD_COMPRESSION_ZLIB: {
+        uLongf dest_len = out_len;
+        int ret = compress2(out, &dest_len, in, len, level);
+
+        if (ret != Z_OK) {
+            error_setg(errp, "device state zlib compression failed: %d", ret);
+            return -1;
+        }
+        return dest_len;
+    }
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        size_t ret = ZSTD_compress(out, out_len, in, len, level);
+
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "device state zstd compression failed: %s",
+                       ZSTD_getErrorName(ret));
+            return -1;
+        }
+        return ret;
+    }
+#endif
+    default:
+        error_setg(errp, "device state compression %s is not supported",
+                   MultiFDCompression_str(method));
+        return -1;
+    }
+}
+
+/**
+ * device_state_decompress: decompress a buffer of device state
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @method: compression method
+ * @in: compressed data
+ * @len: size of @in
+ * @out: buffer for the decompressed data
+ * @out_len: expected size of the decompressed data
+ * @errp: pointer to an error
+ */
+int device_state_decompress(MultiFDCompression method,
+                            const uint8_t *in, size_t len,
+                            uint8_t *out, size_t out_len, Error **errp)
+{
+    switch (method) {
+    case MULTIFD_COMPRESSION_ZLIB: {
+        uLongf dest_len = out_len;
+        int ret = uncompress(out, &dest_len, in, len);
+
+        if (ret != Z_OK || dest_len != out_len) {
+            error_setg(errp, "device state zlib decompression failed: %d",
+                       ret);
+            return -1;
+        }
+        return 0;
+    }
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        size_t ret = ZSTD_decompress(out, out_len, in, len);
+
+        if (ZSTD_isError(ret) || ret != out_len) {
+            error_setg(errp, "device state zstd decompression failed: %s",
+                       ZSTD_isError(ret) ? ZSTD_getErrorName(ret) :
+                       "size mismatch");
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    default:
+        error_setg(errp, "device state compression %s is not supported",
+                   MultiFDCompression_str(method));
+        return -1;
+    }
+}
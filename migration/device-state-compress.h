@@ -0,0 +1,26 @@
+/*
+ * Encoding of the device state saved while the guest is stopped
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_DEVICE_STATE_COMPRESS_H
+#define QEMU_MIGRATION_DEVICE_STATE_COMPRESS_H
+
+#include "qapi/qapi-types-migration.h"
+
+size_t zero_run_encode_bound(size_t len);
+size_t zero_run_encode(const uint8_t *in, size_t len, uint8_t *out);
+int zero_run_decode(const uint8_t *in, size_t in_len,
+                    uint8_t *out, size_t out_len);
+
+size_t device_state_compress_bound(MultiFDCompression method, size_t len);
+ssize_t device_state_compress(MultiFDCompression method, int level,
+                              const uint8_t *in, size_t len,
+                              uint8_t *out, size_t out_len, Error **errp);
+int device_state_decompress(MultiFDCompression method,
+                            const uint8_t *in, size_t len,
+                            uint8_t *out, size_t out_len, Error **errp);
+
+#endif
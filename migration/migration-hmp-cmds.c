@@ -113,6 +113,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        if (info->ram->dirty_sync_duration) {
+            monitor_printf(mon, "dirty sync duration: %" PRIu64 " us\n",
+                           info->ram->dirty_sync_duration);
+        }
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
@@ -171,6 +175,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->encoding_rate);
         monitor_printf(mon, "xbzrle overflow: %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
+        monitor_printf(mon, "xbzrle encoding time: %" PRIu64 " us\n",
+                       info->xbzrle_cache->encoding_time / 1000);
     }
 
     if (info->compression) {
@@ -201,6 +209,32 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->dirty_limit_ring_full_time);
     }
 
+    if (info->switchover_prediction) {
+        SwitchoverPrediction *p = info->switchover_prediction;
+
+        monitor_printf(mon, "predicted dirty rate: %" PRIu64 " kbytes/s\n",
+                       p->dirty_rate >> 10);
+        monitor_printf(mon, "predicted final size: %" PRIu64 " kbytes\n",
+                       p->final_bytes >> 10);
+        monitor_printf(mon, "device state size: %" PRIu64 " kbytes\n",
+                       p->device_state_bytes >> 10);
+        monitor_printf(mon, "predicted downtime: %" PRIu64 " ms\n",
+                       p->downtime);
+        if (p->has_downtime_error) {
+            monitor_printf(mon, "downtime prediction error: %" PRId64 " ms\n",
+                           p->downtime_error);
+        }
+    }
+
+    if (info->device_state_compression) {
+        monitor_printf(mon, "device state raw: %" PRIu64 " kbytes\n",
+                       info->device_state_compression->raw_bytes >> 10);
+        monitor_printf(mon, "device state zero-run: %" PRIu64 " kbytes\n",
+                       info->device_state_compression->zero_run_bytes >> 10);
+        monitor_printf(mon, "device state compressed: %" PRIu64 " kbytes\n",
+                       info->device_state_compression->compressed_bytes >> 10);
+    }
+
     if (info->has_postcopy_blocktime) {
         monitor_printf(mon, "postcopy blocktime: %u\n",
                        info->postcopy_blocktime);
@@ -349,6 +383,11 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
             MigrationParameter_str(MIGRATION_PARAMETER_ZERO_PAGE_DETECTION),
             qapi_enum_lookup(&ZeroPageDetection_lookup,
                 params->zero_page_detection));
+        assert(params->has_device_state_compression);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(
+                MIGRATION_PARAMETER_DEVICE_STATE_COMPRESSION),
+            MultiFDCompression_str(params->device_state_compression));
         monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -397,6 +436,11 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MODE),
             qapi_enum_lookup(&MigMode_lookup, params->mode));
+
+        assert(params->has_x_dirty_sync_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_DIRTY_SYNC_THREADS),
+            params->x_dirty_sync_threads);
     }
 
     qapi_free_MigrationParameters(params);
@@ -643,6 +687,11 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_zero_page_detection = true;
         visit_type_ZeroPageDetection(v, param, &p->zero_page_detection, &err);
         break;
+    case MIGRATION_PARAMETER_DEVICE_STATE_COMPRESSION:
+        p->has_device_state_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->device_state_compression,
+                                      &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         if (!visit_type_size(v, param, &cache_size, &err)) {
@@ -690,6 +739,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_mode = true;
         visit_type_MigMode(v, param, &p->mode, &err);
         break;
+    case MIGRATION_PARAMETER_X_DIRTY_SYNC_THREADS:
+        p->has_x_dirty_sync_threads = true;
+        visit_type_uint8(v, param, &p->x_dirty_sync_threads, &err);
+        break;
     default:
         assert(0);
     }
@@ -34,6 +34,21 @@
  * one thread).
  */
 typedef struct {
+    /*
+     * Size of the device state saved while the guest is stopped, after
+     * all the encodings requested for it.
+     */
+    Stat64 device_state_compressed_bytes;
+    /*
+     * Size of the device state saved while the guest is stopped, before
+     * any encoding.
+     */
+    Stat64 device_state_raw_bytes;
+    /*
+     * Size of the device state saved while the guest is stopped, after
+     * the zero-run encoding.
+     */
+    Stat64 device_state_zero_run_bytes;
     /*
      * Number of bytes that were dirty last time that we synced with
      * the guest memory.  We use that to calculate the downtime.  As
@@ -50,6 +65,11 @@ typedef struct {
      * Number of times we have synchronized guest bitmaps.
      */
     Stat64 dirty_sync_count;
+    /*
+     * Duration of the last synchronization of guest bitmaps, in
+     * microseconds.
+     */
+    Stat64 dirty_sync_duration;
     /*
      * Number of times zero copy failed to send any page using zero
      * copy.
@@ -60,6 +80,11 @@ typedef struct {
      * guest is stopped.
      */
     Stat64 downtime_bytes;
+    /*
+     * Number of bytes of pages received with io_uring through multifd
+     * channels.
+     */
+    Stat64 io_uring_recv_bytes;
     /*
      * Number of bytes sent through multifd channels.
      */
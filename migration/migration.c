@@ -229,6 +229,7 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fast_load, 0);
     qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done, 0);
+    qemu_sem_init(&current_incoming->postcopy_file_sem, 0);
 
     qemu_mutex_init(&current_incoming->page_request_mutex);
     qemu_cond_init(&current_incoming->page_request_cond);
@@ -722,6 +723,18 @@ static void process_incoming_migration_bh(void *opaque)
         runstate_set(global_state_get_runstate());
     }
     trace_vmstate_downtime_checkpoint("dst-precopy-bh-vm-started");
+
+    if (mis->postcopy_file_ioc) {
+        /*
+         * Guest RAM is still being loaded from the file; the listen
+         * thread completes the migration when it is done.
+         */
+        migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_POSTCOPY_ACTIVE);
+        qemu_sem_post(&mis->postcopy_file_sem);
+        return;
+    }
+
     /*
      * This must happen after any state changes since as soon as an external
      * observer sees this event they might start to prod at the VM assuming
@@ -1158,6 +1171,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_duration =
+        stat64_get(&mig_stats.dirty_sync_duration);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
@@ -1176,10 +1191,38 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit_rate = xbzrle_counters.cache_hit_rate;
+        info->xbzrle_cache->encoding_time = xbzrle_counters.encoding_time;
     }
 
     populate_compress(info);
 
+    if (migrate_predictive_switchover()) {
+        SwitchoverPrediction *p = g_new0(SwitchoverPrediction, 1);
+
+        p->dirty_rate = s->predicted_dirty_rate;
+        p->final_bytes = s->predicted_final_bytes;
+        p->device_state_bytes = s->device_state_bytes;
+        p->downtime = s->predicted_downtime;
+        if (s->state == MIGRATION_STATUS_COMPLETED) {
+            p->has_downtime_error = true;
+            p->downtime_error = s->downtime - s->predicted_downtime;
+        }
+        info->switchover_prediction = p;
+    }
+
+    if (migrate_device_state_zero_run() ||
+        migrate_device_state_compression() != MULTIFD_COMPRESSION_NONE) {
+        info->device_state_compression =
+            g_new0(DeviceStateCompressionStats, 1);
+        info->device_state_compression->raw_bytes =
+            stat64_get(&mig_stats.device_state_raw_bytes);
+        info->device_state_compression->zero_run_bytes =
+            stat64_get(&mig_stats.device_state_zero_run_bytes);
+        info->device_state_compression->compressed_bytes =
+            stat64_get(&mig_stats.device_state_compressed_bytes);
+    }
+
     if (cpu_throttle_active()) {
         info->has_cpu_throttle_percentage = true;
         info->cpu_throttle_percentage = cpu_throttle_get_percentage();
@@ -1313,6 +1356,11 @@ static void fill_destination_migration_info(MigrationInfo *info)
         break;
     }
     info->status = mis->state;
+
+    if (migrate_io_uring_recv()) {
+        info->has_io_uring_recv_bytes = true;
+        info->io_uring_recv_bytes = stat64_get(&mig_stats.io_uring_recv_bytes);
+    }
 }
 
 MigrationInfo *qmp_query_migrate(Error **errp)
@@ -1321,6 +1369,7 @@ MigrationInfo *qmp_query_migrate(Error **errp)
 
     fill_destination_migration_info(info);
     fill_source_migration_info(info);
+    info->device_state = qemu_savevm_device_state_stats();
 
     return info;
 }
@@ -1664,6 +1713,9 @@ int migrate_init(MigrationState *s, Error **errp)
     s->pages_per_second = 0.0;
     s->downtime = 0;
     s->expected_downtime = 0;
+    s->predicted_dirty_rate = 0;
+    s->predicted_final_bytes = 0;
+    s->predicted_downtime = 0;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->migration_thread_running = false;
@@ -1678,6 +1730,7 @@ int migrate_init(MigrationState *s, Error **errp)
     s->vm_old_state = -1;
     s->iteration_initial_bytes = 0;
     s->threshold_size = 0;
+    s->expected_bw_per_ms = 0;
     s->switchover_acked = false;
     s->rdma_migration = false;
     /*
@@ -3161,6 +3214,7 @@ static void migration_update_counters(MigrationState *s,
     }
 
     s->threshold_size = expected_bw_per_ms * migrate_downtime_limit();
+    s->expected_bw_per_ms = expected_bw_per_ms;
 
     s->mbps = (((double) transferred * 8.0) /
                ((double) time_spent / 1000.0)) / 1000.0 / 1000.0;
@@ -3204,6 +3258,45 @@ static bool migration_can_switchover(MigrationState *s)
     return s->switchover_acked;
 }
 
+/*
+ * Predict the downtime if the switchover happened now: besides the
+ * @pending_size bytes, the final stage sends what the guest dirtied since
+ * the last sync and the device state, whose size is taken from the last
+ * switchover.
+ */
+static bool migration_switchover_predict(MigrationState *s,
+                                         uint64_t pending_size)
+{
+    uint64_t dirty_bytes = ram_predict_dirty_bytes(&s->predicted_dirty_rate);
+
+    if (!s->expected_bw_per_ms) {
+        /* No bandwidth estimation yet */
+        return false;
+    }
+
+    s->predicted_final_bytes = pending_size + dirty_bytes +
+                               s->device_state_bytes;
+    s->predicted_downtime = s->predicted_final_bytes / s->expected_bw_per_ms;
+    s->expected_downtime = s->predicted_downtime;
+    trace_migration_switchover_predict(pending_size, dirty_bytes,
+                                       s->device_state_bytes,
+                                       s->predicted_downtime);
+
+    return s->predicted_downtime <= migrate_downtime_limit();
+}
+
+/*
+ * Return true if the pending data is low enough to switch over without
+ * exceeding the downtime limit.
+ */
+static bool migration_pending_is_low(MigrationState *s, uint64_t pending_size)
+{
+    if (migrate_predictive_switchover()) {
+        return migration_switchover_predict(s, pending_size);
+    }
+    return pending_size < s->threshold_size;
+}
+
 /* Migration thread iteration status */
 typedef enum {
     MIG_ITERATE_RESUME,         /* Resume current iteration */
@@ -3226,13 +3319,14 @@ static MigIterateState migration_iteration_run(MigrationState *s)
     pending_size = must_precopy + can_postcopy;
     trace_migrate_pending_estimate(pending_size, must_precopy, can_postcopy);
 
-    if (pending_size < s->threshold_size) {
+    if (migration_pending_is_low(s, pending_size)) {
         qemu_savevm_state_pending_exact(&must_precopy, &can_postcopy);
         pending_size = must_precopy + can_postcopy;
         trace_migrate_pending_exact(pending_size, must_precopy, can_postcopy);
     }
 
-    if ((!pending_size || pending_size < s->threshold_size) && can_switchover) {
+    if ((migration_pending_is_low(s, pending_size) || !pending_size) &&
+        can_switchover) {
         trace_migration_thread_low_pending(pending_size);
         migration_completion(s);
         return MIG_ITERATE_BREAK;
@@ -104,6 +104,14 @@ struct MigrationIncomingState {
     bool           have_listen_thread;
     QemuThread     listen_thread;
 
+    /*
+     * With postcopy-from-file, the channel that guest RAM is read from.
+     * The listen thread loads RAM in the background and is told by
+     * postcopy_file_sem when the guest has been started.
+     */
+    QIOChannel    *postcopy_file_ioc;
+    QemuSemaphore  postcopy_file_sem;
+
     /* For the kernel to send us notifications */
     int       userfault_fd;
     /* To notify the fault_thread to wake, e.g., when need to quit */
@@ -294,6 +302,8 @@ struct MigrationState {
      * measured bandwidth, or avail-switchover-bandwidth if specified.
      */
     uint64_t threshold_size;
+    /* Expected bandwidth when switching over, in bytes per ms */
+    double expected_bw_per_ms;
 
     /* params from 'migrate-set-parameters' */
     MigrationParameters parameters;
@@ -336,6 +346,19 @@ struct MigrationState {
     int64_t downtime_start;
     int64_t downtime;
     int64_t expected_downtime;
+    /*
+     * Prediction of the switchover made by the migration thread when the
+     * predictive-switchover capability is enabled.
+     */
+    uint64_t predicted_dirty_rate;
+    uint64_t predicted_final_bytes;
+    uint64_t predicted_downtime;
+    /*
+     * Size of the non-iterable device state saved by the last switchover.
+     * Kept across migrations, as the next one can only predict it from the
+     * previous one.
+     */
+    uint64_t device_state_bytes;
     bool capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
 
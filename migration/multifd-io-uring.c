@@ -0,0 +1,236 @@
+/*
+ * Multifd receive side with io_uring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qapi/error.h"
+#include "io/channel-socket.h"
+#include "migration-stats.h"
+#include "multifd.h"
+#include "trace.h"
+
+/*
+ * The pages of a packet are received straight into guest memory with a
+ * single MSG_WAITALL receive.  Unless the packet asks for a sync, the
+ * header of the next packet is received by a second request linked to
+ * the first one, so that a whole packet costs one submission and one
+ * wait instead of a receive for the header and one or more for the
+ * pages.
+ *
+ * A short receive of the pages fails the link and cancels the receive
+ * of the next header, so that the stream can never get out of sequence.
+ * io_uring does that since Linux 5.12, which also introduced
+ * IORING_FEAT_NATIVE_WORKERS; the next header is not linked on older
+ * kernels.
+ */
+
+#define MULTIFD_IO_URING_ENTRIES    4
+
+enum {
+    MULTIFD_IO_URING_PAGES = 1,
+    MULTIFD_IO_URING_PACKET,
+};
+
+struct MultiFDIOUring {
+    struct io_uring ring;
+    int fd;
+    /* whether the next header can be linked to the pages */
+    bool link_packet;
+    struct msghdr pages_msg;
+    struct msghdr packet_msg;
+    struct iovec packet_iov;
+    /* bytes of the next header already received */
+    size_t packet_done;
+    /* the receive of the next header hit the end of the stream */
+    bool packet_eof;
+};
+
+/**
+ * multifd_io_uring_recv_setup: setup io_uring for a receiving channel
+ *
+ * io_uring is only used for plain sockets; other channels keep using
+ * the QIOChannel functions, and so does a channel for which io_uring
+ * cannot be set up, for example because the host disabled it.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_io_uring_recv_setup(MultiFDRecvParams *p)
+{
+    MultiFDIOUring *u;
+    int ret;
+
+    if (!object_dynamic_cast(OBJECT(p->c), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+
+    u = g_new0(MultiFDIOUring, 1);
+    ret = io_uring_queue_init(MULTIFD_IO_URING_ENTRIES, &u->ring, 0);
+    if (ret < 0) {
+        g_free(u);
+        warn_report_once("multifd: failed to setup io_uring: %s",
+                         strerror(-ret));
+        return;
+    }
+
+    u->fd = QIO_CHANNEL_SOCKET(p->c)->fd;
+#ifdef IORING_FEAT_NATIVE_WORKERS
+    u->link_packet = u->ring.features & IORING_FEAT_NATIVE_WORKERS;
+#endif
+    u->packet_iov.iov_base = p->packet;
+    u->packet_iov.iov_len = p->packet_len;
+    u->packet_msg.msg_iov = &u->packet_iov;
+    u->packet_msg.msg_iovlen = 1;
+    p->io_uring = u;
+
+    trace_multifd_io_uring_recv_setup(p->id, u->link_packet);
+}
+
+/**
+ * multifd_io_uring_recv_cleanup: cleanup io_uring for a receiving channel
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_io_uring_recv_cleanup(MultiFDRecvParams *p)
+{
+    if (!p->io_uring) {
+        return;
+    }
+
+    io_uring_queue_exit(&p->io_uring->ring);
+    g_free(p->io_uring);
+    p->io_uring = NULL;
+}
+
+/**
+ * multifd_io_uring_recv_packet: receive the header of a packet
+ *
+ * The header may have been received, or started to be, together with
+ * the pages of the previous packet.
+ *
+ * Returns 1 for success, 0 for end of stream and -1 for error, like
+ * qio_channel_read_all_eof()
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_io_uring_recv_packet(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDIOUring *u = p->io_uring;
+    size_t done = u->packet_done;
+
+    if (u->packet_eof) {
+        return 0;
+    }
+
+    if (!done) {
+        return qio_channel_read_all_eof(p->c, (void *)p->packet,
+                                        p->packet_len, errp);
+    }
+
+    u->packet_done = 0;
+    if (done < p->packet_len &&
+        qio_channel_read_all(p->c, (char *)p->packet + done,
+                             p->packet_len - done, errp)) {
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * multifd_io_uring_recv_pages: receive the pages of a packet
+ *
+ * Receive the pages described by p->iov, and the header of the next
+ * packet unless the current one asks for a sync.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_io_uring_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDIOUring *u = p->io_uring;
+    size_t size = (size_t)p->normal_num * p->page_size;
+    bool link = u->link_packet && p->recv_next_packet;
+    int pages_res = -ECANCELED, packet_res = -ECANCELED;
+    unsigned int nr = link ? 2 : 1;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct iovec *iov;
+    unsigned int niov;
+    unsigned int i;
+    int ret;
+
+    u->pages_msg.msg_iov = p->iov;
+    u->pages_msg.msg_iovlen = p->normal_num;
+    sqe = io_uring_get_sqe(&u->ring);
+    io_uring_prep_recvmsg(sqe, u->fd, &u->pages_msg, MSG_WAITALL);
+    sqe->user_data = MULTIFD_IO_URING_PAGES;
+
+    if (link) {
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = io_uring_get_sqe(&u->ring);
+        io_uring_prep_recvmsg(sqe, u->fd, &u->packet_msg, MSG_WAITALL);
+        sqe->user_data = MULTIFD_IO_URING_PACKET;
+    }
+
+    ret = io_uring_submit(&u->ring);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "multifd %u: io_uring submit failed",
+                         p->id);
+        return -1;
+    }
+
+    for (i = 0; i < nr; i++) {
+        do {
+            ret = io_uring_wait_cqe(&u->ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "multifd %u: io_uring wait failed",
+                             p->id);
+            return -1;
+        }
+        if (cqe->user_data == MULTIFD_IO_URING_PAGES) {
+            pages_res = cqe->res;
+        } else {
+            packet_res = cqe->res;
+        }
+        io_uring_cqe_seen(&u->ring, cqe);
+    }
+
+    trace_multifd_io_uring_recv_pages(p->id, size, pages_res, packet_res);
+
+    if (pages_res < 0) {
+        error_setg_errno(errp, -pages_res,
+                         "multifd %u: io_uring receive failed", p->id);
+        return -1;
+    }
+    stat64_add(&mig_stats.io_uring_recv_bytes, pages_res);
+    if ((size_t)pages_res < size) {
+        /* Short receive, the next header was not received */
+        iov = p->iov;
+        niov = p->normal_num;
+        iov_discard_front(&iov, &niov, pages_res);
+        if (qio_channel_readv_all(p->c, iov, niov, errp)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (packet_res == 0) {
+        u->packet_eof = true;
+    } else if (packet_res > 0) {
+        u->packet_done = packet_res;
+    } else if (packet_res != -ECANCELED) {
+        error_setg_errno(errp, -packet_res,
+                         "multifd %u: io_uring receive failed", p->id);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Multifd XBZRLE encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "options.h"
+#include "multifd.h"
+#include "xbzrle.h"
+
+/*
+ * The data of a packet is made of one 32-bit big endian length for each
+ * normal page, followed by the data of the pages.  The length tells how
+ * the page was sent:
+ *  - 0: the page did not change since it was last sent
+ *  - the page size: the whole page
+ *  - anything else: XBZRLE encoded difference from the last sent page
+ */
+
+struct xbzrle_data {
+    /* length of each normal page */
+    uint32_t *lens;
+    /* encoded pages */
+    uint8_t *buf;
+    /* buffer for the current contents of a page */
+    uint8_t *page;
+};
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->lens = g_try_new(uint32_t, p->page_count);
+    x->buf = g_try_malloc(p->page_count * p->page_size);
+    x->page = g_try_malloc(p->page_size);
+    if (!x->lens || !x->buf || !x->page) {
+        g_free(x->lens);
+        g_free(x->buf);
+        g_free(x->page);
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle", p->id);
+        return -1;
+    }
+    p->compress_data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    g_free(x->lens);
+    g_free(x->buf);
+    g_free(x->page);
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+/**
+ * xbzrle_send_prepare: prepare data to be able to send
+ *
+ * Encode all the normal pages against the XBZRLE cache, and update
+ * the cache for the zero pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct xbzrle_data *x = p->compress_data;
+    XBZRLECacheStats stats = { 0 };
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    multifd_send_zero_page_detect(p);
+    multifd_send_prepare_header(p);
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        xbzrle_multifd_zero_page(pages->block, pages->offset[i]);
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        int len = xbzrle_multifd_encode_page(pages->block, pages->offset[i],
+                                             x->page, x->buf + out_size,
+                                             &stats);
+
+        if (len < 0) {
+            len = p->page_size;
+        }
+        x->lens[i] = cpu_to_be32(len);
+        out_size += len;
+    }
+    xbzrle_multifd_add_stats(&stats);
+
+    if (pages->normal_num) {
+        p->iov[p->iovs_num].iov_base = x->lens;
+        p->iov[p->iovs_num].iov_len = pages->normal_num * sizeof(uint32_t);
+        p->iovs_num++;
+        p->iov[p->iovs_num].iov_base = x->buf;
+        p->iov[p->iovs_num].iov_len = out_size;
+        p->iovs_num++;
+    }
+    p->next_packet_size = pages->normal_num * sizeof(uint32_t) + out_size;
+
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_recv: read the data from the channel into actual pages
+ *
+ * Apply the XBZRLE encoded differences to the pages, which still hold
+ * what was sent for them last time.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t lens_size = p->normal_num * sizeof(uint32_t);
+    uint8_t *buf;
+    uint32_t *lens;
+    uint32_t pos;
+    int ret;
+    int i;
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        return 0;
+    }
+
+    if (in_size < lens_size ||
+        in_size > lens_size + p->normal_num * p->page_size) {
+        error_setg(errp, "multifd %u: xbzrle packet size %u is invalid",
+                   p->id, in_size);
+        return -1;
+    }
+
+    /* Freed by nocomp_recv_cleanup() */
+    if (!p->compress_data) {
+        p->compress_data = g_malloc(p->page_count *
+                                    (sizeof(uint32_t) + p->page_size));
+    }
+    buf = p->compress_data;
+    ret = qio_channel_read_all(p->c, (void *)buf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    lens = (uint32_t *)buf;
+    pos = lens_size;
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = be32_to_cpu(lens[i]);
+        uint8_t *host = p->host + p->normal[i];
+
+        if (len > in_size - pos) {
+            error_setg(errp, "multifd %u: xbzrle page data overflows packet",
+                       p->id);
+            return -1;
+        }
+
+        if (len == p->page_size) {
+            memcpy(host, buf + pos, len);
+        } else if (len && xbzrle_decode_buffer(buf + pos, len, host,
+                                               p->page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page",
+                       p->id);
+            return -1;
+        }
+        pos += len;
+    }
+
+    return 0;
+}
+
+MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+};
@@ -234,12 +234,14 @@ static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
 /**
  * nocomp_recv_cleanup: setup receive side
  *
- * For no compression this function does nothing.
+ * Free the buffer used to receive XBZRLE encoded pages, if any.
  *
  * @p: Params for the channel that we are using
  */
 static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
+    g_free(p->compress_data);
+    p->compress_data = NULL;
 }
 
 /**
@@ -262,6 +264,11 @@ static int nocomp_recv(MultiFDRecvParams *p, Error **errp)
 
     flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
 
+    /* XBZRLE is only enabled on the source, it is not a compression method */
+    if (flags == MULTIFD_FLAG_XBZRLE) {
+        return multifd_xbzrle_recv(p, errp);
+    }
+
     if (flags != MULTIFD_FLAG_NOCOMP) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
                    p->id, flags, MULTIFD_FLAG_NOCOMP);
@@ -278,6 +285,9 @@ static int nocomp_recv(MultiFDRecvParams *p, Error **errp)
         p->iov[i].iov_base = p->host + p->normal[i];
         p->iov[i].iov_len = p->page_size;
     }
+    if (p->io_uring) {
+        return multifd_io_uring_recv_pages(p, errp);
+    }
     return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
 }
 
@@ -1162,7 +1172,11 @@ bool multifd_send_setup(void)
     qemu_sem_init(&multifd_send_state->channels_created, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     qatomic_set(&multifd_send_state->exiting, 0);
-    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    if (migrate_xbzrle()) {
+        multifd_send_state->ops = &multifd_xbzrle_ops;
+    } else {
+        multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    }
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -1358,6 +1372,7 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->normal = NULL;
     g_free(p->zero);
     p->zero = NULL;
+    multifd_io_uring_recv_cleanup(p);
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
@@ -1475,8 +1490,12 @@ static void *multifd_recv_thread(void *opaque)
                 break;
             }
 
-            ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
-                                           p->packet_len, &local_err);
+            if (p->io_uring) {
+                ret = multifd_io_uring_recv_packet(p, &local_err);
+            } else {
+                ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
+                                               p->packet_len, &local_err);
+            }
             if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
                 break;
             }
@@ -1491,6 +1510,11 @@ static void *multifd_recv_thread(void *opaque)
             flags = p->flags;
             /* recv methods don't know how to handle the SYNC flag */
             p->flags &= ~MULTIFD_FLAG_SYNC;
+            /*
+             * After a sync the source may not send anything else, so the
+             * next packet can only be waited for once the sync is done.
+             */
+            p->recv_next_packet = !(flags & MULTIFD_FLAG_SYNC);
             has_data = p->normal_num || p->zero_num;
             qemu_mutex_unlock(&p->mutex);
         } else {
@@ -1673,6 +1697,10 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     p->c = ioc;
     object_ref(OBJECT(ioc));
 
+    if (use_packets && migrate_io_uring_recv()) {
+        multifd_io_uring_recv_setup(p);
+    }
+
     p->thread_created = true;
     qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
                        QEMU_THREAD_JOINABLE);
@@ -16,6 +16,7 @@
 #include "ram.h"
 
 typedef struct MultiFDRecvData MultiFDRecvData;
+typedef struct MultiFDIOUring MultiFDIOUring;
 
 bool multifd_send_setup(void);
 void multifd_send_shutdown(void);
@@ -40,6 +41,7 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -220,6 +222,10 @@ typedef struct {
     uint32_t zero_num;
     /* used for de-compression methods */
     void *compress_data;
+    /* whether the header of the next packet can be received with the pages */
+    bool recv_next_packet;
+    /* io_uring receive state, NULL if io_uring is not used */
+    MultiFDIOUring *io_uring;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -238,6 +244,38 @@ typedef struct {
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+
+/* Used instead of the compression methods when XBZRLE is enabled */
+extern MultiFDMethods multifd_xbzrle_ops;
+int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp);
+
+#ifdef CONFIG_LINUX_IO_URING
+void multifd_io_uring_recv_setup(MultiFDRecvParams *p);
+void multifd_io_uring_recv_cleanup(MultiFDRecvParams *p);
+int multifd_io_uring_recv_packet(MultiFDRecvParams *p, Error **errp);
+int multifd_io_uring_recv_pages(MultiFDRecvParams *p, Error **errp);
+#else
+static inline void multifd_io_uring_recv_setup(MultiFDRecvParams *p)
+{
+}
+
+static inline void multifd_io_uring_recv_cleanup(MultiFDRecvParams *p)
+{
+}
+
+static inline int multifd_io_uring_recv_packet(MultiFDRecvParams *p,
+                                               Error **errp)
+{
+    g_assert_not_reached();
+}
+
+static inline int multifd_io_uring_recv_pages(MultiFDRecvParams *p,
+                                              Error **errp)
+{
+    g_assert_not_reached();
+}
+#endif
+
 void multifd_send_fill_packet(MultiFDSendParams *p);
 bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
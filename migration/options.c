@@ -182,6 +182,11 @@ Property migration_properties[] = {
     DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
                        parameters.zero_page_detection,
                        ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_MULTIFD_COMPRESSION("device-state-compression",
+                      MigrationState, parameters.device_state_compression,
+                      MULTIFD_COMPRESSION_NONE),
+    DEFINE_PROP_UINT8("x-dirty-sync-threads", MigrationState,
+                      parameters.x_dirty_sync_threads, 0),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -208,6 +213,17 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("postcopy-from-file",
+                        MIGRATION_CAPABILITY_POSTCOPY_FROM_FILE),
+    DEFINE_PROP_MIG_CAP("concurrent-device-state",
+                        MIGRATION_CAPABILITY_CONCURRENT_DEVICE_STATE),
+    DEFINE_PROP_MIG_CAP("predictive-switchover",
+                        MIGRATION_CAPABILITY_PREDICTIVE_SWITCHOVER),
+    DEFINE_PROP_MIG_CAP("device-state-zero-run",
+                        MIGRATION_CAPABILITY_DEVICE_STATE_ZERO_RUN),
+#ifdef CONFIG_LINUX_IO_URING
+    DEFINE_PROP_MIG_CAP("io-uring-recv", MIGRATION_CAPABILITY_IO_URING_RECV),
+#endif
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -246,6 +262,20 @@ bool migrate_compress(void)
     return s->capabilities[MIGRATION_CAPABILITY_COMPRESS];
 }
 
+bool migrate_concurrent_device_state(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_CONCURRENT_DEVICE_STATE];
+}
+
+bool migrate_device_state_zero_run(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEVICE_STATE_ZERO_RUN];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -281,6 +311,13 @@ bool migrate_ignore_shared(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_IGNORE_SHARED];
 }
 
+bool migrate_io_uring_recv(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_IO_URING_RECV];
+}
+
 bool migrate_late_block_activate(void)
 {
     MigrationState *s = migrate_get_current();
@@ -309,6 +346,13 @@ bool migrate_postcopy_blocktime(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME];
 }
 
+bool migrate_postcopy_from_file(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_FROM_FILE];
+}
+
 bool migrate_postcopy_preempt(void)
 {
     MigrationState *s = migrate_get_current();
@@ -323,6 +367,13 @@ bool migrate_postcopy_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_predictive_switchover(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PREDICTIVE_SWITCHOVER];
+}
+
 bool migrate_rdma_pin_all(void)
 {
     MigrationState *s = migrate_get_current();
@@ -586,6 +637,24 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (new_caps[MIGRATION_CAPABILITY_IO_URING_RECV] &&
+        (!new_caps[MIGRATION_CAPABILITY_MULTIFD] ||
+         new_caps[MIGRATION_CAPABILITY_MAPPED_RAM] ||
+         migrate_multifd_compression() ||
+         migrate_tls())) {
+        error_setg(errp,
+                   "io_uring receive only available for non-compressed non-TLS multifd migration");
+        return false;
+    }
+#else
+    if (new_caps[MIGRATION_CAPABILITY_IO_URING_RECV]) {
+        error_setg(errp,
+                   "io_uring receive requires QEMU built with io_uring support");
+        return false;
+    }
+#endif
+
     if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
         if (!new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
             error_setg(errp, "Postcopy preempt requires postcopy-ram");
@@ -643,8 +712,10 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     }
 
     if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
-        if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
-            error_setg(errp, "Multifd is not compatible with xbzrle");
+        if (new_caps[MIGRATION_CAPABILITY_XBZRLE] &&
+            migrate_multifd_compression()) {
+            error_setg(errp,
+                       "Multifd compression is not compatible with xbzrle");
             return false;
         }
     }
@@ -676,6 +747,27 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_FROM_FILE]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'postcopy-from-file' requires "
+                       "capability 'mapped-ram'");
+            return false;
+        }
+
+        if (!old_caps[MIGRATION_CAPABILITY_POSTCOPY_FROM_FILE] &&
+            runstate_check(RUN_STATE_INMIGRATE) &&
+            !postcopy_ram_supported_by_host(mis, errp)) {
+            error_prepend(errp, "Postcopy is not supported: ");
+            return false;
+        }
+
+        if (migrate_incoming_started()) {
+            error_setg(errp,
+                       "Postcopy from file must be set before incoming starts");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -826,6 +918,21 @@ int migrate_decompress_threads(void)
     return s->parameters.decompress_threads;
 }
 
+MultiFDCompression migrate_device_state_compression(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    assert(s->parameters.device_state_compression < MULTIFD_COMPRESSION__MAX);
+    return s->parameters.device_state_compression;
+}
+
+uint8_t migrate_dirty_sync_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.x_dirty_sync_threads;
+}
+
 uint64_t migrate_downtime_limit(void)
 {
     MigrationState *s = migrate_get_current();
@@ -1060,6 +1167,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->mode = s->parameters.mode;
     params->has_zero_page_detection = true;
     params->zero_page_detection = s->parameters.zero_page_detection;
+    params->has_device_state_compression = true;
+    params->device_state_compression = s->parameters.device_state_compression;
+    params->has_x_dirty_sync_threads = true;
+    params->x_dirty_sync_threads = s->parameters.x_dirty_sync_threads;
 
     return params;
 }
@@ -1097,6 +1208,8 @@ void migrate_params_init(MigrationParameters *params)
     params->has_vcpu_dirty_limit = true;
     params->has_mode = true;
     params->has_zero_page_detection = true;
+    params->has_device_state_compression = true;
+    params->has_x_dirty_sync_threads = true;
 }
 
 /*
@@ -1268,6 +1381,20 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_io_uring_recv() &&
+        ((params->has_multifd_compression && params->multifd_compression) ||
+         (params->tls_creds && *params->tls_creds))) {
+        error_setg(errp,
+                   "io_uring receive only available for non-compressed non-TLS multifd migration");
+        return false;
+    }
+
+    if (migrate_multifd() && migrate_xbzrle() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp, "Multifd compression is not compatible with xbzrle");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -1417,6 +1544,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_zero_page_detection) {
         dest->zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_device_state_compression) {
+        dest->device_state_compression = params->device_state_compression;
+    }
+
+    if (params->has_x_dirty_sync_threads) {
+        dest->x_dirty_sync_threads = params->x_dirty_sync_threads;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1571,6 +1706,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_zero_page_detection) {
         s->parameters.zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_device_state_compression) {
+        s->parameters.device_state_compression =
+            params->device_state_compression;
+    }
+
+    if (params->has_x_dirty_sync_threads) {
+        s->parameters.x_dirty_sync_threads = params->x_dirty_sync_threads;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -28,15 +28,20 @@ bool migrate_auto_converge(void);
 bool migrate_block(void);
 bool migrate_colo(void);
 bool migrate_compress(void);
+bool migrate_concurrent_device_state(void);
+bool migrate_device_state_zero_run(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
 bool migrate_ignore_shared(void);
+bool migrate_io_uring_recv(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
+bool migrate_postcopy_from_file(void);
 bool migrate_postcopy_preempt(void);
+bool migrate_predictive_switchover(void);
 bool migrate_rdma_pin_all(void);
 bool migrate_release_ram(void);
 bool migrate_return_path(void);
@@ -76,6 +81,8 @@ uint8_t migrate_cpu_throttle_increment(void);
 uint8_t migrate_cpu_throttle_initial(void);
 bool migrate_cpu_throttle_tailslow(void);
 int migrate_decompress_threads(void);
+MultiFDCompression migrate_device_state_compression(void);
+uint8_t migrate_dirty_sync_threads(void);
 uint64_t migrate_downtime_limit(void);
 uint8_t migrate_max_cpu_throttle(void);
 uint64_t migrate_max_bandwidth(void);
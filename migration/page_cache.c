@@ -17,12 +17,20 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* Number of items that can cache the same page */
+#define PAGE_CACHE_WAYS 8
+
+/* Maximum number of locks that protect the sets */
+#define PAGE_CACHE_SHARDS 64
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -31,11 +39,22 @@ struct CacheItem {
     uint8_t *it_data;
 };
 
+/*
+ * The cache is set-associative: a page can be cached in any of the
+ * num_ways items of the set that its address hashes to, and the oldest
+ * item of the set is replaced.  The sets are split into shards, each
+ * protected by its own lock, so that several threads can use the cache.
+ */
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t num_ways;
+    unsigned set_bits;
+    size_t num_shards;
+    QemuMutex *shard_locks;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -58,7 +77,7 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     }
 
     /* We prefer not to abort if there is no memory */
-    cache = g_try_malloc(sizeof(*cache));
+    cache = g_try_malloc0(sizeof(*cache));
     if (!cache) {
         error_setg(errp, "Failed to allocate cache");
         return NULL;
@@ -66,6 +85,9 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, PAGE_CACHE_WAYS);
+    cache->set_bits = ctz64(num_pages / cache->num_ways);
+    cache->num_shards = MIN(num_pages / cache->num_ways, PAGE_CACHE_SHARDS);
 
     trace_migration_pagecache_init(cache->max_num_items);
 
@@ -84,6 +106,11 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_addr = -1;
     }
 
+    cache->shard_locks = g_new(QemuMutex, cache->num_shards);
+    for (i = 0; i < cache->num_shards; i++) {
+        qemu_mutex_init(&cache->shard_locks[i]);
+    }
+
     return cache;
 }
 
@@ -97,34 +124,98 @@ void cache_fini(PageCache *cache)
     for (i = 0; i < cache->max_num_items; i++) {
         g_free(cache->page_cache[i].it_data);
     }
+    for (i = 0; i < cache->num_shards; i++) {
+        qemu_mutex_destroy(&cache->shard_locks[i]);
+    }
 
+    g_free(cache->shard_locks);
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+void cache_fini_rcu(PageCache *cache)
+{
+    call_rcu(cache, cache_fini, rcu);
+}
+
+static size_t cache_get_set(const PageCache *cache, uint64_t address)
+{
+    uint64_t page = address / cache->page_size;
+
+    if (!cache->set_bits) {
+        return 0;
+    }
+    /*
+     * Hash the page number, so that pages that are a multiple of the
+     * cache size apart (for example the same offset in different RAM
+     * blocks) do not all compete for the same set.
+     */
+    return (page * 0x9e3779b97f4a7c15ULL) >> (64 - cache->set_bits);
+}
+
+static QemuMutex *cache_get_lock(PageCache *cache, uint64_t addr)
+{
+    return &cache->shard_locks[cache_get_set(cache, addr) %
+                               cache->num_shards];
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    qemu_mutex_lock(cache_get_lock(cache, addr));
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(cache_get_lock(cache, addr));
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set;
+    size_t i;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    set = &cache->page_cache[cache_get_set(cache, addr) * cache->num_ways];
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Pick the item of the set that receives @addr: an unused one if
+ * possible, otherwise the one that was used least recently.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set, *victim;
+    size_t i;
+
+    set = &cache->page_cache[cache_get_set(cache, addr) * cache->num_ways];
+    victim = &set[0];
+    for (i = 0; i < cache->num_ways; i++) {
+        if (!set[i].it_data) {
+            return &set[i];
+        }
+        if (set[i].it_age < victim->it_age) {
+            victim = &set[i];
+        }
+    }
 
-    return &cache->page_cache[pos];
+    return victim;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -134,7 +225,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
         return true;
@@ -150,11 +241,12 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (!it) {
+        it = cache_get_victim(cache, addr);
+        if (it->it_data && it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* the cache page is fresh, don't replace it */
+            return -1;
+        }
     }
     /* allocate page */
     if (!it->it_data) {
@@ -163,7 +255,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             trace_migration_pagecache_insert();
             return -1;
         }
-        cache->num_items++;
+        qatomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -35,6 +35,30 @@ PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lock: lock the part of the cache that holds a page
+ *
+ * The functions below must be called with this lock held when the
+ * cache is used by more than one thread.
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: unlock the part of the cache that holds a page
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
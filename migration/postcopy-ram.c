@@ -17,7 +17,9 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -760,6 +762,10 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     return ret;
 }
 
+static int postcopy_file_place_range(MigrationIncomingState *mis,
+                                     RAMBlock *rb, ram_addr_t offset,
+                                     size_t len, void *buf);
+
 static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
                                  ram_addr_t start, uint64_t haddr)
 {
@@ -780,6 +786,13 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
         return received ? 0 : postcopy_place_page_zero(mis, aligned, rb);
     }
 
+    if (mis->postcopy_file_ioc) {
+        void *buf = mis->postcopy_tmp_pages[0].tmp_huge_page;
+
+        return postcopy_file_place_range(mis, rb, start,
+                                         qemu_ram_pagesize(rb), buf);
+    }
+
     return migrate_send_rp_req_pages(mis, rb, start, haddr);
 }
 
@@ -1009,7 +1022,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
             break;
         }
 
-        if (!mis->to_src_file) {
+        if (!mis->to_src_file && !mis->postcopy_file_ioc) {
             /*
              * Possibly someone tells us that the return path is
              * broken already using the event. We should hold until
@@ -1087,6 +1100,11 @@ retry:
              */
             ret = postcopy_request_page(mis, rb, rb_offset,
                                         msg.arg.pagefault.address);
+            if (ret && mis->postcopy_file_ioc) {
+                /* There is no source to recover from */
+                error_report("%s: failed to load page from file", __func__);
+                exit(EXIT_FAILURE);
+            }
             if (ret) {
                 /* May be network failure, try to wait for recovery */
                 postcopy_pause_fault_thread(mis);
@@ -1391,6 +1409,201 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/*
+ * postcopy-from-file: guest RAM is restored from a mapped-ram file while
+ * the guest runs.  The fault thread reads the pages that the guest touches
+ * straight from the file, and a few prefetch threads load everything else.
+ */
+
+#define POSTCOPY_FILE_CHUNK_SIZE    (1 * MiB)
+
+typedef struct PostcopyFilePrefetch {
+    MigrationIncomingState *mis;
+    QemuThread thread;
+    int index;
+    int nr_threads;
+    size_t chunk_size;
+    int ret;
+} PostcopyFilePrefetch;
+
+/*
+ * Place the host pages of @rb between @offset and @offset + @len that are
+ * not there yet.  @buf is a bounce buffer of @len bytes.
+ */
+static int postcopy_file_place_range(MigrationIncomingState *mis,
+                                     RAMBlock *rb, ram_addr_t offset,
+                                     size_t len, void *buf)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    Error *local_err = NULL;
+    size_t off;
+    int ret;
+
+    for (off = 0; off < len; off += pagesize) {
+        if (!ramblock_recv_bitmap_test_byte_offset(rb, offset + off)) {
+            break;
+        }
+    }
+    if (off == len) {
+        return 0;
+    }
+
+    ret = ram_block_read_mapped_ram(mis->postcopy_file_ioc, rb, offset, len,
+                                    buf, &local_err);
+    if (ret < 0) {
+        error_report_err(local_err);
+        return ret;
+    }
+
+    for (off = 0; off < len; off += pagesize) {
+        void *host = qemu_ram_get_host_addr(rb) + offset + off;
+        void *from = NULL;
+
+        if (ramblock_recv_bitmap_test_byte_offset(rb, offset + off)) {
+            continue;
+        }
+
+        if (ret && !buffer_is_zero(buf + off, pagesize)) {
+            from = buf + off;
+        } else if (!qemu_ram_is_uf_zeroable(rb)) {
+            from = mis->postcopy_tmp_zero_page;
+        }
+
+        /* The fault thread and the prefetch threads can race on a page */
+        if (qemu_ufd_copy_ioctl(mis, host, from, pagesize, rb) &&
+            errno != EEXIST) {
+            int e = errno;
+            error_report("%s: %s placing host: %p (size: %zd)",
+                         __func__, strerror(e), host, pagesize);
+            return -e;
+        }
+    }
+
+    return 0;
+}
+
+static void *postcopy_file_prefetch_thread(void *opaque)
+{
+    PostcopyFilePrefetch *p = opaque;
+    size_t stride = p->chunk_size * p->nr_threads;
+    void *buf = qemu_memalign(qemu_real_host_page_size(), p->chunk_size);
+    ram_addr_t offset;
+    RAMBlock *rb;
+
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            for (offset = p->chunk_size * p->index;
+                 offset < rb->postcopy_length && !p->ret;
+                 offset += stride) {
+                size_t len = MIN(p->chunk_size, rb->postcopy_length - offset);
+
+                p->ret = postcopy_file_place_range(p->mis, rb, offset, len,
+                                                   buf);
+            }
+        }
+    }
+    rcu_unregister_thread();
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+/*
+ * Takes the place of the postcopy listen thread: loads all of guest RAM
+ * once the device state is loaded, then completes the migration.
+ */
+static void *postcopy_file_listen_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int nr_threads = migrate_multifd() ? migrate_multifd_channels() : 1;
+    g_autofree PostcopyFilePrefetch *prefetch = NULL;
+    int i, ret = 0;
+
+    qemu_sem_post(&mis->thread_sync_sem);
+    rcu_register_thread();
+
+    qemu_event_wait(&mis->main_thread_load_event);
+    trace_postcopy_file_listen_thread_start(nr_threads);
+
+    prefetch = g_new0(PostcopyFilePrefetch, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        prefetch[i].mis = mis;
+        prefetch[i].index = i;
+        prefetch[i].nr_threads = nr_threads;
+        prefetch[i].chunk_size = MAX(POSTCOPY_FILE_CHUNK_SIZE,
+                                     mis->largest_page_size);
+        qemu_thread_create(&prefetch[i].thread, "postcopy/prefetch",
+                           postcopy_file_prefetch_thread, &prefetch[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&prefetch[i].thread);
+        ret = ret ?: prefetch[i].ret;
+    }
+
+    if (ret) {
+        /* The guest may already be running, and cannot do without RAM */
+        error_report("%s: failed to load guest RAM: %s", __func__,
+                     strerror(-ret));
+        rcu_unregister_thread();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Wait for process_incoming_migration_bh() to start the guest */
+    qemu_sem_wait(&mis->postcopy_file_sem);
+    trace_postcopy_file_listen_thread_exit();
+
+    postcopy_ram_incoming_cleanup(mis);
+    object_unref(OBJECT(mis->postcopy_file_ioc));
+    mis->postcopy_file_ioc = NULL;
+
+    migrate_set_state(&mis->state, MIGRATION_STATUS_POSTCOPY_ACTIVE,
+                                   MIGRATION_STATUS_COMPLETED);
+    migration_incoming_state_destroy();
+    qemu_loadvm_state_cleanup();
+
+    rcu_unregister_thread();
+    mis->have_listen_thread = false;
+    postcopy_state_set(POSTCOPY_INCOMING_END);
+
+    return NULL;
+}
+
+static int postcopy_file_check_ramblock(RAMBlock *rb, void *opaque)
+{
+    /* Other processes would see the pages that are not loaded yet */
+    if (qemu_ram_is_shared(rb)) {
+        error_report("postcopy-from-file: RAM block %s is shared",
+                     qemu_ram_get_idstr(rb));
+        return -1;
+    }
+
+    return 0;
+}
+
+int postcopy_file_incoming_setup(MigrationIncomingState *mis, QEMUFile *f)
+{
+    if (foreach_not_ignored_block(postcopy_file_check_ramblock, NULL)) {
+        return -EINVAL;
+    }
+
+    /* The fault thread starts serving pages from the file right away */
+    mis->postcopy_file_ioc = qemu_file_get_ioc(f);
+    object_ref(OBJECT(mis->postcopy_file_ioc));
+
+    if (postcopy_ram_incoming_init(mis) ||
+        postcopy_ram_incoming_setup(mis)) {
+        return -EINVAL;
+    }
+
+    /* Keeps qemu_loadvm_state() from cleaning up the RAM load state */
+    mis->have_listen_thread = true;
+    postcopy_thread_create(mis, &mis->listen_thread, "postcopy/file",
+                           postcopy_file_listen_thread, QEMU_THREAD_DETACHED);
+    return 0;
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1441,6 +1654,12 @@ int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from,
     return -1;
 }
 
+int postcopy_file_incoming_setup(MigrationIncomingState *mis, QEMUFile *f)
+{
+    error_report("%s: No OS support", __func__);
+    return -1;
+}
+
 int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
                         RAMBlock *rb)
 {
@@ -35,6 +35,13 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis);
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis);
 
+/*
+ * Called with postcopy-from-file once the RAMBlocks of a mapped-ram file
+ * have been parsed: guest RAM is then loaded on demand and in the
+ * background, while the device state is loaded and the guest runs.
+ */
+int postcopy_file_incoming_setup(MigrationIncomingState *mis, QEMUFile *f);
+
 /*
  * Userfault requires us to mark RAM as NOHUGEPAGE prior to discard
  * however leaving it until after precopy means that most of the precopy
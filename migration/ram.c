@@ -32,6 +32,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
 #include "ram.h"
@@ -112,6 +113,14 @@
  */
 #define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
 
+/*
+ * When doing mapped-ram migration without multifd, contiguous pages are
+ * written to the migration file together, up to this amount at a time.
+ * This lets the block layer split the write over several clusters in
+ * parallel when saving an internal snapshot.
+ */
+#define MAPPED_RAM_SAVE_BUF_SIZE 0x400000
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -131,6 +140,10 @@ struct PageSearchStatus {
     /* The start/end of current host page.  Invalid if host_page_sending==false */
     unsigned long host_page_start;
     unsigned long host_page_end;
+    /* Contiguous pages queued by mapped_ram_queue_page(), not written yet */
+    RAMBlock *mapped_ram_block;
+    ram_addr_t mapped_ram_offset;
+    size_t mapped_ram_len;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -141,13 +154,18 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /*
+     * Cache for XBZRLE, Protected by lock.  The multifd threads use it
+     * under the RCU read lock and the cache's own locks instead.
+     */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
     uint8_t *zero_target_page;
     /* buffer used for XBZRLE decoding */
     uint8_t *decoded_buf;
+    /* Are we really using XBZRLE (e.g., after the first round). */
+    bool started;
 } XBZRLE;
 
 static void XBZRLE_cache_lock(void)
@@ -179,7 +197,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -203,8 +221,9 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        qatomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -349,6 +368,43 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/*
+ * On large guests, merging the dirty log into the migration bitmap takes a
+ * long time, so it is split into shards that a pool of threads processes in
+ * parallel.  Unless the x-dirty-sync-threads parameter sets the number of
+ * threads, one more thread is added for every RAM_SYNC_BYTES_PER_THREAD of
+ * guest memory.
+ */
+#define RAM_SYNC_BYTES_PER_THREAD   (256 * GiB)
+#define RAM_SYNC_MAX_THREADS        8
+
+typedef struct RamSyncShard {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+    /* Set by the thread that processed the shard */
+    uint64_t new_dirty_pages;
+} RamSyncShard;
+
+typedef struct RamSyncPool {
+    QemuThread *threads;
+    int nr_threads;
+    bool quit;
+
+    /* Posted once per thread to start a sync, and by each thread when done */
+    QemuSemaphore work_sem;
+    QemuSemaphore done_sem;
+
+    /* Filled by the migration thread before posting work_sem */
+    RamSyncShard *shards;
+    int nr_shards;
+    int max_shards;
+
+    /* Index of the next shard to process, atomic */
+    int next_shard;
+    Stat64 new_dirty_pages;
+} RamSyncPool;
+
 /* State of RAM for migration */
 struct RAMState {
     /*
@@ -371,6 +427,10 @@ struct RAMState {
     /* these variables are used for bitmap sync */
     /* last time we did a full bitmap_sync */
     int64_t time_last_bitmap_sync;
+    /* end of the last bitmap sync, even if shorter than a period */
+    int64_t time_last_sync;
+    /* predicted dirty page rate in bytes per second */
+    uint64_t predicted_dirty_rate;
     /* bytes transferred at start_time */
     uint64_t bytes_xfer_prev;
     /* number of dirty pages since start_time */
@@ -381,8 +441,6 @@ struct RAMState {
     uint64_t xbzrle_pages_prev;
     /* Amount of xbzrle encoded bytes since the beginning of the period */
     uint64_t xbzrle_bytes_prev;
-    /* Are we really using XBZRLE (e.g., after the first round). */
-    bool xbzrle_started;
     /* Are we on the last stage of migration */
     bool last_stage;
 
@@ -412,6 +470,9 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+
+    /* Threads that synchronize the dirty bitmap, NULL on small guests */
+    RamSyncPool *sync_pool;
 };
 typedef struct RAMState RAMState;
 
@@ -589,8 +650,10 @@ static void xbzrle_cache_zero_page(ram_addr_t current_addr)
 {
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
+    cache_lock(XBZRLE.cache, current_addr);
     cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
                  stat64_get(&mig_stats.dirty_sync_count));
+    cache_unlock(XBZRLE.cache, current_addr);
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -614,6 +677,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
                             RAMBlock *block, ram_addr_t offset)
 {
     int encoded_len = 0, bytes_xbzrle;
+    int64_t start_ns;
     uint8_t *prev_cached_page;
     QEMUFile *file = pss->pss_channel;
     uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
@@ -651,9 +715,11 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
 
     /* XBZRLE encoding (if there is no overflow) */
+    start_ns = get_clock();
     encoded_len = xbzrle_encode_buffer(prev_cached_page, XBZRLE.current_buf,
                                        TARGET_PAGE_SIZE, XBZRLE.encoded_buf,
                                        TARGET_PAGE_SIZE);
+    xbzrle_counters.encoding_time += get_clock() - start_ns;
 
     /*
      * Update the cache contents, so that it corresponds to the data
@@ -697,6 +763,130 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     return 1;
 }
 
+/**
+ * xbzrle_multifd_encode_page: encode a page for a multifd channel
+ *
+ * Like save_xbzrle_page(), but only fills @dst and can be called by
+ * several multifd threads at the same time.  The counters are
+ * accumulated in @stats; see xbzrle_multifd_add_stats().
+ *
+ * Returns: the size of the XBZRLE data in @dst
+ *          0 means that page is identical to the one already sent
+ *          -1 means that @dst contains the whole page
+ *
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ * @buf: page sized buffer for the current contents of the page
+ * @dst: page sized output buffer
+ * @stats: counters for the calling thread
+ */
+int xbzrle_multifd_encode_page(RAMBlock *block, ram_addr_t offset,
+                               uint8_t *buf, uint8_t *dst,
+                               XBZRLECacheStats *stats)
+{
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    ram_addr_t current_addr = block->offset + offset;
+    uint8_t *current_data = block->host + offset;
+    uint8_t *prev_cached_page;
+    int encoded_len = -1;
+    int64_t start_ns;
+    PageCache *cache;
+
+    RCU_READ_LOCK_GUARD();
+    cache = qatomic_rcu_read(&XBZRLE.cache);
+    if (!cache) {
+        memcpy(dst, current_data, TARGET_PAGE_SIZE);
+        return -1;
+    }
+
+    cache_lock(cache, current_addr);
+    if (!cache_is_cached(cache, current_addr, generation)) {
+        if (qatomic_read(&XBZRLE.started)) {
+            stats->cache_miss++;
+            if (cache_insert(cache, current_addr, current_data,
+                             generation) == 0) {
+                /* Send the data that was inserted into the cache */
+                current_data = get_cached_data(cache, current_addr);
+            }
+        }
+        memcpy(dst, current_data, TARGET_PAGE_SIZE);
+        goto out;
+    }
+
+    stats->pages++;
+    prev_cached_page = get_cached_data(cache, current_addr);
+    memcpy(buf, current_data, TARGET_PAGE_SIZE);
+
+    /*
+     * Leave one byte of room, so that the receiver can tell an encoded
+     * page from a whole one by its size.
+     */
+    start_ns = get_clock();
+    encoded_len = xbzrle_encode_buffer(prev_cached_page, buf,
+                                       TARGET_PAGE_SIZE, dst,
+                                       TARGET_PAGE_SIZE - 1);
+    stats->encoding_time += get_clock() - start_ns;
+
+    if (encoded_len != 0) {
+        memcpy(prev_cached_page, buf, TARGET_PAGE_SIZE);
+    }
+    if (encoded_len == -1) {
+        stats->overflow++;
+        stats->bytes += TARGET_PAGE_SIZE;
+        memcpy(dst, buf, TARGET_PAGE_SIZE);
+    } else {
+        stats->bytes += encoded_len;
+    }
+
+out:
+    cache_unlock(cache, current_addr);
+    return encoded_len;
+}
+
+/**
+ * xbzrle_multifd_zero_page: update the cache for a page sent as all 0
+ *
+ * Like xbzrle_cache_zero_page(), for the multifd threads.  Only pages
+ * that are already cached are updated.
+ *
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+void xbzrle_multifd_zero_page(RAMBlock *block, ram_addr_t offset)
+{
+    ram_addr_t current_addr = block->offset + offset;
+    uint8_t *cached_page;
+    PageCache *cache;
+
+    RCU_READ_LOCK_GUARD();
+    cache = qatomic_rcu_read(&XBZRLE.cache);
+    if (!cache) {
+        return;
+    }
+
+    cache_lock(cache, current_addr);
+    cached_page = get_cached_data(cache, current_addr);
+    if (cached_page) {
+        memset(cached_page, 0, TARGET_PAGE_SIZE);
+    }
+    cache_unlock(cache, current_addr);
+}
+
+/**
+ * xbzrle_multifd_add_stats: add the counters of a multifd thread
+ *
+ * @stats: counters accumulated by xbzrle_multifd_encode_page()
+ */
+void xbzrle_multifd_add_stats(const XBZRLECacheStats *stats)
+{
+    QEMU_LOCK_GUARD(&XBZRLE.lock);
+    xbzrle_counters.bytes += stats->bytes;
+    xbzrle_counters.pages += stats->pages;
+    xbzrle_counters.cache_miss += stats->cache_miss;
+    xbzrle_counters.overflow += stats->overflow;
+    xbzrle_counters.encoding_time += stats->encoding_time;
+}
+
 /**
  * pss_find_next_dirty: find the next dirty page of current ramblock
  *
@@ -917,6 +1107,195 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     uint64_t new_dirty_pages =
         cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
 
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+    rb->dirty_pages_period += new_dirty_pages;
+}
+
+static void ram_sync_pool_run_shards(RamSyncPool *pool)
+{
+    uint64_t new_dirty_pages = 0;
+    int i;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        while ((i = qatomic_fetch_inc(&pool->next_shard)) < pool->nr_shards) {
+            RamSyncShard *shard = &pool->shards[i];
+
+            shard->new_dirty_pages =
+                cpu_physical_memory_sync_dirty_bitmap(shard->block,
+                                                      shard->start,
+                                                      shard->length);
+            new_dirty_pages += shard->new_dirty_pages;
+        }
+    }
+    stat64_add(&pool->new_dirty_pages, new_dirty_pages);
+}
+
+static void *ram_sync_pool_thread(void *opaque)
+{
+    RamSyncPool *pool = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_wait(&pool->work_sem);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        ram_sync_pool_run_shards(pool);
+        qemu_sem_post(&pool->done_sem);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static RamSyncPool *ram_sync_pool_new(uint64_t ram_bytes)
+{
+    RamSyncPool *pool;
+    int nr_threads;
+    int i;
+
+    /*
+     * TCG resets the TLB dirty state while synchronizing, which is not
+     * safe to do from several threads.
+     */
+    if (tcg_enabled()) {
+        return NULL;
+    }
+
+    nr_threads = migrate_dirty_sync_threads();
+    if (!nr_threads) {
+        nr_threads = MIN(ram_bytes / RAM_SYNC_BYTES_PER_THREAD,
+                         RAM_SYNC_MAX_THREADS);
+        nr_threads = MIN(nr_threads, g_get_num_processors() - 1);
+    }
+    if (nr_threads <= 0) {
+        return NULL;
+    }
+
+    pool = g_new0(RamSyncPool, 1);
+    pool->threads = g_new0(QemuThread, nr_threads);
+    pool->nr_threads = nr_threads;
+    qemu_sem_init(&pool->work_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&pool->threads[i], "mig/src/sync",
+                           ram_sync_pool_thread, pool,
+                           QEMU_THREAD_JOINABLE);
+    }
+    return pool;
+}
+
+static void ram_sync_pool_free(RamSyncPool *pool)
+{
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    qemu_sem_destroy(&pool->work_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_free(pool->shards);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
+/*
+ * Returns how much of @block, from its start, can be split into shards.
+ * Shards must not share words of the dirty bitmaps, and they must use the
+ * fast path of cpu_physical_memory_sync_dirty_bitmap() that only postpones
+ * clearing the dirty log.  *@shard_size is set to the shard size.
+ */
+static ram_addr_t ram_sync_shardable_length(RAMBlock *block,
+                                            ram_addr_t *shard_size)
+{
+    ram_addr_t word_size = (ram_addr_t)BITS_PER_LONG << TARGET_PAGE_BITS;
+
+    if (!block->clear_bmap ||
+        (block->offset >> TARGET_PAGE_BITS) % BITS_PER_LONG) {
+        return 0;
+    }
+
+    /* A word of clear_bmap covers the most memory */
+    *shard_size = word_size << block->clear_bmap_shift;
+    return QEMU_ALIGN_DOWN(block->used_length, word_size);
+}
+
+static void ram_sync_pool_add_block(RamSyncPool *pool, RAMBlock *block)
+{
+    ram_addr_t shard_size;
+    ram_addr_t length = ram_sync_shardable_length(block, &shard_size);
+    ram_addr_t start;
+
+    for (start = 0; start < length; start += shard_size) {
+        if (pool->nr_shards == pool->max_shards) {
+            pool->max_shards = MAX(pool->max_shards * 2, 64);
+            pool->shards = g_renew(RamSyncShard, pool->shards,
+                                   pool->max_shards);
+        }
+        pool->shards[pool->nr_shards++] = (RamSyncShard) {
+            .block = block,
+            .start = start,
+            .length = MIN(shard_size, length - start),
+        };
+    }
+}
+
+/*
+ * Synchronizes the dirty bitmap of all RAMBlocks with the help of the
+ * threads in rs->sync_pool.  Called with RCU critical section and
+ * bitmap_mutex held.
+ */
+static void migration_bitmap_sync_parallel(RAMState *rs)
+{
+    RamSyncPool *pool = rs->sync_pool;
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    int i;
+
+    pool->nr_shards = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_sync_pool_add_block(pool, block);
+    }
+
+    qatomic_set(&pool->next_shard, 0);
+    stat64_set(&pool->new_dirty_pages, 0);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    ram_sync_pool_run_shards(pool);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+    new_dirty_pages = stat64_get(&pool->new_dirty_pages);
+    for (i = 0; i < pool->nr_shards; i++) {
+        pool->shards[i].block->dirty_pages_period +=
+            pool->shards[i].new_dirty_pages;
+    }
+
+    /* Whatever could not be split into shards is done here */
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t shard_size;
+        ram_addr_t done = ram_sync_shardable_length(block, &shard_size);
+
+        if (done < block->used_length) {
+            uint64_t pages =
+                cpu_physical_memory_sync_dirty_bitmap(block, done,
+                                                      block->used_length -
+                                                      done);
+
+            block->dirty_pages_period += pages;
+            new_dirty_pages += pages;
+        }
+    }
+
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
 }
@@ -964,9 +1343,13 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
 
     if (migrate_xbzrle()) {
         double encoded_size, unencoded_size;
+        uint64_t hits = xbzrle_counters.pages - rs->xbzrle_pages_prev;
+        uint64_t misses = xbzrle_counters.cache_miss -
+                          rs->xbzrle_cache_miss_prev;
 
-        xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
-            rs->xbzrle_cache_miss_prev) / page_count;
+        xbzrle_counters.cache_miss_rate = (double)misses / page_count;
+        xbzrle_counters.cache_hit_rate =
+            hits + misses ? (double)hits / (hits + misses) : 0;
         rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
         unencoded_size = (xbzrle_counters.pages - rs->xbzrle_pages_prev) *
                          TARGET_PAGE_SIZE;
@@ -1013,13 +1396,131 @@ static void migration_dirty_limit_guest(void)
     trace_migration_dirty_limit_guest(quota_dirtyrate);
 }
 
-static void migration_trigger_throttle(RAMState *rs)
+/*
+ * Weight of the last sample in the moving average of the dirty rates.
+ * A high weight reacts quickly to workload changes, while the deviation
+ * keeps track of how bursty the block is.
+ */
+#define DIRTY_RATE_EWMA_WEIGHT  0.5
+
+/*
+ * Update the dirty rate of each RAMBlock with the pages dirtied during
+ * the last period, and predict the dirty rate of the guest as the sum of
+ * the average plus the deviation of every block.  Predicting per block
+ * keeps one bursty block from being smoothed out by the idle ones.
+ */
+static void migration_update_dirty_rates(RAMState *rs, int64_t end_time)
+{
+    int64_t period_ms = end_time - rs->time_last_bitmap_sync;
+    double predicted = 0;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        double rate = (double)block->dirty_pages_period * 1000 / period_ms;
+        double delta = rate - block->dirty_rate;
+        double dev = delta < 0 ? -delta : delta;
+
+        block->dirty_rate += DIRTY_RATE_EWMA_WEIGHT * delta;
+        block->dirty_rate_dev += DIRTY_RATE_EWMA_WEIGHT *
+                                 (dev - block->dirty_rate_dev);
+        block->dirty_pages_period = 0;
+        predicted += block->dirty_rate + block->dirty_rate_dev;
+    }
+    rs->predicted_dirty_rate = predicted * TARGET_PAGE_SIZE;
+}
+
+/*
+ * Split the dirty rate that the migration can keep up with between the
+ * vCPUs: the ones dirtying memory slower than their fair share keep their
+ * rate, and whatever they leave is shared among the others.  Needs the
+ * dirty limit to be in service to know the rate of each vCPU, so the
+ * first call limits all vCPUs to their fair share.
+ */
+static void migration_dirty_limit_vcpus(uint64_t bytes_xfer_period,
+                                        int64_t period_ms)
+{
+    MigrationState *s = migrate_get_current();
+    uint64_t threshold = migrate_throttle_trigger_threshold();
+    /* dirty rates are in MB/s */
+    uint64_t target = bytes_xfer_period * 1000 / period_ms * threshold / 100 /
+                      MiB;
+    g_autofree int64_t *rates = NULL;
+    uint64_t fair, quota, budget = target;
+    int nr_vcpus = 0, nr_heavy = 0;
+    CPUState *cpu;
+    int i;
+
+    CPU_FOREACH(cpu) {
+        nr_vcpus++;
+    }
+    fair = MAX(target / nr_vcpus, s->parameters.vcpu_dirty_limit);
+
+    if (!dirtylimit_in_service()) {
+        qmp_set_vcpu_dirty_limit(false, -1, fair, NULL);
+        trace_migration_dirty_limit_guest(fair);
+        return;
+    }
+
+    rates = g_new(int64_t, nr_vcpus);
+    i = 0;
+    dirtylimit_state_lock();
+    CPU_FOREACH(cpu) {
+        rates[i] = vcpu_dirty_rate_get(cpu->cpu_index);
+        if (rates[i] < fair) {
+            budget -= MIN(budget, rates[i]);
+        } else {
+            nr_heavy++;
+        }
+        i++;
+    }
+    dirtylimit_state_unlock();
+
+    if (!nr_heavy) {
+        return;
+    }
+    quota = MAX(budget / nr_heavy, s->parameters.vcpu_dirty_limit);
+    i = 0;
+    CPU_FOREACH(cpu) {
+        if (rates[i] >= fair) {
+            qmp_set_vcpu_dirty_limit(true, cpu->cpu_index, quota, NULL);
+            trace_migration_dirty_limit_vcpu(cpu->cpu_index, rates[i], quota);
+        }
+        i++;
+    }
+}
+
+/**
+ * ram_predict_dirty_bytes: predict the memory dirtied since the last sync
+ *
+ * Returns the number of bytes that the guest is predicted to have dirtied
+ * since the dirty bitmap was last synchronized.  Called from the migration
+ * thread.
+ *
+ * @rate: set to the predicted dirty rate, in bytes per second
+ */
+uint64_t ram_predict_dirty_bytes(uint64_t *rate)
+{
+    RAMState *rs = ram_state;
+    int64_t elapsed;
+
+    if (!rs || !rs->time_last_sync) {
+        *rate = 0;
+        return 0;
+    }
+    elapsed = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - rs->time_last_sync;
+    *rate = rs->predicted_dirty_rate;
+    return rs->predicted_dirty_rate * MAX(elapsed, 0) / 1000;
+}
+
+static void migration_trigger_throttle(RAMState *rs, int64_t end_time)
 {
     uint64_t threshold = migrate_throttle_trigger_threshold();
     uint64_t bytes_xfer_period =
         migration_transferred_bytes() - rs->bytes_xfer_prev;
     uint64_t bytes_dirty_period = rs->num_dirty_pages_period * TARGET_PAGE_SIZE;
     uint64_t bytes_dirty_threshold = bytes_xfer_period * threshold / 100;
+    int64_t period_ms = end_time - rs->time_last_bitmap_sync;
 
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
@@ -1028,6 +1529,18 @@ static void migration_trigger_throttle(RAMState *rs)
         return;
     }
 
+    /*
+     * With a prediction of the dirty rate, there is no need to wait for
+     * two periods in a row to be above the threshold.
+     */
+    if (migrate_predictive_switchover() && migrate_dirty_limit()) {
+        if (rs->predicted_dirty_rate * period_ms / 1000 >
+            bytes_dirty_threshold) {
+            migration_dirty_limit_vcpus(bytes_xfer_period, period_ms);
+        }
+        return;
+    }
+
     /*
      * The following detection logic can be refined later. For now:
      * Check to see if the ratio between dirtied bytes and the approx.
@@ -1048,10 +1561,16 @@ static void migration_trigger_throttle(RAMState *rs)
     }
 }
 
-static void migration_bitmap_sync(RAMState *rs, bool last_stage)
+/*
+ * If @drop_bql is true, the BQL is released while the threads of
+ * rs->sync_pool merge the dirty log, so that vCPUs are not blocked on it.
+ * The caller must be able to cope with that.
+ */
+static void migration_bitmap_sync(RAMState *rs, bool last_stage,
+                                  bool drop_bql)
 {
     RAMBlock *block;
-    int64_t end_time;
+    int64_t start_us, end_time;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1059,26 +1578,44 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
         rs->time_last_bitmap_sync = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     }
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync(last_stage);
 
+    drop_bql = drop_bql && rs->sync_pool;
+    if (drop_bql) {
+        /* The BQL must not be taken with bitmap_mutex held */
+        bql_unlock();
+    }
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (rs->sync_pool) {
+            migration_bitmap_sync_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
+    if (drop_bql) {
+        bql_lock();
+    }
 
     memory_global_after_dirty_log_sync();
+    stat64_set(&mig_stats.dirty_sync_duration,
+               qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us);
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
+    rs->time_last_sync = end_time;
+
     /* more than 1 second = 1000 millisecons */
     if (end_time > rs->time_last_bitmap_sync + 1000) {
-        migration_trigger_throttle(rs);
+        migration_update_dirty_rates(rs, end_time);
+        migration_trigger_throttle(rs, end_time);
 
         migration_update_rates(rs, end_time);
 
@@ -1095,7 +1632,8 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 }
 
-static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage)
+static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage,
+                                          bool drop_bql)
 {
     Error *local_err = NULL;
 
@@ -1108,7 +1646,7 @@ static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage)
         local_err = NULL;
     }
 
-    migration_bitmap_sync(rs, last_stage);
+    migration_bitmap_sync(rs, last_stage, drop_bql);
 
     if (precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC, &local_err)) {
         error_report_err(local_err);
@@ -1166,7 +1704,7 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
      * Must let xbzrle know, otherwise a previous (now 0'd) cached
      * page would be stale.
      */
-    if (rs->xbzrle_started) {
+    if (XBZRLE.started) {
         XBZRLE_cache_lock();
         xbzrle_cache_zero_page(pss->block->offset + offset);
         XBZRLE_cache_unlock();
@@ -1201,6 +1739,61 @@ static bool control_save_page(PageSearchStatus *pss,
     return true;
 }
 
+/**
+ * mapped_ram_flush_pages: write the pages queued with mapped-ram
+ *
+ * @pss: current PSS channel
+ */
+static void mapped_ram_flush_pages(PageSearchStatus *pss)
+{
+    RAMBlock *block = pss->mapped_ram_block;
+
+    if (!pss->mapped_ram_len) {
+        return;
+    }
+
+    qemu_put_buffer_at(pss->pss_channel, block->host + pss->mapped_ram_offset,
+                       pss->mapped_ram_len,
+                       block->pages_offset + pss->mapped_ram_offset);
+    pss->mapped_ram_len = 0;
+}
+
+/**
+ * mapped_ram_queue_page: queue a page to be written with mapped-ram
+ *
+ * Pages contiguous in the RAMBlock are written to the migration file
+ * with a single request, so that the destination of the write sees
+ * large requests instead of one request per page.
+ *
+ * @pss: current PSS channel
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+static void mapped_ram_queue_page(PageSearchStatus *pss, RAMBlock *block,
+                                  ram_addr_t offset)
+{
+    if (pss->mapped_ram_len &&
+        (pss->mapped_ram_block != block ||
+         pss->mapped_ram_offset + pss->mapped_ram_len != offset ||
+         pss->mapped_ram_len >= MAPPED_RAM_SAVE_BUF_SIZE)) {
+        mapped_ram_flush_pages(pss);
+    }
+
+    if (!pss->mapped_ram_len) {
+        pss->mapped_ram_block = block;
+        pss->mapped_ram_offset = offset;
+    }
+    pss->mapped_ram_len += TARGET_PAGE_SIZE;
+
+    /*
+     * With background snapshot the page is unprotected as soon as it is
+     * saved, so it must hit the file before the guest can change it.
+     */
+    if (migrate_background_snapshot()) {
+        mapped_ram_flush_pages(pss);
+    }
+}
+
 /*
  * directly send the page to the stream
  *
@@ -1218,8 +1811,8 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
     QEMUFile *file = pss->pss_channel;
 
     if (migrate_mapped_ram()) {
-        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
-                           block->pages_offset + offset);
+        /* @buf is always the page in guest memory with mapped-ram */
+        mapped_ram_queue_page(pss, block, offset);
         set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
     } else {
         ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
@@ -1262,7 +1855,7 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
     XBZRLE_cache_lock();
-    if (rs->xbzrle_started && !migration_in_postcopy()) {
+    if (XBZRLE.started && !migration_in_postcopy()) {
         pages = save_xbzrle_page(rs, pss, &p, current_addr,
                                  block, offset);
         if (!rs->last_stage) {
@@ -1395,7 +1988,7 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
             pss->complete_round = true;
             /* After the first round, enable XBZRLE. */
             if (migrate_xbzrle()) {
-                rs->xbzrle_started = true;
+                qatomic_set(&XBZRLE.started, true);
             }
         }
         /* Didn't find anything this time, but try again on the new block */
@@ -2414,6 +3007,7 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        ram_sync_pool_free((*rsp)->sync_pool);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2426,11 +3020,14 @@ static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        PageCache *cache = XBZRLE.cache;
+
+        /* The multifd threads may still be using the cache */
+        qatomic_rcu_set(&XBZRLE.cache, NULL);
+        cache_fini_rcu(cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2483,7 +3080,7 @@ static void ram_state_reset(RAMState *rs)
     rs->last_seen_block = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
-    rs->xbzrle_started = false;
+    qatomic_set(&XBZRLE.started, false);
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2669,7 +3266,7 @@ void ram_postcopy_send_discard_bitmap(MigrationState *ms)
     RCU_READ_LOCK_GUARD();
 
     /* This should be our last sync, the src is now paused */
-    migration_bitmap_sync(rs, false);
+    migration_bitmap_sync(rs, false, false);
 
     /* Easiest way to make sure we don't resume in the middle of a host-page */
     rs->pss[RAM_CHANNEL_PRECOPY].last_sent_block = NULL;
@@ -2774,6 +3371,8 @@ err_out:
 
 static int ram_state_init(RAMState **rsp)
 {
+    RAMBlock *block;
+
     *rsp = g_try_new0(RAMState, 1);
 
     if (!*rsp) {
@@ -2792,8 +3391,18 @@ static int ram_state_init(RAMState **rsp)
      * This must match with the initial values of dirty bitmap.
      */
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
+    (*rsp)->sync_pool = ram_sync_pool_new((*rsp)->ram_bytes_total);
     ram_state_reset(*rsp);
 
+    /* Do not predict from the dirty rates of a previous migration */
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            block->dirty_pages_period = 0;
+            block->dirty_rate = 0;
+            block->dirty_rate_dev = 0;
+        }
+    }
+
     return 0;
 }
 
@@ -2861,7 +3470,7 @@ static void ram_init_bitmaps(RAMState *rs)
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
-            migration_bitmap_sync_precopy(rs, false);
+            migration_bitmap_sync_precopy(rs, false, false);
         }
     }
     qemu_mutex_unlock_ramlist();
@@ -3275,6 +3884,7 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
                 }
                 i++;
             }
+            mapped_ram_flush_pages(&rs->pss[RAM_CHANNEL_PRECOPY]);
         }
     }
 
@@ -3329,7 +3939,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     WITH_RCU_READ_LOCK_GUARD() {
         if (!migration_in_postcopy()) {
-            migration_bitmap_sync_precopy(rs, true);
+            migration_bitmap_sync_precopy(rs, true, false);
         }
 
         ret = rdma_registration_start(f, RAM_CONTROL_FINISH);
@@ -3355,6 +3965,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
                 return pages;
             }
         }
+        mapped_ram_flush_pages(&rs->pss[RAM_CHANNEL_PRECOPY]);
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
         compress_flush_data();
@@ -3417,7 +4028,7 @@ static void ram_state_pending_exact(void *opaque, uint64_t *must_precopy,
     if (!migration_in_postcopy()) {
         bql_lock();
         WITH_RCU_READ_LOCK_GUARD() {
-            migration_bitmap_sync_precopy(rs, false);
+            migration_bitmap_sync_precopy(rs, false, true);
         }
         bql_unlock();
     }
@@ -3716,6 +4327,8 @@ static int ram_load_cleanup(void *opaque)
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
+        g_free(rb->file_bmap);
+        rb->file_bmap = NULL;
     }
 
     return 0;
@@ -4055,6 +4668,56 @@ err:
     return false;
 }
 
+/**
+ * ram_block_read_mapped_ram: read part of a RAMBlock from a mapped-ram file
+ *
+ * Returns 1 if @buf was filled, 0 if none of the pages are in the file and
+ * thus are zero, or -errno on error.  Pages that are not in the file are
+ * cleared in @buf, because the file can still hold stale data for them.
+ *
+ * Used by postcopy-from-file, after parse_ramblocks() has read the
+ * bitmap of pages present in the file.
+ *
+ * @ioc: channel of the migration file
+ * @block: RAMBlock to read from
+ * @offset: offset in @block, aligned to the target page size
+ * @len: number of bytes to read, aligned to the target page size
+ * @buf: buffer of @len bytes
+ */
+int ram_block_read_mapped_ram(QIOChannel *ioc, RAMBlock *block,
+                              ram_addr_t offset, size_t len, void *buf,
+                              Error **errp)
+{
+    unsigned long first = offset >> TARGET_PAGE_BITS;
+    unsigned long last = first + (len >> TARGET_PAGE_BITS);
+    unsigned long page;
+    ssize_t ret;
+
+    if (!block->file_bmap ||
+        find_next_bit(block->file_bmap, last, first) >= last) {
+        return 0;
+    }
+
+    ret = qio_channel_pread(ioc, buf, len, block->pages_offset + offset, errp);
+    if (ret != len) {
+        if (ret >= 0) {
+            error_setg(errp, "(%s) short read of " RAM_ADDR_FMT
+                       " from file offset %" PRIx64, block->idstr, offset,
+                       block->pages_offset + offset);
+        }
+        return -EIO;
+    }
+
+    for (page = find_next_zero_bit(block->file_bmap, last, first);
+         page < last;
+         page = find_next_zero_bit(block->file_bmap, last, page + 1)) {
+        memset(buf + ((page - first) << TARGET_PAGE_BITS), 0,
+               TARGET_PAGE_SIZE);
+    }
+
+    return 1;
+}
+
 static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                       ram_addr_t length, Error **errp)
 {
@@ -4092,7 +4755,11 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_postcopy_from_file()) {
+        /* The pages are loaded on demand once the device state is loaded */
+        g_free(block->file_bmap);
+        block->file_bmap = g_steal_pointer(&bitmap);
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -4314,6 +4981,9 @@ static int ram_load_precopy(QEMUFile *f)
             if (migrate_mapped_ram()) {
                 multifd_recv_sync_main();
             }
+            if (!ret && migrate_postcopy_from_file()) {
+                ret = postcopy_file_incoming_setup(mis, f);
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
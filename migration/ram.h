@@ -45,8 +45,14 @@ extern XBZRLECacheStats xbzrle_counters;
         if (!qemu_ram_is_migratable(block)) {} else
 
 int xbzrle_cache_resize(uint64_t new_size, Error **errp);
+int xbzrle_multifd_encode_page(RAMBlock *block, ram_addr_t offset,
+                               uint8_t *buf, uint8_t *dst,
+                               XBZRLECacheStats *stats);
+void xbzrle_multifd_zero_page(RAMBlock *block, ram_addr_t offset);
+void xbzrle_multifd_add_stats(const XBZRLECacheStats *stats);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_total(void);
+uint64_t ram_predict_dirty_bytes(uint64_t *rate);
 void mig_throttle_counter_reset(void);
 
 uint64_t ram_pagesize_summary(void);
@@ -75,6 +81,9 @@ bool ram_dirty_bitmap_reload(MigrationState *s, RAMBlock *rb, Error **errp);
 bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start);
 void postcopy_preempt_shutdown_file(MigrationState *s);
 void *postcopy_preempt_thread(void *opaque);
+int ram_block_read_mapped_ram(QIOChannel *ioc, RAMBlock *block,
+                              ram_addr_t offset, size_t len, void *buf,
+                              Error **errp);
 void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset,
                                    bool set);
 
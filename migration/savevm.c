@@ -43,6 +43,7 @@
 #include "postcopy-ram.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qmp/qerror.h"
@@ -69,6 +70,7 @@
 #include "yank_functions.h"
 #include "sysemu/qtest.h"
 #include "options.h"
+#include "device-state-compress.h"
 
 const unsigned int postcopy_ram_discard_version;
 
@@ -91,9 +93,16 @@ enum qemu_vm_cmd {
     MIG_CMD_ENABLE_COLO,       /* Enable COLO */
     MIG_CMD_POSTCOPY_RESUME,   /* resume postcopy on dest */
     MIG_CMD_RECV_BITMAP,       /* Request for recved bitmap on dst */
+    MIG_CMD_DEVICE_STATE,      /* Section to be loaded concurrently */
+    MIG_CMD_PACKAGED_COMPRESSED, /* Wrapped stream, encoded */
     MIG_CMD_MAX
 };
 
+/* Encodings of MIG_CMD_PACKAGED_COMPRESSED, applied in this order */
+#define MIG_PACKAGED_ZERO_RUN   0x01
+#define MIG_PACKAGED_ZLIB       0x02
+#define MIG_PACKAGED_ZSTD       0x04
+
 #define MAX_VM_CMD_PACKAGED_SIZE UINT32_MAX
 static struct mig_cmd_args {
     ssize_t     len; /* -1 = variable */
@@ -110,6 +119,9 @@ static struct mig_cmd_args {
     [MIG_CMD_POSTCOPY_RESUME]  = { .len =  0, .name = "POSTCOPY_RESUME" },
     [MIG_CMD_PACKAGED]         = { .len =  4, .name = "PACKAGED" },
     [MIG_CMD_RECV_BITMAP]      = { .len = -1, .name = "RECV_BITMAP" },
+    [MIG_CMD_DEVICE_STATE]     = { .len =  4, .name = "DEVICE_STATE" },
+    [MIG_CMD_PACKAGED_COMPRESSED] = {
+                                   .len = 13, .name = "PACKAGED_COMPRESSED" },
     [MIG_CMD_MAX]              = { .len = -1, .name = "MAX" },
 };
 
@@ -239,6 +251,47 @@ static SaveState savevm_state = {
 
 static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id);
 
+/* Maximum number of threads that save or load independent device state */
+#define DEVICE_STATE_MAX_THREADS 8
+
+/*
+ * The state of a device with an independent VMSD.  On the source, it is
+ * saved into @file by a worker thread and then sent in a
+ * MIG_CMD_DEVICE_STATE command.  On the destination, the commands are
+ * queued until the next section or command in the stream and then loaded
+ * from @file by worker threads.
+ */
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QEMUFile *file;
+    QIOChannelBuffer *bioc;
+    JSONWriter *vmdesc;
+    int ret;
+} DeviceStateJob;
+
+typedef struct DeviceStateBatch {
+    GPtrArray *jobs;
+    int (*fn)(DeviceStateJob *job);
+    /* Index of the next job to run, atomic */
+    int next;
+} DeviceStateBatch;
+
+/* Device state commands received but not loaded yet */
+static GPtrArray *device_state_load_jobs;
+
+/* Time spent on each device during the last save or load */
+static struct {
+    QemuMutex lock;
+    DeviceStateStatsList *list;
+    DeviceStateStatsList **tail;
+} device_state_stats;
+
+static void __attribute__((constructor)) device_state_stats_init(void)
+{
+    qemu_mutex_init(&device_state_stats.lock);
+    device_state_stats.tail = &device_state_stats.list;
+}
+
 static bool should_validate_capability(int capability)
 {
     assert(capability >= 0 && capability < MIGRATION_CAPABILITY__MAX);
@@ -948,6 +1001,99 @@ void vmstate_unregister(VMStateIf *obj, const VMStateDescription *vmsd,
     }
 }
 
+static void device_state_stats_reset(void)
+{
+    QEMU_LOCK_GUARD(&device_state_stats.lock);
+    qapi_free_DeviceStateStatsList(device_state_stats.list);
+    device_state_stats.list = NULL;
+    device_state_stats.tail = &device_state_stats.list;
+}
+
+static void device_state_stats_add(SaveStateEntry *se, int64_t time)
+{
+    DeviceStateStats *stats = g_new0(DeviceStateStats, 1);
+
+    stats->id = g_strdup(se->idstr);
+    stats->instance_id = se->instance_id;
+    stats->time = time;
+    /* Only the worker threads run without the BQL */
+    stats->concurrent = !bql_locked();
+
+    QEMU_LOCK_GUARD(&device_state_stats.lock);
+    QAPI_LIST_APPEND(device_state_stats.tail, stats);
+}
+
+DeviceStateStatsList *qemu_savevm_device_state_stats(void)
+{
+    QEMU_LOCK_GUARD(&device_state_stats.lock);
+    return QAPI_CLONE(DeviceStateStatsList, device_state_stats.list);
+}
+
+static void device_state_job_free(gpointer opaque)
+{
+    DeviceStateJob *job = opaque;
+
+    if (job->file) {
+        qemu_fclose(job->file);
+    }
+    if (job->vmdesc) {
+        json_writer_free(job->vmdesc);
+    }
+    g_free(job);
+}
+
+static void device_state_batch_run(DeviceStateBatch *batch)
+{
+    int i;
+
+    while ((i = qatomic_fetch_inc(&batch->next)) < batch->jobs->len) {
+        DeviceStateJob *job = g_ptr_array_index(batch->jobs, i);
+
+        job->ret = batch->fn(job);
+    }
+}
+
+static void *device_state_thread(void *opaque)
+{
+    rcu_register_thread();
+    device_state_batch_run(opaque);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Run @fn on all @jobs, in the calling thread and up to
+ * DEVICE_STATE_MAX_THREADS - 1 worker threads.  Returns the first error.
+ */
+static int device_state_run_jobs(GPtrArray *jobs,
+                                 int (*fn)(DeviceStateJob *job))
+{
+    DeviceStateBatch batch = { .jobs = jobs, .fn = fn };
+    g_autofree QemuThread *threads = NULL;
+    int nr_threads, i;
+
+    nr_threads = MIN(jobs->len, MIN(DEVICE_STATE_MAX_THREADS,
+                                    g_get_num_processors()));
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "mig/devstate", device_state_thread,
+                           &batch, QEMU_THREAD_JOINABLE);
+    }
+    device_state_batch_run(&batch);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < jobs->len; i++) {
+        DeviceStateJob *job = g_ptr_array_index(jobs, i);
+
+        if (job->ret < 0) {
+            return job->ret;
+        }
+    }
+    return 0;
+}
+
 static int vmstate_load(QEMUFile *f, SaveStateEntry *se)
 {
     trace_vmstate_load(se->idstr, se->vmsd ? se->vmsd->name : "(old)");
@@ -1014,6 +1160,7 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     int ret;
     Error *local_err = NULL;
     MigrationState *s = migrate_get_current();
+    int64_t start_ts;
 
     if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
         return 0;
@@ -1023,6 +1170,7 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
         return 0;
     }
 
+    start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     trace_savevm_section_start(se->idstr, se->section_id);
     save_section_header(f, se, QEMU_VM_SECTION_FULL);
     if (vmdesc) {
@@ -1048,6 +1196,8 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     if (vmdesc) {
         json_writer_end_object(vmdesc);
     }
+    device_state_stats_add(se, qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                               start_ts);
     return 0;
 }
 /**
@@ -1126,6 +1276,107 @@ int qemu_savevm_send_packaged(QEMUFile *f, const uint8_t *buf, size_t len)
     return 0;
 }
 
+/*
+ * Send the state of a device that was saved separately; it is loaded
+ * concurrently with the following MIG_CMD_DEVICE_STATE commands.
+ */
+static int qemu_savevm_send_device_state(QEMUFile *f, const uint8_t *buf,
+                                         size_t len)
+{
+    uint32_t tmp;
+
+    if (len > MAX_VM_CMD_PACKAGED_SIZE) {
+        error_report("%s: Unreasonably large device state: %zu",
+                     __func__, len);
+        return -EINVAL;
+    }
+
+    tmp = cpu_to_be32(len);
+
+    trace_qemu_savevm_send_device_state(len);
+    qemu_savevm_command_send(f, MIG_CMD_DEVICE_STATE, 4, (uint8_t *)&tmp);
+
+    qemu_put_buffer(f, buf, len);
+
+    return 0;
+}
+
+/*
+ * Send a wrapped stream like qemu_savevm_send_packaged(), encoded as
+ * requested by the device-state-zero-run capability and the
+ * device-state-compression parameter.  The arguments of the command are
+ * the encodings, then the length of the stream before any encoding, after
+ * the zero-run encoding, and as sent.
+ */
+static int qemu_savevm_send_packaged_compressed(QEMUFile *f,
+                                                const uint8_t *buf,
+                                                size_t len)
+{
+    MultiFDCompression compression = migrate_device_state_compression();
+    g_autofree uint8_t *zero_run_buf = NULL;
+    g_autofree uint8_t *compressed_buf = NULL;
+    const uint8_t *data = buf;
+    size_t zero_run_len = len;
+    size_t data_len = len;
+    uint8_t args[13];
+    uint8_t flags = 0;
+
+    if (migrate_device_state_zero_run()) {
+        zero_run_buf = g_malloc(zero_run_encode_bound(len));
+        zero_run_len = zero_run_encode(buf, len, zero_run_buf);
+        data = zero_run_buf;
+        data_len = zero_run_len;
+        flags |= MIG_PACKAGED_ZERO_RUN;
+    }
+
+    if (compression != MULTIFD_COMPRESSION_NONE) {
+        size_t bound = device_state_compress_bound(compression, data_len);
+        /* The compression level is the one set for multifd */
+        int level = compression == MULTIFD_COMPRESSION_ZLIB ?
+                    migrate_multifd_zlib_level() :
+                    migrate_multifd_zstd_level();
+        Error *local_err = NULL;
+        ssize_t ret;
+
+        compressed_buf = g_malloc(bound);
+        ret = device_state_compress(compression, level, data, data_len,
+                                    compressed_buf, bound, &local_err);
+        if (ret < 0) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+        data = compressed_buf;
+        data_len = ret;
+        flags |= compression == MULTIFD_COMPRESSION_ZLIB ?
+                 MIG_PACKAGED_ZLIB : MIG_PACKAGED_ZSTD;
+    }
+
+    if (len > MAX_VM_CMD_PACKAGED_SIZE ||
+        zero_run_len > MAX_VM_CMD_PACKAGED_SIZE ||
+        data_len > MAX_VM_CMD_PACKAGED_SIZE) {
+        error_report("%s: Unreasonably large packaged state: %zu",
+                     __func__, len);
+        return -EINVAL;
+    }
+
+    stat64_add(&mig_stats.device_state_raw_bytes, len);
+    stat64_add(&mig_stats.device_state_zero_run_bytes, zero_run_len);
+    stat64_add(&mig_stats.device_state_compressed_bytes, data_len);
+
+    args[0] = flags;
+    stl_be_p(args + 1, len);
+    stl_be_p(args + 5, zero_run_len);
+    stl_be_p(args + 9, data_len);
+
+    trace_qemu_savevm_send_packaged_compressed(flags, len, data_len);
+    qemu_savevm_command_send(f, MIG_CMD_PACKAGED_COMPRESSED, sizeof(args),
+                             args);
+
+    qemu_put_buffer(f, data, data_len);
+
+    return 0;
+}
+
 /* Send prior to any postcopy transfer */
 void qemu_savevm_send_postcopy_advise(QEMUFile *f)
 {
@@ -1533,18 +1784,84 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
-                                                    bool in_postcopy,
-                                                    bool inactivate_disks)
+static int device_state_save_job(DeviceStateJob *job)
+{
+    int ret = vmstate_save(job->file, job->se, job->vmdesc);
+
+    return ret ?: qemu_fflush(job->file);
+}
+
+/*
+ * Save the state of all devices with an independent VMSD concurrently.
+ * Returns the jobs in the order of savevm_state.handlers.
+ */
+static GPtrArray *device_state_save_concurrent(void)
+{
+    GPtrArray *jobs = g_ptr_array_new_with_free_func(device_state_job_free);
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        DeviceStateJob *job;
+
+        if (!se->vmsd || !se->vmsd->independent || se->vmsd->early_setup) {
+            continue;
+        }
+
+        job = g_new0(DeviceStateJob, 1);
+        job->se = se;
+        job->bioc = qio_channel_buffer_new(4096);
+        qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                             "migration-device-state-buffer");
+        job->file = qemu_file_new_output(QIO_CHANNEL(job->bioc));
+        object_unref(OBJECT(job->bioc));
+        job->vmdesc = json_writer_new(false);
+        g_ptr_array_add(jobs, job);
+    }
+
+    if (jobs->len) {
+        device_state_run_jobs(jobs, device_state_save_job);
+    }
+    return jobs;
+}
+
+static int device_state_job_send(QEMUFile *f, DeviceStateJob *job,
+                                 JSONWriter *vmdesc)
+{
+    int ret;
+
+    if (job->ret < 0) {
+        return job->ret;
+    }
+    if (!job->bioc->usage) {
+        /* Section not needed */
+        return 0;
+    }
+
+    ret = qemu_savevm_send_device_state(f, job->bioc->data,
+                                        job->bioc->usage);
+    if (ret) {
+        return ret;
+    }
+    json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+    return 0;
+}
+
+static int qemu_savevm_save_non_iterable(QEMUFile *f, JSONWriter *vmdesc)
 {
-    MigrationState *ms = migrate_get_current();
     int64_t start_ts_each, end_ts_each;
-    JSONWriter *vmdesc = ms->vmdesc;
-    int vmdesc_len;
+    g_autoptr(GPtrArray) jobs = NULL;
+    guint next_job = 0;
     SaveStateEntry *se;
     int ret;
 
+    device_state_stats_reset();
+    if (migrate_concurrent_device_state()) {
+        jobs = device_state_save_concurrent();
+    }
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        DeviceStateJob *job = NULL;
+
         if (se->vmsd && se->vmsd->early_setup) {
             /* Already saved during qemu_savevm_state_setup(). */
             continue;
@@ -1552,9 +1869,16 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 
         start_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
-        ret = vmstate_save(f, se, vmdesc);
+        if (jobs && next_job < jobs->len) {
+            job = g_ptr_array_index(jobs, next_job);
+        }
+        if (job && job->se == se) {
+            next_job++;
+            ret = device_state_job_send(f, job, vmdesc);
+        } else {
+            ret = vmstate_save(f, se, vmdesc);
+        }
         if (ret) {
-            qemu_file_set_error(f, ret);
             return ret;
         }
 
@@ -1563,6 +1887,64 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                     end_ts_each - start_ts_each);
     }
 
+    return 0;
+}
+
+/*
+ * Save the non-iterable device state into a buffer, and send it to @f
+ * encoded in a MIG_CMD_PACKAGED_COMPRESSED.  @packed_bytes is set to the
+ * size of the buffer.
+ */
+static int qemu_savevm_save_non_iterable_packed(QEMUFile *f,
+                                                JSONWriter *vmdesc,
+                                                uint64_t *packed_bytes)
+{
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    int ret;
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-devstate-buffer");
+    fb = qemu_file_new_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    ret = qemu_savevm_save_non_iterable(fb, vmdesc);
+    if (!ret) {
+        qemu_put_byte(fb, QEMU_VM_EOF);
+        ret = qemu_fflush(fb);
+    }
+    if (!ret) {
+        *packed_bytes = bioc->usage;
+        ret = qemu_savevm_send_packaged_compressed(f, bioc->data,
+                                                   bioc->usage);
+    }
+
+    qemu_fclose(fb);
+    return ret;
+}
+
+int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
+                                                    bool in_postcopy,
+                                                    bool inactivate_disks)
+{
+    MigrationState *ms = migrate_get_current();
+    JSONWriter *vmdesc = ms->vmdesc;
+    uint64_t start_bytes = qemu_file_transferred(f);
+    uint64_t packed_bytes = 0;
+    int vmdesc_len;
+    int ret;
+
+    if (migrate_device_state_zero_run() ||
+        migrate_device_state_compression() != MULTIFD_COMPRESSION_NONE) {
+        ret = qemu_savevm_save_non_iterable_packed(f, vmdesc, &packed_bytes);
+    } else {
+        ret = qemu_savevm_save_non_iterable(f, vmdesc);
+    }
+    if (ret) {
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
          * bdrv_activate_all() on the other end won't fail. */
@@ -1591,6 +1973,9 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         qemu_put_be32(f, vmdesc_len);
         qemu_put_buffer(f, (uint8_t *)json_writer_get(vmdesc), vmdesc_len);
     }
+    /* The packed buffer was accounted as transferred when it was flushed */
+    ms->device_state_bytes = qemu_file_transferred(f) - start_bytes -
+                             packed_bytes;
 
     /* Free it now to detect any inconsistencies. */
     json_writer_free(vmdesc);
@@ -1716,6 +2101,11 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    if (migrate_mapped_ram() && migrate_multifd()) {
+        error_setg(errp, "Multifd and snapshots are incompatible");
+        return -EINVAL;
+    }
+
     ret = migrate_init(ms, errp);
     if (ret) {
         return ret;
@@ -1771,6 +2161,7 @@ int qemu_save_device_state(QEMUFile *f)
         qemu_put_be32(f, QEMU_VM_FILE_VERSION);
     }
     cpu_synchronize_all_states();
+    device_state_stats_reset();
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         int ret;
@@ -2371,6 +2762,122 @@ static int loadvm_handle_cmd_packaged(MigrationIncomingState *mis)
     return ret;
 }
 
+/*
+ * Decode the wrapped stream sent by qemu_savevm_send_packaged_compressed()
+ * into @out, of @raw_len bytes.
+ */
+static int loadvm_decode_packaged(uint8_t flags, const uint8_t *data,
+                                  size_t len, size_t zero_run_len,
+                                  uint8_t *out, size_t raw_len)
+{
+    g_autofree uint8_t *zero_run_buf = NULL;
+    Error *local_err = NULL;
+
+    if (flags & (MIG_PACKAGED_ZLIB | MIG_PACKAGED_ZSTD)) {
+        MultiFDCompression method = MULTIFD_COMPRESSION_ZLIB;
+
+#ifdef CONFIG_ZSTD
+        if (flags & MIG_PACKAGED_ZSTD) {
+            method = MULTIFD_COMPRESSION_ZSTD;
+        }
+#endif
+        if (flags & MIG_PACKAGED_ZERO_RUN) {
+            zero_run_buf = g_malloc(zero_run_len);
+        } else if (zero_run_len != raw_len) {
+            error_report("CMD_PACKAGED_COMPRESSED: inconsistent lengths");
+            return -EINVAL;
+        }
+        if (device_state_decompress(method, data, len,
+                                    zero_run_buf ?: out, zero_run_len,
+                                    &local_err)) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+        if (!zero_run_buf) {
+            return 0;
+        }
+        data = zero_run_buf;
+        len = zero_run_len;
+    }
+
+    if (flags & MIG_PACKAGED_ZERO_RUN) {
+        if (zero_run_decode(data, len, out, raw_len)) {
+            error_report("CMD_PACKAGED_COMPRESSED: invalid zero-run data");
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    if (len != raw_len) {
+        error_report("CMD_PACKAGED_COMPRESSED: inconsistent lengths");
+        return -EINVAL;
+    }
+    memcpy(out, data, len);
+    return 0;
+}
+
+/*
+ * Like loadvm_handle_cmd_packaged(), for a wrapped stream that is zero-run
+ * encoded and/or compressed.  It can come from a package itself, so it is
+ * read from @f.
+ */
+static int loadvm_handle_cmd_packaged_compressed(QEMUFile *f,
+                                                 MigrationIncomingState *mis)
+{
+    g_autofree uint8_t *data = NULL;
+    QIOChannelBuffer *bioc;
+    size_t raw_len, zero_run_len, len;
+    QEMUFile *packf;
+    uint8_t flags;
+    int ret;
+
+    flags = qemu_get_byte(f);
+    raw_len = qemu_get_be32(f);
+    zero_run_len = qemu_get_be32(f);
+    len = qemu_get_be32(f);
+    trace_loadvm_handle_cmd_packaged_compressed(flags, raw_len, len);
+
+    if (flags & ~(MIG_PACKAGED_ZERO_RUN | MIG_PACKAGED_ZLIB |
+                  MIG_PACKAGED_ZSTD) ||
+        (flags & MIG_PACKAGED_ZLIB && flags & MIG_PACKAGED_ZSTD)) {
+        error_report("CMD_PACKAGED_COMPRESSED: unknown encoding 0x%x", flags);
+        return -EINVAL;
+    }
+#ifndef CONFIG_ZSTD
+    if (flags & MIG_PACKAGED_ZSTD) {
+        error_report("CMD_PACKAGED_COMPRESSED: zstd is not supported");
+        return -EINVAL;
+    }
+#endif
+
+    data = g_malloc(len);
+    ret = qemu_get_buffer(f, data, len);
+    if (ret != len) {
+        error_report("CMD_PACKAGED_COMPRESSED: Buffer receive fail ret=%d "
+                     "length=%zu", ret, len);
+        return (ret < 0) ? ret : -EAGAIN;
+    }
+
+    bioc = qio_channel_buffer_new(raw_len);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-loadvm-buffer");
+    ret = loadvm_decode_packaged(flags, data, len, zero_run_len,
+                                 bioc->data, raw_len);
+    if (ret) {
+        object_unref(OBJECT(bioc));
+        return ret;
+    }
+    bioc->usage += raw_len;
+    g_clear_pointer(&data, g_free);
+
+    packf = qemu_file_new_input(QIO_CHANNEL(bioc));
+    ret = qemu_loadvm_state_main(packf, mis);
+    trace_loadvm_handle_cmd_packaged_main(ret);
+    qemu_fclose(packf);
+    object_unref(OBJECT(bioc));
+
+    return ret;
+}
+
 /*
  * Handle request that source requests for recved_bitmap on
  * destination. Payload format:
@@ -2433,6 +2940,72 @@ static int loadvm_process_enable_colo(MigrationIncomingState *mis)
  * LOADVM_QUIT All good, but exit the loop
  * <0          Error
  */
+static int loadvm_handle_device_state(QEMUFile *f)
+{
+    QIOChannelBuffer *bioc;
+    DeviceStateJob *job;
+    size_t length;
+    int ret;
+
+    length = qemu_get_be32(f);
+    trace_loadvm_handle_device_state(length);
+
+    if (length > MAX_VM_CMD_PACKAGED_SIZE) {
+        error_report("Unreasonably large device state: %zu", length);
+        return -1;
+    }
+
+    bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-device-state-buffer");
+    ret = qemu_get_buffer(f, bioc->data, length);
+    if (ret != length) {
+        object_unref(OBJECT(bioc));
+        error_report("CMD_DEVICE_STATE: Buffer receive fail ret=%d "
+                     "length=%zu", ret, length);
+        return (ret < 0) ? ret : -EAGAIN;
+    }
+    bioc->usage += length;
+
+    job = g_new0(DeviceStateJob, 1);
+    job->file = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    if (!device_state_load_jobs) {
+        device_state_load_jobs =
+            g_ptr_array_new_with_free_func(device_state_job_free);
+    }
+    g_ptr_array_add(device_state_load_jobs, job);
+    return 0;
+}
+
+static int device_state_load_job(DeviceStateJob *job)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    uint8_t section_type = qemu_get_byte(job->file);
+
+    if (section_type != QEMU_VM_SECTION_FULL) {
+        error_report("Unexpected section type %d in device state",
+                     section_type);
+        return -EINVAL;
+    }
+    return qemu_loadvm_section_start_full(job->file, mis, section_type);
+}
+
+/*
+ * Load the device state commands received so far.  Called before anything
+ * else in the stream is processed, so that devices which are not
+ * independent see the state of all devices that precede them.
+ */
+static int loadvm_device_state_wait(void)
+{
+    g_autoptr(GPtrArray) jobs = g_steal_pointer(&device_state_load_jobs);
+
+    if (!jobs) {
+        return 0;
+    }
+    return device_state_run_jobs(jobs, device_state_load_job);
+}
+
 static int loadvm_process_command(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
@@ -2462,6 +3035,14 @@ static int loadvm_process_command(QEMUFile *f)
         return -ERANGE;
     }
 
+    if (cmd != MIG_CMD_DEVICE_STATE) {
+        int ret = loadvm_device_state_wait();
+
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     switch (cmd) {
     case MIG_CMD_OPEN_RETURN_PATH:
         if (mis->to_src_file) {
@@ -2505,6 +3086,12 @@ static int loadvm_process_command(QEMUFile *f)
     case MIG_CMD_PACKAGED:
         return loadvm_handle_cmd_packaged(mis);
 
+    case MIG_CMD_DEVICE_STATE:
+        return loadvm_handle_device_state(f);
+
+    case MIG_CMD_PACKAGED_COMPRESSED:
+        return loadvm_handle_cmd_packaged_compressed(f, mis);
+
     case MIG_CMD_POSTCOPY_ADVISE:
         return loadvm_postcopy_handle_advise(mis, len);
 
@@ -2643,6 +3230,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
         end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_load("non-iterable", se->idstr,
                                     se->instance_id, end_ts - start_ts);
+        device_state_stats_add(se, end_ts - start_ts);
     }
 
     if (!check_section_footer(f, se)) {
@@ -2884,6 +3472,13 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        if (section_type != QEMU_VM_COMMAND) {
+            ret = loadvm_device_state_wait();
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
@@ -2917,6 +3512,12 @@ retry:
     }
 
 out:
+    if (ret < 0) {
+        /* Drop the device state that was queued but not loaded */
+        g_clear_pointer(&device_state_load_jobs, g_ptr_array_unref);
+    } else {
+        ret = loadvm_device_state_wait();
+    }
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -2960,6 +3561,7 @@ int qemu_loadvm_state(QEMUFile *f)
         return ret;
     }
 
+    device_state_stats_reset();
     if (qemu_loadvm_state_setup(f) != 0) {
         return -EINVAL;
     }
@@ -3030,6 +3632,7 @@ int qemu_load_device_state(QEMUFile *f)
     MigrationIncomingState *mis = migration_incoming_get_current();
     int ret;
 
+    device_state_stats_reset();
     /* Load QEMU_VM_SECTION_FULL section */
     ret = qemu_loadvm_state_main(f, mis);
     if (ret < 0) {
@@ -3143,7 +3746,12 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         goto the_end;
     }
     ret = qemu_savevm_state(f, errp);
-    vm_state_size = qemu_file_transferred(f);
+    /*
+     * With mapped-ram, the RAM pages are written at fixed offsets and the
+     * stream continues past them, so the size is the final position.
+     */
+    vm_state_size = migrate_mapped_ram() ? qemu_get_offset(f) :
+                                           qemu_file_transferred(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
         goto the_end;
@@ -42,6 +42,13 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * NBD_SENDFILE_MIN_SIZE: Reads at least this large are sent straight from
+ * the image file to the socket if possible.  For smaller reads, copying
+ * the data is cheaper than the extra system calls.
+ */
+#define NBD_SENDFILE_MIN_SIZE (64 * KiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -2145,6 +2152,79 @@ static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
     return nbd_co_send_iov(client, iov, 3, errp);
 }
 
+/*
+ * Send the reply to a read of @size bytes at @offset without copying the
+ * data through a buffer: the reply header is written to the socket, and
+ * then the data is sent directly from the image with bdrv_co_sendfile().
+ *
+ * This is only possible for plain (non-TLS) sockets and if the block layer
+ * supports it for the request; otherwise, nothing is sent and -ENOTSUP is
+ * returned so that the caller can fall back to reading into a buffer.
+ * Since the reply header is already sent when reading the data, read errors
+ * cannot be reported to the client, and the connection is closed instead.
+ */
+static int coroutine_fn nbd_co_send_read_sendfile(NBDClient *client,
+                                                  NBDRequest *request,
+                                                  uint64_t offset,
+                                                  uint64_t size,
+                                                  bool final,
+                                                  Error **errp)
+{
+    BlockBackend *blk = client->exp->common.blk;
+    NBDSimpleReply reply;
+    NBDReply hdr;
+    NBDStructuredReadData chunk;
+    struct iovec iov[3];
+    unsigned niov;
+    uint64_t progress = 0;
+    int64_t ret;
+
+    if (size < NBD_SENDFILE_MIN_SIZE ||
+        client->ioc != QIO_CHANNEL(client->sioc) ||
+        blk_co_sendfile(blk, offset, size, -1) < 0) {
+        return -ENOTSUP;
+    }
+
+    trace_nbd_co_send_read_sendfile(request->cookie, offset, size);
+    if (client->mode >= NBD_MODE_STRUCTURED) {
+        iov[0].iov_base = &hdr;
+        iov[1] = (struct iovec) {.iov_base = &chunk, .iov_len = sizeof(chunk)};
+        /* Only used to compute the chunk length, the data is not in memory */
+        iov[2] = (struct iovec) {.iov_base = NULL, .iov_len = size};
+        set_be_chunk(client, iov, 3, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, request);
+        stq_be_p(&chunk.offset, offset);
+        niov = 2;
+    } else {
+        set_be_simple_reply(&reply, 0, request->cookie);
+        iov[0] = (struct iovec) {.iov_base = &reply, .iov_len = sizeof(reply)};
+        niov = 1;
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov, errp);
+    while (ret == 0 && progress < size) {
+        ret = blk_co_sendfile(blk, offset + progress, size - progress,
+                              client->sioc->fd);
+        if (ret == -EAGAIN) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            ret = 0;
+        } else if (ret < 0) {
+            error_setg_errno(errp, -ret, "sending data from file failed");
+        } else {
+            progress += ret;
+            ret = 0;
+        }
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 /* Do a sparse read and send the structured reply to the client.
  * Returns -errno if sending fails. blk_co_block_status_above() failure is
  * reported to the client, at which point this function succeeds.
@@ -2196,14 +2276,20 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 2, errp);
         } else {
-            ret = blk_co_pread(exp->common.blk, offset + progress, pnum,
-                               data + progress, 0);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = nbd_co_send_read_sendfile(client, request, offset + progress,
+                                            pnum, final, errp);
+            if (ret == -ENOTSUP) {
+                ret = blk_co_pread(exp->common.blk, offset + progress, pnum,
+                                   data + progress, 0);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_chunk_read(client, request,
+                                             offset + progress,
+                                             data + progress, pnum, final,
+                                             errp);
             }
-            ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
         }
 
         if (ret < 0) {
@@ -2822,6 +2908,12 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    ret = nbd_co_send_read_sendfile(client, request, request->from,
+                                    request->len, true, errp);
+    if (ret != -ENOTSUP) {
+        return ret;
+    }
+
     ret = blk_co_pread(exp->common.blk, request->from, request->len, data, 0);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request, ret,
@@ -86,6 +86,7 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_BUFFER_SIZE = 278,
 };
 
 typedef enum OutputFormat {
@@ -219,6 +220,16 @@ void help(void)
            "  '-f' first image format\n"
            "  '-F' second image format\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
+           "  '-m' specifies how many coroutines compare the images in parallel\n"
+           "       (defaults to 8)\n"
+           "  '--buffer-size' sets the read buffer size of each coroutine\n"
+           "       (defaults to 2M)\n"
+           "\n"
+           "Parameters to rebase subcommand:\n"
+           "  '-m' specifies how many coroutines compare and merge clusters in\n"
+           "       parallel in safe mode (defaults to 8)\n"
+           "  '--buffer-size' sets the buffer size of each coroutine\n"
+           "       (defaults to 2M)\n"
            "\n"
            "Parameters to dd subcommand:\n"
            "  'bs=BYTES' read and write up to BYTES bytes at a time "
@@ -1309,6 +1320,36 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 }
 
 #define IO_BUF_SIZE (2 * MiB)
+#define MAX_IO_BUF_SIZE (1 * GiB)
+#define MAX_COROUTINES 1024
+/* Memory that the buffers of all coroutines may use together */
+#define MAX_IO_BUF_TOTAL (2 * GiB)
+
+/*
+ * Parse the argument of '-m', the number of coroutines working in parallel.
+ * Returns false after emitting an error message if it is invalid.
+ */
+static bool parse_num_coroutines(const char *arg, long *num_coroutines)
+{
+    if (qemu_strtol(arg, NULL, 0, num_coroutines) ||
+        *num_coroutines < 1 || *num_coroutines > MAX_COROUTINES) {
+        error_report("Invalid number of coroutines. Allowed number of"
+                     " coroutines is between 1 and %d", MAX_COROUTINES);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Limit @num_coroutines so that their buffers, @bufs_per_co of @buf_size
+ * bytes each, fit into MAX_IO_BUF_TOTAL.  At least one coroutine is left.
+ */
+static long limit_num_coroutines(long num_coroutines, int64_t buf_size,
+                                 int bufs_per_co)
+{
+    return MAX(1, MIN(num_coroutines,
+                      MAX_IO_BUF_TOTAL / (buf_size * bufs_per_co)));
+}
 
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
@@ -1348,6 +1389,196 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     return 0;
 }
 
+/*
+ * State of a 'qemu-img compare' run.
+ *
+ * Chunks are handed out to the coroutines in increasing offset order under
+ * @lock.  A mismatch or an error only stops the dispatching of chunks after
+ * it; chunks before it still complete, so that the result reported is the
+ * one at the lowest offset, exactly as with a serial walk of the images.
+ */
+typedef struct ImgCompareState {
+    BlockBackend *blk1;
+    BlockBackend *blk2;
+    const char *filename1;
+    const char *filename2;
+    int64_t total_size1;
+    int64_t total_size2;
+    int64_t total_size;
+    int64_t progress_base;
+    bool strict;
+    bool quiet;
+    int64_t buf_size;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    int64_t offset;         /* next offset to dispatch */
+    int64_t fail_offset;    /* lowest offset of a mismatch or error */
+    int ret;                /* exit code for fail_offset */
+    char *msg;              /* message for fail_offset, printed at the end */
+} ImgCompareState;
+
+/* Record a result at @offset unless one was found at a lower offset. */
+static void compare_set_result(ImgCompareState *s, int64_t offset, int ret,
+                               char *msg)
+{
+    if (offset < s->fail_offset) {
+        s->fail_offset = offset;
+        s->ret = ret;
+        g_free(s->msg);
+        s->msg = msg;
+    } else {
+        g_free(msg);
+    }
+}
+
+static bool coroutine_fn compare_co_read(ImgCompareState *s, BlockBackend *blk,
+                                         const char *filename, int64_t offset,
+                                         int64_t bytes, uint8_t *buf)
+{
+    int ret = blk_co_pread(blk, offset, bytes, buf, 0);
+
+    if (ret < 0) {
+        compare_set_result(s, offset, 4,
+                           g_strdup_printf("Error while reading offset %"
+                                           PRId64 " of %s: %s", offset,
+                                           filename, strerror(-ret)));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Claim the next chunk and return its offset and size, or return false if
+ * there is nothing left to do.  Must be called with @s->lock held.
+ */
+static bool coroutine_fn GRAPH_RDLOCK
+compare_co_next_chunk(ImgCompareState *s, int64_t *poffset, int64_t *pchunk,
+                      int *pstatus1, int *pstatus2)
+{
+    int64_t offset = s->offset;
+    int64_t pnum1, pnum2, chunk;
+    int status1, status2;
+
+    if (offset >= s->total_size || offset >= s->fail_offset) {
+        return false;
+    }
+
+    status1 = bdrv_co_block_status_above(blk_bs(s->blk1), NULL, offset,
+                                         s->total_size1 - offset, &pnum1,
+                                         NULL, NULL);
+    if (status1 < 0) {
+        compare_set_result(s, offset, 3,
+                           g_strdup_printf("Sector allocation test failed "
+                                           "for %s", s->filename1));
+        return false;
+    }
+    status2 = bdrv_co_block_status_above(blk_bs(s->blk2), NULL, offset,
+                                         s->total_size2 - offset, &pnum2,
+                                         NULL, NULL);
+    if (status2 < 0) {
+        compare_set_result(s, offset, 3,
+                           g_strdup_printf("Sector allocation test failed "
+                                           "for %s", s->filename2));
+        return false;
+    }
+
+    assert(pnum1 && pnum2);
+    chunk = MIN(pnum1, pnum2);
+
+    if (s->strict && status1 != status2) {
+        compare_set_result(s, offset, 1,
+                           g_strdup_printf("Strict mode: Offset %" PRId64
+                                           " block status mismatch!", offset));
+        return false;
+    }
+    if (!((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) &&
+        ((status1 | status2) & BDRV_BLOCK_ALLOCATED)) {
+        /* Data has to be read, so stay within the buffer */
+        chunk = MIN(chunk, s->buf_size);
+    }
+
+    s->offset += chunk;
+    *poffset = offset;
+    *pchunk = chunk;
+    *pstatus1 = status1;
+    *pstatus2 = status2;
+    return true;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1, *buf2;
+
+    s->running_coroutines++;
+    buf1 = blk_blockalign(s->blk1, s->buf_size);
+    buf2 = blk_blockalign(s->blk2, s->buf_size);
+
+    while (1) {
+        int64_t offset, chunk, pnum;
+        int status1, status2;
+        bool allocated1, allocated2;
+        bool found;
+
+        qemu_co_mutex_lock(&s->lock);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            found = compare_co_next_chunk(s, &offset, &chunk,
+                                          &status1, &status2);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (!found) {
+            break;
+        }
+
+        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
+        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
+
+        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+            /* nothing to do */
+        } else if (allocated1 && allocated2) {
+            int res;
+
+            if (!compare_co_read(s, s->blk1, s->filename1, offset, chunk,
+                                 buf1) ||
+                !compare_co_read(s, s->blk2, s->filename2, offset, chunk,
+                                 buf2)) {
+                break;
+            }
+            res = compare_buffers(buf1, buf2, chunk, 0, &pnum);
+            if (res || pnum != chunk) {
+                offset += res ? 0 : pnum;
+                compare_set_result(s, offset, 1,
+                                   g_strdup_printf("Content mismatch at "
+                                                   "offset %" PRId64 "!",
+                                                   offset));
+                break;
+            }
+        } else if (allocated1 != allocated2) {
+            BlockBackend *blk = allocated1 ? s->blk1 : s->blk2;
+            const char *filename = allocated1 ? s->filename1 : s->filename2;
+            int64_t idx;
+
+            if (!compare_co_read(s, blk, filename, offset, chunk, buf1)) {
+                break;
+            }
+            idx = find_nonzero(buf1, chunk);
+            if (idx >= 0) {
+                compare_set_result(s, offset + idx, 1,
+                                   g_strdup_printf("Content mismatch at "
+                                                   "offset %" PRId64 "!",
+                                                   offset + idx));
+                break;
+            }
+        }
+        qemu_progress_print(((float) chunk / s->progress_base) * 100, 100);
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1359,11 +1590,8 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
+    uint8_t *buf1 = NULL;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
@@ -1371,10 +1599,13 @@ static int img_compare(int argc, char **argv)
     int64_t total_size;
     int64_t offset = 0;
     int64_t chunk;
-    int c;
+    int c, i;
     uint64_t progress_base;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    int64_t buf_size = IO_BUF_SIZE;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1383,9 +1614,10 @@ static int img_compare(int argc, char **argv)
             {"object", required_argument, 0, OPTION_OBJECT},
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"force-share", no_argument, 0, 'U'},
+            {"buffer-size", required_argument, 0, OPTION_BUFFER_SIZE},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:pqsUm:",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1421,6 +1653,18 @@ static int img_compare(int argc, char **argv)
         case 'U':
             force_share = true;
             break;
+        case 'm':
+            if (!parse_num_coroutines(optarg, &num_coroutines)) {
+                exit(2);
+            }
+            break;
+        case OPTION_BUFFER_SIZE:
+            buf_size = cvtnum_full("buffer size", optarg, BDRV_SECTOR_SIZE,
+                                   MAX_IO_BUF_SIZE);
+            if (buf_size < 0) {
+                exit(2);
+            }
+            break;
         case OPTION_OBJECT:
             {
                 Error *local_err = NULL;
@@ -1478,11 +1722,8 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
+    buf1 = blk_blockalign(blk1, buf_size);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1508,87 +1749,42 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    s = (ImgCompareState) {
+        .blk1 = blk1,
+        .blk2 = blk2,
+        .filename1 = filename1,
+        .filename2 = filename2,
+        .total_size1 = total_size1,
+        .total_size2 = total_size2,
+        .total_size = total_size,
+        .progress_base = progress_base,
+        .strict = strict,
+        .quiet = quiet,
+        .buf_size = buf_size,
+        /* Each coroutine has a buffer for either image */
+        .num_coroutines = limit_num_coroutines(num_coroutines, buf_size, 2),
+        .fail_offset = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
+    for (i = 0; i < s.num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(compare_co_do_compare, &s);
+        qemu_coroutine_enter(co);
+    }
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, chunk, buf1, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, chunk, buf2, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
+    if (s.ret) {
+        if (s.ret == 1) {
+            qprintf(quiet, "%s\n", s.msg);
         } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
+            error_report("%s", s.msg);
         }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+        g_free(s.msg);
+        ret = s.ret;
+        goto out;
     }
+    offset = total_size;
 
     if (total_size1 != total_size2) {
         BlockBackend *blk_over;
@@ -1615,7 +1811,7 @@ static int img_compare(int argc, char **argv)
 
             }
             if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
+                chunk = MIN(chunk, buf_size);
                 ret = check_empty_sectors(blk_over, offset, chunk,
                                           filename_over, buf1, quiet);
                 if (ret) {
@@ -1632,7 +1828,6 @@ static int img_compare(int argc, char **argv)
 
 out:
     qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1664,7 +1859,6 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -1686,6 +1880,7 @@ typedef struct ImgConvertState {
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
     bool wr_in_order;
+    bool wr_pipelined;
     bool copy_range;
     bool salvage;
     bool quiet;
@@ -1695,8 +1890,8 @@ typedef struct ImgConvertState {
     size_t buf_sectors;
     long num_coroutines;
     int running_coroutines;
-    Coroutine *co[MAX_COROUTINES];
-    int64_t wait_sector_num[MAX_COROUTINES];
+    Coroutine **co;
+    int64_t *wait_sector_num;
     CoMutex lock;
     int ret;
 } ImgConvertState;
@@ -2044,6 +2239,22 @@ retry:
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+
+            if (s->wr_pipelined && !copy_range) {
+                /*
+                 * The target lays out compressed clusters in submission
+                 * order, so the next write can be issued as soon as this
+                 * one has been submitted.  aio_co_wake() only runs the
+                 * next coroutine once this one yields inside the write.
+                 */
+                s->wr_offs = sector_num + n;
+                for (i = 0; i < s->num_coroutines; i++) {
+                    if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
+                        aio_co_wake(s->co[i]);
+                        break;
+                    }
+                }
+            }
         }
 
         if (s->ret == -EINPROGRESS) {
@@ -2065,7 +2276,7 @@ retry:
             }
         }
 
-        if (s->wr_in_order) {
+        if (s->wr_in_order && !(s->wr_pipelined && !copy_range)) {
             /* reenter the coroutine that might have waited
              * for this write to complete */
             s->wr_offs = sector_num + n;
@@ -2114,6 +2325,9 @@ static int convert_do_copy(ImgConvertState *s)
         }
         s->buf_sectors = s->cluster_sectors;
     }
+    s->num_coroutines = limit_num_coroutines(s->num_coroutines,
+                                             s->buf_sectors * BDRV_SECTOR_SIZE,
+                                             1);
 
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
@@ -2134,6 +2348,8 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    s->co = g_new0(Coroutine *, s->num_coroutines);
+    s->wait_sector_num = g_new(int64_t, s->num_coroutines);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -2143,6 +2359,8 @@ static int convert_do_copy(ImgConvertState *s)
     while (s->running_coroutines) {
         main_loop_wait(false);
     }
+    g_free(s->co);
+    g_free(s->wait_sector_num);
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2364,10 +2582,7 @@ static int img_convert(int argc, char **argv)
             skip_create = true;
             break;
         case 'm':
-            if (qemu_strtol(optarg, NULL, 0, &s.num_coroutines) ||
-                s.num_coroutines < 1 || s.num_coroutines > MAX_COROUTINES) {
-                error_report("Invalid number of coroutines. Allowed number of"
-                             " coroutines is between 1 and %d", MAX_COROUTINES);
+            if (!parse_num_coroutines(optarg, &s.num_coroutines)) {
                 goto fail_getopt;
             }
             break;
@@ -2674,6 +2889,12 @@ static int img_convert(int argc, char **argv)
                               out_filename, out_fmt);
             goto out;
         }
+
+        if (s.compressed && !strcmp(drv->format_name, "qcow2")) {
+            /* Let every coroutine compress on a CPU of its own */
+            qdict_put_int(open_opts, "compress-threads",
+                          MIN(s.num_coroutines, g_get_num_processors()));
+        }
     }
 
     s.target_is_new = !skip_create;
@@ -2777,6 +2998,7 @@ static int img_convert(int argc, char **argv)
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
+        s.wr_pipelined = s.compressed && bdi.compressed_writes_ordered;
     }
 
     if (rate_limit) {
@@ -3531,11 +3753,229 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+/*
+ * State of a safe 'qemu-img rebase' run.  Regions of the image are handed
+ * out to the coroutines in increasing offset order under @lock; they are
+ * disjoint and aligned to @write_align, so they can be merged into the
+ * image concurrently.
+ */
+typedef struct ImgRebaseState {
+    BlockBackend *blk;
+    BlockBackend *blk_old_backing;
+    BlockBackend *blk_new_backing;
+    BlockDriverState *unfiltered_bs;
+    BlockDriverState *unfiltered_bs_cow;
+    BlockDriverState *prefix_chain_bs;
+    int64_t size;
+    int64_t old_backing_size;
+    int64_t new_backing_size;
+    int64_t write_align;
+    BdrvRequestFlags write_flags;
+    int64_t buf_size;
+    float local_progress;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    int64_t offset;
+    int ret;
+} ImgRebaseState;
+
+/*
+ * Find the next region that is unallocated in the image and may differ
+ * between the old and the new backing file.  Returns 1 and the region in
+ * @poffset and @pbytes if it has to be compared, 0 if a region that needs
+ * no action was skipped, or a negative errno.  Must be called with
+ * @s->lock held.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+rebase_co_next_region(ImgRebaseState *s, int64_t *poffset, int64_t *pbytes)
+{
+    int64_t offset = s->offset;
+    int64_t n, n_alloc;
+    int ret;
+
+    /* How many bytes can we handle with the next read? */
+    n = MIN(s->buf_size, s->size - offset);
+
+    /* If the cluster is allocated, we don't need to take action */
+    ret = bdrv_co_is_allocated(s->unfiltered_bs, offset, n, &n);
+    if (ret < 0) {
+        error_report("error while reading image metadata: %s",
+                     strerror(-ret));
+        return ret;
+    }
+    if (ret) {
+        s->offset += n;
+        return 0;
+    }
+
+    if (s->prefix_chain_bs) {
+        int64_t bytes = n;
+
+        /*
+         * If cluster wasn't changed since prefix_chain, we don't need
+         * to take action
+         */
+        ret = bdrv_co_is_allocated_above(s->unfiltered_bs_cow,
+                                         s->prefix_chain_bs, false,
+                                         offset, n, &n);
+        if (ret < 0) {
+            error_report("error while reading image metadata: %s",
+                         strerror(-ret));
+            return ret;
+        }
+        if (!ret && n) {
+            s->offset += n;
+            return 0;
+        }
+        if (!n) {
+            /*
+             * If we've reached EOF of the old backing, it means that
+             * offsets beyond the old backing size were read as zeroes.
+             * Now we will need to explicitly zero the cluster in
+             * order to preserve that state after the rebase.
+             */
+            n = bytes;
+        }
+    }
+
+    /*
+     * At this point we know that the region [offset; offset + n)
+     * is unallocated within the target image.  This region might be
+     * unaligned to the target image's (sub)cluster boundaries, as
+     * old backing may have smaller clusters (or have subclusters).
+     * We extend it to the aligned boundaries to avoid CoW on
+     * partial writes in blk_pwrite(),
+     */
+    n += offset - QEMU_ALIGN_DOWN(offset, s->write_align);
+    offset = QEMU_ALIGN_DOWN(offset, s->write_align);
+    n += QEMU_ALIGN_UP(offset + n, s->write_align) - (offset + n);
+    n = MIN(n, s->size - offset);
+    assert(!bdrv_co_is_allocated(s->unfiltered_bs, offset, n, &n_alloc) &&
+           n_alloc == n);
+
+    s->offset = offset + n;
+    *poffset = offset;
+    *pbytes = n;
+    return 1;
+}
+
+static void coroutine_fn rebase_co_do_copy(void *opaque)
+{
+    ImgRebaseState *s = opaque;
+    uint8_t *buf_old, *buf_new;
+
+    s->running_coroutines++;
+    if (s->blk_old_backing &&
+        bdrv_opt_mem_align(blk_bs(s->blk_old_backing)) >
+        bdrv_opt_mem_align(blk_bs(s->blk))) {
+        buf_old = blk_blockalign(s->blk_old_backing, s->buf_size);
+    } else {
+        buf_old = blk_blockalign(s->blk, s->buf_size);
+    }
+    buf_new = blk_blockalign(s->blk_new_backing, s->buf_size);
+
+    while (1) {
+        bool old_backing_eof = false;
+        int64_t offset, n, n_old, n_new;
+        int64_t written = 0;
+        int ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->offset >= s->size) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = rebase_co_next_region(s, &offset, &n);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret < 0) {
+            s->ret = ret;
+            break;
+        } else if (!ret) {
+            continue;
+        }
+
+        /*
+         * Much like with the target image, we'll try to read as much
+         * of the old and new backings as we can.
+         */
+        n_old = MIN(n, MAX(0, s->old_backing_size - offset));
+        n_new = MIN(n, MAX(0, s->new_backing_size - offset));
+
+        /*
+         * Read old and new backing file and take into consideration that
+         * backing files may be smaller than the COW image.
+         */
+        memset(buf_old + n_old, 0, n - n_old);
+        if (!n_old) {
+            old_backing_eof = true;
+        } else {
+            ret = blk_co_pread(s->blk_old_backing, offset, n_old, buf_old, 0);
+            if (ret < 0) {
+                error_report("error while reading from old backing file");
+                s->ret = ret;
+                break;
+            }
+        }
+
+        memset(buf_new + n_new, 0, n - n_new);
+        if (n_new) {
+            ret = blk_co_pread(s->blk_new_backing, offset, n_new, buf_new, 0);
+            if (ret < 0) {
+                error_report("error while reading from new backing file");
+                s->ret = ret;
+                break;
+            }
+        }
+
+        /* If they differ, we need to write to the COW file */
+        while (written < n) {
+            int64_t pnum;
+
+            if (compare_buffers(buf_old + written, buf_new + written,
+                                n - written, s->write_align, &pnum))
+            {
+                if (old_backing_eof) {
+                    ret = blk_co_pwrite_zeroes(s->blk, offset + written,
+                                               pnum, 0);
+                } else {
+                    assert(written + pnum <= s->buf_size);
+                    ret = blk_co_pwrite(s->blk, offset + written, pnum,
+                                        buf_old + written, s->write_flags);
+                }
+                if (ret < 0) {
+                    error_report("Error while writing to COW image: %s",
+                        strerror(-ret));
+                    s->ret = ret;
+                    break;
+                }
+            }
+
+            written += pnum;
+            if (offset + written >= s->old_backing_size) {
+                old_backing_eof = true;
+            }
+        }
+        if (s->ret != -EINPROGRESS) {
+            break;
+        }
+        qemu_progress_print(s->local_progress, 100);
+    }
+
+    qemu_vfree(buf_old);
+    qemu_vfree(buf_new);
+    s->running_coroutines--;
+    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
+        /* the rebase finished successfully */
+        s->ret = 0;
+    }
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
-    uint8_t *buf_old = NULL;
-    uint8_t *buf_new = NULL;
     BlockDriverState *bs = NULL, *prefix_chain_bs = NULL;
     BlockDriverState *unfiltered_bs, *unfiltered_bs_cow;
     BlockDriverInfo bdi = {0};
@@ -3552,6 +3992,8 @@ static int img_rebase(int argc, char **argv)
     Error *local_err = NULL;
     bool image_opts = false;
     int64_t write_align;
+    long num_coroutines = 8;
+    int64_t buf_size = IO_BUF_SIZE;
 
     /* Parse commandline parameters */
     fmt = NULL;
@@ -3566,9 +4008,10 @@ static int img_rebase(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"force-share", no_argument, 0, 'U'},
             {"compress", no_argument, 0, 'c'},
+            {"buffer-size", required_argument, 0, OPTION_BUFFER_SIZE},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qUc",
+        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qUcm:",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -3619,6 +4062,18 @@ static int img_rebase(int argc, char **argv)
         case 'c':
             compress = true;
             break;
+        case 'm':
+            if (!parse_num_coroutines(optarg, &num_coroutines)) {
+                return 1;
+            }
+            break;
+        case OPTION_BUFFER_SIZE:
+            buf_size = cvtnum_full("buffer size", optarg, BDRV_SECTOR_SIZE,
+                                   MAX_IO_BUF_SIZE);
+            if (buf_size < 0) {
+                return 1;
+            }
+            break;
         }
     }
 
@@ -3803,177 +4258,70 @@ static int img_rebase(int argc, char **argv)
      * the image is the same as the original one at any time.
      */
     if (!unsafe) {
-        int64_t size;
-        int64_t old_backing_size = 0;
-        int64_t new_backing_size = 0;
-        uint64_t offset;
-        int64_t n, n_old = 0, n_new = 0;
-        float local_progress = 0;
-
-        if (blk_old_backing && bdrv_opt_mem_align(blk_bs(blk_old_backing)) >
-            bdrv_opt_mem_align(blk_bs(blk))) {
-            buf_old = blk_blockalign(blk_old_backing, IO_BUF_SIZE);
-        } else {
-            buf_old = blk_blockalign(blk, IO_BUF_SIZE);
-        }
-        buf_new = blk_blockalign(blk_new_backing, IO_BUF_SIZE);
+        ImgRebaseState s = {
+            .blk = blk,
+            .blk_old_backing = blk_old_backing,
+            .blk_new_backing = blk_new_backing,
+            .unfiltered_bs = unfiltered_bs,
+            .unfiltered_bs_cow = unfiltered_bs_cow,
+            .prefix_chain_bs = prefix_chain_bs,
+            .write_align = write_align,
+            .write_flags = write_flags,
+            /* Regions are aligned to write_align and must fit the buffer */
+            .buf_size = QEMU_ALIGN_UP(buf_size, write_align),
+            /* Each coroutine has a buffer for either backing file */
+            .num_coroutines = limit_num_coroutines(
+                num_coroutines, QEMU_ALIGN_UP(buf_size, write_align), 2),
+            .ret = -EINPROGRESS,
+        };
+        int i;
 
-        size = blk_getlength(blk);
-        if (size < 0) {
+        s.size = blk_getlength(blk);
+        if (s.size < 0) {
             error_report("Could not get size of '%s': %s",
-                         filename, strerror(-size));
+                         filename, strerror(-s.size));
             ret = -1;
             goto out;
         }
         if (blk_old_backing) {
-            old_backing_size = blk_getlength(blk_old_backing);
-            if (old_backing_size < 0) {
+            s.old_backing_size = blk_getlength(blk_old_backing);
+            if (s.old_backing_size < 0) {
                 char backing_name[PATH_MAX];
 
                 bdrv_get_backing_filename(bs, backing_name,
                                           sizeof(backing_name));
                 error_report("Could not get size of '%s': %s",
-                             backing_name, strerror(-old_backing_size));
+                             backing_name, strerror(-s.old_backing_size));
                 ret = -1;
                 goto out;
             }
         }
         if (blk_new_backing) {
-            new_backing_size = blk_getlength(blk_new_backing);
-            if (new_backing_size < 0) {
+            s.new_backing_size = blk_getlength(blk_new_backing);
+            if (s.new_backing_size < 0) {
                 error_report("Could not get size of '%s': %s",
-                             out_baseimg, strerror(-new_backing_size));
+                             out_baseimg, strerror(-s.new_backing_size));
                 ret = -1;
                 goto out;
             }
         }
 
-        if (size != 0) {
-            local_progress = (float)100 / (size / MIN(size, IO_BUF_SIZE));
+        if (s.size != 0) {
+            s.local_progress = (float)100 /
+                (s.size / MIN(s.size, s.buf_size));
         }
 
-        for (offset = 0; offset < size; offset += n) {
-            bool old_backing_eof = false;
-            int64_t n_alloc;
-
-            /* How many bytes can we handle with the next read? */
-            n = MIN(IO_BUF_SIZE, size - offset);
-
-            /* If the cluster is allocated, we don't need to take action */
-            ret = bdrv_is_allocated(unfiltered_bs, offset, n, &n);
-            if (ret < 0) {
-                error_report("error while reading image metadata: %s",
-                             strerror(-ret));
-                goto out;
-            }
-            if (ret) {
-                continue;
-            }
-
-            if (prefix_chain_bs) {
-                uint64_t bytes = n;
-
-                /*
-                 * If cluster wasn't changed since prefix_chain, we don't need
-                 * to take action
-                 */
-                ret = bdrv_is_allocated_above(unfiltered_bs_cow,
-                                              prefix_chain_bs, false,
-                                              offset, n, &n);
-                if (ret < 0) {
-                    error_report("error while reading image metadata: %s",
-                                 strerror(-ret));
-                    goto out;
-                }
-                if (!ret && n) {
-                    continue;
-                }
-                if (!n) {
-                    /*
-                     * If we've reached EOF of the old backing, it means that
-                     * offsets beyond the old backing size were read as zeroes.
-                     * Now we will need to explicitly zero the cluster in
-                     * order to preserve that state after the rebase.
-                     */
-                    n = bytes;
-                }
-            }
-
-            /*
-             * At this point we know that the region [offset; offset + n)
-             * is unallocated within the target image.  This region might be
-             * unaligned to the target image's (sub)cluster boundaries, as
-             * old backing may have smaller clusters (or have subclusters).
-             * We extend it to the aligned boundaries to avoid CoW on
-             * partial writes in blk_pwrite(),
-             */
-            n += offset - QEMU_ALIGN_DOWN(offset, write_align);
-            offset = QEMU_ALIGN_DOWN(offset, write_align);
-            n += QEMU_ALIGN_UP(offset + n, write_align) - (offset + n);
-            n = MIN(n, size - offset);
-            assert(!bdrv_is_allocated(unfiltered_bs, offset, n, &n_alloc) &&
-                   n_alloc == n);
-
-            /*
-             * Much like with the target image, we'll try to read as much
-             * of the old and new backings as we can.
-             */
-            n_old = MIN(n, MAX(0, old_backing_size - (int64_t) offset));
-            n_new = MIN(n, MAX(0, new_backing_size - (int64_t) offset));
-
-            /*
-             * Read old and new backing file and take into consideration that
-             * backing files may be smaller than the COW image.
-             */
-            memset(buf_old + n_old, 0, n - n_old);
-            if (!n_old) {
-                old_backing_eof = true;
-            } else {
-                ret = blk_pread(blk_old_backing, offset, n_old, buf_old, 0);
-                if (ret < 0) {
-                    error_report("error while reading from old backing file");
-                    goto out;
-                }
-            }
-
-            memset(buf_new + n_new, 0, n - n_new);
-            if (n_new) {
-                ret = blk_pread(blk_new_backing, offset, n_new, buf_new, 0);
-                if (ret < 0) {
-                    error_report("error while reading from new backing file");
-                    goto out;
-                }
-            }
-
-            /* If they differ, we need to write to the COW file */
-            uint64_t written = 0;
-
-            while (written < n) {
-                int64_t pnum;
-
-                if (compare_buffers(buf_old + written, buf_new + written,
-                                    n - written, write_align, &pnum))
-                {
-                    if (old_backing_eof) {
-                        ret = blk_pwrite_zeroes(blk, offset + written, pnum, 0);
-                    } else {
-                        assert(written + pnum <= IO_BUF_SIZE);
-                        ret = blk_pwrite(blk, offset + written, pnum,
-                                         buf_old + written, write_flags);
-                    }
-                    if (ret < 0) {
-                        error_report("Error while writing to COW image: %s",
-                            strerror(-ret));
-                        goto out;
-                    }
-                }
-
-                written += pnum;
-                if (offset + written >= old_backing_size) {
-                    old_backing_eof = true;
-                }
-            }
-            qemu_progress_print(local_progress, 100);
+        qemu_co_mutex_init(&s.lock);
+        for (i = 0; i < s.num_coroutines; i++) {
+            Coroutine *co = qemu_coroutine_create(rebase_co_do_copy, &s);
+            qemu_coroutine_enter(co);
+        }
+        while (s.running_coroutines) {
+            main_loop_wait(false);
+        }
+        ret = s.ret;
+        if (ret < 0) {
+            goto out;
         }
     }
 
@@ -4014,8 +4362,6 @@ out:
         blk_unref(blk_old_backing);
         blk_unref(blk_new_backing);
     }
-    qemu_vfree(buf_old);
-    qemu_vfree(buf_new);
 
     blk_unref(blk);
     if (ret) {
@@ -101,6 +101,77 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+/*
+ * The address ranges that the pending transaction may have changed are
+ * recorded in the coordinates of every region that can render them, that
+ * is the region that changed, its containers and its aliases, recursively.
+ * At commit time, a FlatView whose root has no recorded range is kept as
+ * is, and the others only render again the recorded ranges.
+ */
+typedef struct MemoryRegionUpdate {
+    MemoryRegion *mr;
+    AddrRange range;
+} MemoryRegionUpdate;
+
+/* Past this many recorded ranges, FlatViews are generated from scratch */
+#define MEMORY_REGION_UPDATES_MAX 4096
+
+static GArray *memory_region_updates;
+/* Set when a change cannot be tracked to some address ranges */
+static bool memory_region_update_all;
+
+static void memory_region_update_range(MemoryRegion *mr, AddrRange range)
+{
+    MemoryRegionUpdate update;
+    MemoryRegion *alias;
+
+    if (memory_region_update_all) {
+        return;
+    }
+
+    update.range = addrrange_make(int128_zero(), mr->size);
+    if (!addrrange_intersects(range, update.range)) {
+        return;
+    }
+    update.range = addrrange_intersection(range, update.range);
+    update.mr = mr;
+
+    if (!memory_region_updates) {
+        memory_region_updates = g_array_new(false, false,
+                                            sizeof(MemoryRegionUpdate));
+    }
+    if (memory_region_updates->len >= MEMORY_REGION_UPDATES_MAX) {
+        memory_region_update_all = true;
+        return;
+    }
+    g_array_append_val(memory_region_updates, update);
+
+    if (mr->container) {
+        memory_region_update_range(mr->container,
+                                   addrrange_shift(update.range,
+                                                   int128_make64(mr->addr)));
+    }
+    QTAILQ_FOREACH(alias, &mr->aliased_by, aliased_by_link) {
+        memory_region_update_range(alias,
+            addrrange_shift(update.range,
+                            int128_neg(int128_make64(alias->alias_offset))));
+    }
+}
+
+/* Record that the whole extent of @mr may have changed */
+static void memory_region_update_extent(MemoryRegion *mr)
+{
+    memory_region_update_range(mr, addrrange_make(int128_zero(), mr->size));
+}
+
+static void memory_region_updates_reset(void)
+{
+    if (memory_region_updates) {
+        g_array_set_size(memory_region_updates, 0);
+    }
+    memory_region_update_all = false;
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -263,6 +334,7 @@ static FlatView *flatview_new(MemoryRegion *mr_root)
     view = g_new0(FlatView, 1);
     view->ref = 1;
     view->root = mr_root;
+    view->root_addr = mr_root ? mr_root->addr : 0;
     memory_region_ref(mr_root);
     trace_flatview_new(view, mr_root);
 
@@ -749,10 +821,22 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_init_dispatch(FlatView *view)
+{
+    int i;
+
+    view->dispatch = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(view, &mrs);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -764,18 +848,192 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
-    }
-    address_space_dispatch_compact(view->dispatch);
+    flatview_init_dispatch(view);
     g_hash_table_replace(flat_views, mr, view);
 
     return view;
 }
 
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_gt(r1->start, r2->start);
+}
+
+/*
+ * Return the sorted, disjoint ranges of the FlatView of @mr that the
+ * pending transaction may have changed.
+ */
+static GArray *flatview_changed_ranges(MemoryRegion *mr)
+{
+    GArray *ranges = g_array_new(false, false, sizeof(AddrRange));
+    unsigned i, n;
+
+    for (i = 0; memory_region_updates && i < memory_region_updates->len;
+         i++) {
+        MemoryRegionUpdate *update =
+            &g_array_index(memory_region_updates, MemoryRegionUpdate, i);
+        AddrRange range;
+
+        if (update->mr != mr) {
+            continue;
+        }
+        /* The FlatView of @mr is rendered at the address of @mr */
+        range = addrrange_shift(update->range, int128_make64(mr->addr));
+        g_array_append_val(ranges, range);
+    }
+
+    g_array_sort(ranges, addrrange_compare);
+    for (i = 1, n = 0; i < ranges->len; i++) {
+        AddrRange *last = &g_array_index(ranges, AddrRange, n);
+        AddrRange *range = &g_array_index(ranges, AddrRange, i);
+
+        if (int128_le(range->start, addrrange_end(*last))) {
+            Int128 end = int128_max(addrrange_end(*last),
+                                    addrrange_end(*range));
+            last->size = int128_sub(end, last->start);
+        } else {
+            g_array_index(ranges, AddrRange, ++n) = *range;
+        }
+    }
+    if (ranges->len) {
+        g_array_set_size(ranges, n + 1);
+    }
+
+    return ranges;
+}
+
+/*
+ * Append the ranges of @old_view within @clip to @view.  *@pos is the
+ * index in @old_view from where to search, and is moved past the ranges
+ * that end before @clip.
+ */
+static void flatview_append_clipped(FlatView *view, const FlatView *old_view,
+                                    unsigned *pos, AddrRange clip)
+{
+    unsigned i;
+
+    if (!int128_nz(clip.size)) {
+        return;
+    }
+
+    for (i = *pos; i < old_view->nr; i++) {
+        FlatRange fr = old_view->ranges[i];
+        Int128 start, end;
+
+        if (int128_le(addrrange_end(fr.addr), clip.start)) {
+            *pos = i + 1;
+            continue;
+        }
+        if (int128_ge(fr.addr.start, addrrange_end(clip))) {
+            break;
+        }
+
+        start = int128_max(fr.addr.start, clip.start);
+        end = int128_min(addrrange_end(fr.addr), addrrange_end(clip));
+        fr.offset_in_region += int128_get64(int128_sub(start,
+                                                       fr.addr.start));
+        fr.addr = addrrange_make(start, int128_sub(end, start));
+        flatview_insert(view, view->nr, &fr);
+    }
+}
+
+/*
+ * Whether the ranges at index @i - 1 and @i of @view were split only
+ * because of where the FlatView was patched.  flatview_simplify() merges
+ * them again unless they are unmergeable.
+ */
+static bool flatview_split_unmergeable(FlatView *view, unsigned i)
+{
+    FlatRange *r1, *r2;
+
+    if (i == 0 || i >= view->nr) {
+        return false;
+    }
+
+    r1 = &view->ranges[i - 1];
+    r2 = &view->ranges[i];
+    return (r1->unmergeable || r2->unmergeable)
+        && int128_eq(addrrange_end(r1->addr), r2->addr.start)
+        && r1->mr == r2->mr
+        && int128_eq(int128_add(int128_make64(r1->offset_in_region),
+                                r1->addr.size),
+                     int128_make64(r2->offset_in_region));
+}
+
+/*
+ * Make the FlatView of the root of @old_view for the pending transaction,
+ * reusing @old_view if none of its ranges changed, and otherwise
+ * rendering again only the changed ranges and copying the others.
+ *
+ * Returns false if the FlatView must be generated from scratch.
+ */
+static bool flatview_patch(FlatView *old_view)
+{
+    MemoryRegion *mr = old_view->root;
+    g_autoptr(GArray) ranges = NULL;
+    g_autofree unsigned *splits = NULL;
+    Int128 pos = int128_zero();
+    unsigned i, old_pos = 0;
+    FlatView *view;
+
+    if (!mr || memory_region_update_all) {
+        return false;
+    }
+
+    /*
+     * The view is rendered at the address of its root, and moving the root
+     * itself is recorded as a change of its container only.
+     */
+    if (mr->addr != old_view->root_addr) {
+        return false;
+    }
+
+    ranges = flatview_changed_ranges(mr);
+    if (!ranges->len) {
+        trace_flatview_reuse(old_view, mr);
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return true;
+    }
+
+    view = flatview_new(mr);
+    splits = g_new(unsigned, ranges->len * 2);
+    for (i = 0; i < ranges->len; i++) {
+        AddrRange *range = &g_array_index(ranges, AddrRange, i);
+
+        flatview_append_clipped(view, old_view, &old_pos,
+                                addrrange_make(pos,
+                                               int128_sub(range->start, pos)));
+        splits[i * 2] = view->nr;
+        render_memory_region(view, mr, int128_zero(), *range,
+                             false, false, false);
+        splits[i * 2 + 1] = view->nr;
+        pos = addrrange_end(*range);
+    }
+    flatview_append_clipped(view, old_view, &old_pos,
+                            addrrange_make(pos, int128_sub(int128_2_64(),
+                                                           pos)));
+
+    for (i = 0; i < ranges->len * 2; i++) {
+        if (flatview_split_unmergeable(view, splits[i])) {
+            flatview_destroy(view);
+            return false;
+        }
+    }
+
+    flatview_simplify(view);
+    flatview_init_dispatch(view);
+    g_hash_table_replace(flat_views, mr, view);
+    trace_flatview_patch(view, mr, ranges->len);
+
+    return true;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -1010,6 +1268,30 @@ static void address_space_update_topology_pass(AddressSpace *as,
     }
 }
 
+/*
+ * Notify the listeners that see every range at each commit, when the
+ * FlatView of @as was kept as is.
+ */
+static void address_space_update_topology_nop(AddressSpace *as)
+{
+    FlatView *view = address_space_to_flatview(as);
+    MemoryListener *listener;
+    FlatRange *fr;
+
+    QTAILQ_FOREACH(listener, &as->listeners, link_as) {
+        if (listener->region_nop) {
+            break;
+        }
+    }
+    if (!listener) {
+        return;
+    }
+
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        MEMORY_LISTENER_UPDATE_REGION(fr, as, Forward, region_nop);
+    }
+}
+
 static void flatviews_init(void)
 {
     static FlatView *empty_view;
@@ -1032,24 +1314,31 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, starting from the old ones when possible */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        old_view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (!old_view || !flatview_patch(old_view)) {
+            generate_memory_topology(physmr);
+        }
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    memory_region_updates_reset();
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1129,17 +1418,26 @@ void memory_region_transaction_commit(void)
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
+                if (address_space_to_flatview(as) == old_view) {
+                    address_space_update_topology_nop(as);
+                }
                 address_space_update_ioeventfds(as);
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
-        } else if (ioeventfd_update_pending) {
-            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_update_ioeventfds(as);
+        } else {
+            /* Only changes that are not visible were recorded */
+            memory_region_updates_reset();
+            if (ioeventfd_update_pending) {
+                QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                    address_space_update_ioeventfds(as);
+                }
+                ioeventfd_update_pending = false;
             }
-            ioeventfd_update_pending = false;
         }
    }
 }
@@ -1277,6 +1575,7 @@ static void memory_region_initfn(Object *obj)
     mr->enabled = true;
     mr->romd_mode = true;
     mr->destructor = memory_region_destructor_none;
+    QTAILQ_INIT(&mr->aliased_by);
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
 
@@ -1705,6 +2004,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliased_by, mr, aliased_by_link);
 }
 
 bool memory_region_init_rom_nomigrate(MemoryRegion *mr,
@@ -1787,6 +2087,14 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias && QTAILQ_IN_USE(mr, aliased_by_link)) {
+        QTAILQ_REMOVE(&mr->alias->aliased_by, mr, aliased_by_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->aliased_by)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->aliased_by);
+        QTAILQ_REMOVE(&mr->aliased_by, alias, aliased_by_link);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -2256,6 +2564,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_update_extent(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2386,6 +2695,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_update_extent(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2396,6 +2706,7 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
+        memory_region_update_extent(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2406,6 +2717,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
+        memory_region_update_extent(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2642,6 +2954,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_update_extent(subregion);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2685,6 +2998,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
 
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    memory_region_update_extent(subregion);
     subregion->container = NULL;
     for (alias = subregion->alias; alias; alias = alias->alias) {
         alias->mapped_via_alias--;
@@ -2703,6 +3017,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_update_extent(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2718,7 +3033,9 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_update_extent(mr);
     mr->size = s;
+    memory_region_update_extent(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2740,8 +3057,11 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        memory_region_update_extent(mr);
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2755,6 +3075,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_update_extent(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2767,6 +3088,7 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
 
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
+    memory_region_update_extent(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2898,6 +3220,7 @@ bool memory_region_present(MemoryRegion *container, hwaddr addr)
 
 void memory_global_dirty_log_sync(bool last_stage)
 {
+    cpu_physical_memory_dirty_log_flush();
     memory_region_sync_dirty_bitmap(NULL, last_stage);
 }
 
@@ -2938,6 +3261,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
+        memory_region_update_all = true;
         memory_region_update_pending = true;
         memory_region_transaction_commit();
     }
@@ -2953,8 +3277,11 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
+        memory_region_update_all = true;
         memory_region_update_pending = true;
         memory_region_transaction_commit();
+        /* Nothing is batched anymore, free the buffers of exited threads */
+        cpu_physical_memory_dirty_log_flush();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
 }
@@ -21,9 +21,11 @@
 #include "exec/page-vary.h"
 #include "qapi/error.h"
 
+#include "qemu/coroutine-tls.h"
 #include "qemu/cutils.h"
 #include "qemu/cacheflush.h"
 #include "qemu/hbitmap.h"
+#include "qemu/lockable.h"
 #include "qemu/madvise.h"
 
 #ifdef CONFIG_TCG
@@ -2575,12 +2577,178 @@ MemoryRegion *get_system_io(void)
     return system_io;
 }
 
+/*
+ * Writes to RAM done by the emulation (address_space_write(),
+ * dma_memory_write(), ...) do not set the bits of the migration client
+ * in ram_list.dirty_memory directly: the dirtied ranges are appended to
+ * a per-thread ring instead, which is flushed into the bitmap when the
+ * ring is full and by cpu_physical_memory_dirty_log_flush(), before the
+ * dirty log is synced.
+ *
+ * The thread that owns a ring is the only one that appends to it, and
+ * only moves @head.  Draining the ring, either by the owner when it is
+ * full or by a flush from another thread, is serialized by @lock and
+ * only moves @tail, so that appending needs neither a lock nor atomic
+ * read-modify-write operations.
+ *
+ * Only the migration client is batched: VGA and code dirty tracking
+ * have to be updated synchronously.
+ */
+#define DIRTY_LOG_BUFFER_SIZE   256
+
+typedef struct DirtyLogEntry {
+    unsigned long page;
+    unsigned long end;
+} DirtyLogEntry;
+
+typedef struct DirtyLogBuffer {
+    /* Written by the owner thread only */
+    unsigned int head;
+    /* Written with @lock held */
+    unsigned int tail;
+    QemuSpin lock;
+    /* Set once the owner thread exited, protected by dirty_log_lock */
+    bool exited;
+    QLIST_ENTRY(DirtyLogBuffer) next;
+    Notifier exit_notifier;
+    DirtyLogEntry entries[DIRTY_LOG_BUFFER_SIZE];
+} DirtyLogBuffer;
+
+/* Protects dirty_log_buffers */
+static QemuMutex dirty_log_lock;
+static QLIST_HEAD(, DirtyLogBuffer) dirty_log_buffers =
+    QLIST_HEAD_INITIALIZER(dirty_log_buffers);
+
+QEMU_DEFINE_STATIC_CO_TLS(DirtyLogBuffer *, dirty_log_buffer);
+
+static void dirty_log_set_pages(unsigned long *const *blocks,
+                                unsigned long page, unsigned long end)
+{
+    while (page < end) {
+        unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long offset = page % DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long num = MIN(end - page, DIRTY_MEMORY_BLOCK_SIZE - offset);
+
+        bitmap_set_atomic(blocks[idx], offset, num);
+        page += num;
+    }
+}
+
+/* Called with buf->lock held, or by the last user of @buf */
+static void dirty_log_buffer_drain(DirtyLogBuffer *buf)
+{
+    unsigned int head = qatomic_load_acquire(&buf->head);
+    unsigned int tail = buf->tail;
+    unsigned long *const *blocks;
+    unsigned long page = 0, end = 0;
+
+    if (tail == head) {
+        return;
+    }
+
+    trace_dirty_log_buffer_drain(buf, head - tail);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        blocks = qatomic_rcu_read(
+                &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
+
+        for (; tail != head; tail++) {
+            DirtyLogEntry *entry = &buf->entries[tail % DIRTY_LOG_BUFFER_SIZE];
+
+            /* Skip ranges covered by the previous one, e.g. a virtqueue */
+            if (entry->page >= page && entry->end <= end) {
+                continue;
+            }
+            dirty_log_set_pages(blocks, entry->page, entry->end);
+            page = entry->page;
+            end = entry->end;
+        }
+    }
+
+    qatomic_store_release(&buf->tail, head);
+}
+
+static void dirty_log_buffer_exit(Notifier *n, void *unused)
+{
+    DirtyLogBuffer *buf = container_of(n, DirtyLogBuffer, exit_notifier);
+
+    /*
+     * The RCU read lock may not be usable anymore in an exiting thread,
+     * so leave the ring to the next flush.
+     */
+    WITH_QEMU_LOCK_GUARD(&dirty_log_lock) {
+        buf->exited = true;
+    }
+    set_dirty_log_buffer(NULL);
+}
+
+static DirtyLogBuffer *dirty_log_buffer_get(void)
+{
+    DirtyLogBuffer *buf = get_dirty_log_buffer();
+
+    if (likely(buf)) {
+        return buf;
+    }
+
+    buf = g_new0(DirtyLogBuffer, 1);
+    qemu_spin_init(&buf->lock);
+    buf->exit_notifier.notify = dirty_log_buffer_exit;
+    qemu_thread_atexit_add(&buf->exit_notifier);
+
+    WITH_QEMU_LOCK_GUARD(&dirty_log_lock) {
+        QLIST_INSERT_HEAD(&dirty_log_buffers, buf, next);
+    }
+    set_dirty_log_buffer(buf);
+    return buf;
+}
+
+static void dirty_log_buffer_add(ram_addr_t start, ram_addr_t length)
+{
+    DirtyLogBuffer *buf = dirty_log_buffer_get();
+    unsigned int head = buf->head;
+    DirtyLogEntry *entry;
+
+    if (head - qatomic_load_acquire(&buf->tail) == DIRTY_LOG_BUFFER_SIZE) {
+        qemu_spin_lock(&buf->lock);
+        dirty_log_buffer_drain(buf);
+        qemu_spin_unlock(&buf->lock);
+    }
+
+    entry = &buf->entries[head % DIRTY_LOG_BUFFER_SIZE];
+    entry->page = start >> TARGET_PAGE_BITS;
+    entry->end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    qatomic_store_release(&buf->head, head + 1);
+}
+
+void cpu_physical_memory_dirty_log_flush(void)
+{
+    DirtyLogBuffer *buf, *tmp;
+
+    QEMU_LOCK_GUARD(&dirty_log_lock);
+    QLIST_FOREACH_SAFE(buf, &dirty_log_buffers, next, tmp) {
+        if (buf->exited) {
+            QLIST_REMOVE(buf, next);
+            dirty_log_buffer_drain(buf);
+            g_free(buf);
+            continue;
+        }
+        qemu_spin_lock(&buf->lock);
+        dirty_log_buffer_drain(buf);
+        qemu_spin_unlock(&buf->lock);
+    }
+}
+
 static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
                                      hwaddr length)
 {
     uint8_t dirty_log_mask = memory_region_get_dirty_log_mask(mr);
     addr += memory_region_get_ram_addr(mr);
 
+    if (dirty_log_mask & (1 << DIRTY_MEMORY_MIGRATION)) {
+        dirty_log_buffer_add(addr, length);
+        dirty_log_mask &= ~(1 << DIRTY_MEMORY_MIGRATION);
+    }
+
     /* No early return if dirty_log_mask is or becomes 0, because
      * cpu_physical_memory_set_dirty_range will still call
      * xen_modified_memory.
@@ -3070,6 +3238,7 @@ void cpu_exec_init_all(void)
     io_mem_init();
     memory_map_init();
     qemu_mutex_init(&map_client_list_lock);
+    qemu_mutex_init(&dirty_log_lock);
 }
 
 void cpu_unregister_map_client(QEMUBH *bh)
@@ -26,6 +26,15 @@
 
 #define MAX_UNROLL  4
 
+/*
+ * Host vector operations are cheap enough that we can afford more of
+ * them inline: 8 x 256-bit covers the largest ARM SVE vector and a
+ * RISC-V vector group of 256 bytes, and 8 x 128-bit covers 1024-bit
+ * SVE on hosts without 256-bit vectors.  Without this, such guests
+ * fall back to the out-of-line helpers for every operation.
+ */
+#define MAX_UNROLL_VEC  8
+
 #ifdef CONFIG_DEBUG_TCG
 static const TCGOpcode vecop_list_empty[1] = { 0 };
 #else
@@ -363,7 +372,7 @@ static inline bool check_size_impl(uint32_t oprsz, uint32_t lnsz)
         q += ctpop32(r);
     }
 
-    return q <= MAX_UNROLL;
+    return q <= (lnsz >= 16 ? MAX_UNROLL_VEC : MAX_UNROLL);
 }
 
 static void expand_clr(uint32_t dofs, uint32_t maxsz);
@@ -282,8 +282,10 @@ void gen_set_label(TCGLabel *l)
 static void add_last_as_label_use(TCGLabel *l)
 {
     TCGLabelUse *u = tcg_malloc(sizeof(TCGLabelUse));
+    TCGOp *before = tcg_ctx->emit_before_op;
 
-    u->op = tcg_last_op();
+    /* The branch just emitted may have been inserted mid-stream. */
+    u->op = before ? QTAILQ_PREV(before, link) : tcg_last_op();
     QSIMPLEQ_INSERT_TAIL(&l->branches, u, next);
 }
 
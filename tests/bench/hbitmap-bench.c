@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Benchmark for the bulk operations of HBitmap: scanning for dirty areas,
+ * merging and serialization, as used by backup, mirror and dirty bitmap
+ * migration.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+
+enum bench_op {
+    OP_SET,
+    OP_RESET,
+    OP_ITER,
+    OP_NEXT_DIRTY_AREA,
+    OP_DIRTY_AREAS,
+    OP_NEXT_ZERO,
+    OP_MERGE,
+    OP_SPARSE_MERGE,
+    OP_SERIALIZE,
+};
+
+struct benchmark {
+    const char * const name;
+    enum bench_op op;
+};
+
+static const struct benchmark benchmarks[] = {
+    { .name = "set",             .op = OP_SET },
+    { .name = "reset",           .op = OP_RESET },
+    { .name = "iter_next",       .op = OP_ITER },
+    { .name = "next_dirty_area", .op = OP_NEXT_DIRTY_AREA },
+    { .name = "dirty_areas",     .op = OP_DIRTY_AREAS },
+    { .name = "next_zero",       .op = OP_NEXT_ZERO },
+    { .name = "merge",           .op = OP_MERGE },
+    { .name = "sparse_merge",    .op = OP_SPARSE_MERGE },
+    { .name = "serialize",       .op = OP_SERIALIZE },
+};
+
+static uint64_t disk_size = 4 * TiB;
+static int granularity = 16;
+static unsigned int density = 50;
+static uint64_t seed = 1;
+
+static uint64_t xorshift64star(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+/*
+ * Dirty about @density percent of the bitmap with runs of 1 to 64 clusters,
+ * which is what a guest doing mixed small and sequential writes produces.
+ */
+static void fill(HBitmap *hb)
+{
+    uint64_t cluster = 1ULL << granularity;
+    uint64_t offset = 0;
+
+    while (offset < disk_size) {
+        uint64_t bytes = MIN((1 + xorshift64star() % 64) * cluster,
+                             disk_size - offset);
+
+        if (xorshift64star() % 100 < density) {
+            hbitmap_set(hb, offset, bytes);
+        }
+        offset += bytes;
+    }
+}
+
+static int64_t run_benchmark(const struct benchmark *bench)
+{
+    HBitmap *hb = hbitmap_alloc(disk_size, granularity);
+    HBitmap *other = hbitmap_alloc(disk_size, granularity);
+    HBitmap *coarse = hbitmap_alloc(disk_size, granularity + 2);
+    uint64_t align = hbitmap_serialization_align(hb);
+    HBitmapRange areas[64];
+    uint8_t *buf = NULL;
+    int64_t offset, count;
+    int64_t start_ns, ns;
+    HBitmapIter hbi;
+    size_t n;
+
+    fill(hb);
+    if (bench->op == OP_MERGE) {
+        fill(other);
+    } else if (bench->op == OP_SPARSE_MERGE) {
+        fill(coarse);
+    } else if (bench->op == OP_NEXT_ZERO) {
+        hbitmap_set(hb, 0, disk_size);
+    } else if (bench->op == OP_SERIALIZE) {
+        buf = g_malloc(hbitmap_serialization_size(hb, 0, disk_size));
+    }
+
+    start_ns = get_clock();
+    switch (bench->op) {
+    case OP_SET:
+        hbitmap_set(other, 0, disk_size);
+        break;
+    case OP_RESET:
+        hbitmap_reset(hb, 0, disk_size);
+        break;
+    case OP_ITER:
+        hbitmap_iter_init(&hbi, hb, 0);
+        while (hbitmap_iter_next(&hbi) >= 0) {
+            ;
+        }
+        break;
+    case OP_NEXT_DIRTY_AREA:
+        for (offset = 0;
+             hbitmap_next_dirty_area(hb, offset, disk_size, INT64_MAX,
+                                     &offset, &count);
+             offset += count) {
+            ;
+        }
+        break;
+    case OP_DIRTY_AREAS:
+        offset = 0;
+        while ((n = hbitmap_dirty_areas(hb, offset, disk_size, areas,
+                                        ARRAY_SIZE(areas)))) {
+            offset = areas[n - 1].start + areas[n - 1].count;
+        }
+        break;
+    case OP_NEXT_ZERO:
+        g_assert(hbitmap_next_zero(hb, 0, INT64_MAX) < 0);
+        break;
+    case OP_MERGE:
+        hbitmap_merge(hb, other, hb);
+        break;
+    case OP_SPARSE_MERGE:
+        hbitmap_merge(hb, coarse, hb);
+        break;
+    case OP_SERIALIZE:
+        for (offset = 0; offset < disk_size; offset += count) {
+            count = MIN(disk_size - offset, align * 8192);
+            hbitmap_serialize_part(hb, buf, offset, count);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    ns = get_clock() - start_ns;
+
+    g_free(buf);
+    hbitmap_free(coarse);
+    hbitmap_free(other);
+    hbitmap_free(hb);
+    return ns;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -s SIZE   disk size in GiB (default %" PRIu64 ")\n",
+           disk_size / GiB);
+    printf("  -g BITS   log2 of the granularity in bytes (default %d)\n",
+           granularity);
+    printf("  -d PCT    percentage of dirty data (default %u)\n", density);
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i;
+
+    while ((c = getopt(argc, argv, "s:g:d:h")) != -1) {
+        switch (c) {
+        case 's':
+            disk_size = g_ascii_strtoull(optarg, NULL, 10) * GiB;
+            break;
+        case 'g':
+            granularity = atoi(optarg);
+            break;
+        case 'd':
+            density = MIN(atoi(optarg), 100);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!disk_size || granularity < 9 || granularity > 30) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("# %" PRIu64 " GiB, granularity %" PRIu64 " bytes, "
+           "%u%% dirty. Units: ms per operation on the whole bitmap\n",
+           disk_size / GiB, UINT64_C(1) << granularity, density);
+    for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        const struct benchmark *bench = &benchmarks[i];
+        int64_t total_ns = 0;
+        int64_t n_runs = 0;
+
+        /* warm-up run */
+        run_benchmark(bench);
+
+        while (n_runs < 10) {
+            total_ns += run_benchmark(bench);
+            n_runs++;
+        }
+        printf("%16s %10.3f\n", bench->name, (double)total_ns / n_runs / 1e6);
+    }
+    return 0;
+}
@@ -20,6 +20,8 @@ typedef struct {
     uint64_t count_insn_inline;
     uint64_t count_mem;
     uint64_t count_mem_inline;
+    uint64_t tb_cond_num_trigger;
+    uint64_t tb_cond_track_count;
 } CPUCount;
 
 static struct qemu_plugin_scoreboard *counts;
@@ -29,6 +31,8 @@ static qemu_plugin_u64 count_insn;
 static qemu_plugin_u64 count_insn_inline;
 static qemu_plugin_u64 count_mem;
 static qemu_plugin_u64 count_mem_inline;
+static qemu_plugin_u64 tb_cond_num_trigger;
+static qemu_plugin_u64 tb_cond_track_count;
 
 static uint64_t global_count_tb;
 static uint64_t global_count_insn;
@@ -38,6 +42,8 @@ static GMutex tb_lock;
 static GMutex insn_lock;
 static GMutex mem_lock;
 
+static const uint64_t cond_trigger_limit = 100;
+
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static void stats_insn(void)
@@ -94,6 +100,8 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
         const uint64_t insn_inline = qemu_plugin_u64_get(count_insn_inline, i);
         const uint64_t mem = qemu_plugin_u64_get(count_mem, i);
         const uint64_t mem_inline = qemu_plugin_u64_get(count_mem_inline, i);
+        const uint64_t cond_num_trigger =
+            qemu_plugin_u64_get(tb_cond_num_trigger, i);
         printf("cpu %d: tb (%" PRIu64 ", %" PRIu64 ") | "
                "insn (%" PRIu64 ", %" PRIu64 ") | "
                "mem (%" PRIu64 ", %" PRIu64 ")"
@@ -102,6 +110,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
         g_assert(tb == tb_inline);
         g_assert(insn == insn_inline);
         g_assert(mem == mem_inline);
+        g_assert(cond_num_trigger == tb_inline / cond_trigger_limit);
     }
 
     stats_tb();
@@ -120,6 +129,14 @@ static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
     g_mutex_unlock(&tb_lock);
 }
 
+static void vcpu_tb_cond_exec(unsigned int cpu_index, void *udata)
+{
+    g_assert(qemu_plugin_u64_get(tb_cond_track_count, cpu_index) ==
+             cond_trigger_limit);
+    qemu_plugin_u64_set(tb_cond_track_count, cpu_index, 0);
+    qemu_plugin_u64_add(tb_cond_num_trigger, cpu_index, 1);
+}
+
 static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
 {
     qemu_plugin_u64_add(count_insn, cpu_index, 1);
@@ -133,6 +150,9 @@ static void vcpu_mem_access(unsigned int cpu_index,
                             uint64_t vaddr,
                             void *userdata)
 {
+    qemu_plugin_mem_value value = qemu_plugin_mem_get_value(info);
+
+    g_assert(value.type == qemu_plugin_mem_size_shift(info));
     qemu_plugin_u64_add(count_mem, cpu_index, 1);
     g_mutex_lock(&mem_lock);
     global_count_mem++;
@@ -145,6 +165,11 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         tb, vcpu_tb_exec, QEMU_PLUGIN_CB_NO_REGS, 0);
     qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
         tb, QEMU_PLUGIN_INLINE_ADD_U64, count_tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_cond_track_count, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond_exec, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_EQ, tb_cond_track_count, cond_trigger_limit, 0);
 
     for (int idx = 0; idx < qemu_plugin_tb_n_insns(tb); ++idx) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, idx);
@@ -179,6 +204,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         counts, CPUCount, count_insn_inline);
     count_mem_inline = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, count_mem_inline);
+    tb_cond_num_trigger = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_cond_num_trigger);
+    tb_cond_track_count = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_cond_track_count);
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -0,0 +1,230 @@
+/*
+ * QTest testcase for memory topology updates
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+/* Slots 0 and 1 hold the host bridge and the PIIX3 */
+#define FIRST_SLOT      2
+#define MAX_DEVICES     ((32 - FIRST_SLOT) * 8)
+
+typedef struct TestDevices {
+    QTestState *qts;
+    QPCIBus *bus;
+    unsigned count;
+    QPCIDevice *dev[MAX_DEVICES];
+    QPCIBar bar[MAX_DEVICES];
+} TestDevices;
+
+/*
+ * Start a machine with @count pci-testdev functions, and map the MMIO BAR
+ * of each of them.
+ */
+static void test_devices_init(TestDevices *d, unsigned count)
+{
+    g_autoptr(GString) cmd = g_string_new("-machine pc -nodefaults");
+    unsigned i;
+
+    g_assert(count <= MAX_DEVICES);
+    for (i = 0; i < count; i++) {
+        g_string_append_printf(cmd,
+                               " -device pci-testdev,addr=%02x.%x%s",
+                               FIRST_SLOT + i / 8, i % 8,
+                               i % 8 ? "" : ",multifunction=on");
+    }
+
+    d->qts = qtest_init(cmd->str);
+    d->bus = qpci_new_pc(d->qts, NULL);
+    d->count = count;
+    for (i = 0; i < count; i++) {
+        d->dev[i] = qpci_device_find(d->bus,
+                                     QPCI_DEVFN(FIRST_SLOT + i / 8, i % 8));
+        g_assert(d->dev[i]);
+        d->bar[i] = qpci_iomap(d->dev[i], 0, NULL);
+        qpci_config_writew(d->dev[i], PCI_COMMAND, PCI_COMMAND_MEMORY);
+    }
+}
+
+static void test_devices_cleanup(TestDevices *d)
+{
+    unsigned i;
+
+    for (i = 0; i < d->count; i++) {
+        g_free(d->dev[i]);
+    }
+    qpci_free_pc(d->bus);
+    qtest_quit(d->qts);
+}
+
+/* Whether the MMIO BAR of a pci-testdev is rendered at @addr */
+static bool test_bar_mapped_at(TestDevices *d, uint64_t addr)
+{
+    g_autofree char *mtree = qtest_hmp(d->qts, "info mtree -f");
+    g_autofree char *range =
+        g_strdup_printf("%016" PRIx64 "-%016" PRIx64
+                        " (prio 1, i/o): pci-testdev-mmio",
+                        addr, addr + 0xfff);
+
+    return strstr(mtree, range);
+}
+
+/* The ranges of the FlatView of the "memory" address space */
+static char *test_memory_flatview(TestDevices *d)
+{
+    g_autofree char *mtree = qtest_hmp(d->qts, "info mtree -f");
+    char *start, *end;
+
+    start = strstr(mtree, " AS \"memory\"");
+    g_assert(start);
+    start = strstr(start, " Root memory region");
+    g_assert(start);
+    end = strstr(start, "FlatView #");
+
+    return g_strndup(start, end ? end - start : strlen(start));
+}
+
+/*
+ * Starting or stopping dirty logging renders all FlatViews from scratch,
+ * without patching them.
+ */
+static void test_flatviews_regenerate(TestDevices *d)
+{
+    QDict *rsp;
+    bool measuring;
+
+    qtest_qmp_assert_success(d->qts,
+        "{'execute': 'calc-dirty-rate', 'arguments': {"
+        "'calc-time': 50, 'calc-time-unit': 'millisecond',"
+        "'mode': 'dirty-bitmap'}}");
+    do {
+        g_usleep(10 * 1000);
+        rsp = qtest_qmp_assert_success_ref(d->qts,
+                                           "{'execute': 'query-dirty-rate'}");
+        measuring = !strcmp(qdict_get_str(rsp, "status"), "measuring");
+        qobject_unref(rsp);
+    } while (measuring);
+}
+
+static void test_bar_remap(void)
+{
+    TestDevices d;
+    uint64_t addr;
+    unsigned i;
+
+    test_devices_init(&d, 16);
+    for (i = 0; i < d.count; i++) {
+        g_assert(test_bar_mapped_at(&d, d.bar[i].addr));
+    }
+
+    /* Move a BAR past the others */
+    addr = d.bar[d.count - 1].addr + 0x10000;
+    qpci_config_writel(d.dev[3], PCI_BASE_ADDRESS_0, addr);
+    g_assert(test_bar_mapped_at(&d, addr));
+    g_assert(!test_bar_mapped_at(&d, d.bar[3].addr));
+
+    /* Move it over the BAR of another device */
+    qpci_config_writel(d.dev[3], PCI_BASE_ADDRESS_0, d.bar[4].addr);
+    g_assert(test_bar_mapped_at(&d, d.bar[4].addr));
+    g_assert(!test_bar_mapped_at(&d, addr));
+
+    /* Disable the device in between, then enable it again */
+    qpci_config_writel(d.dev[3], PCI_BASE_ADDRESS_0, d.bar[3].addr);
+    qpci_config_writew(d.dev[3], PCI_COMMAND, 0);
+    g_assert(!test_bar_mapped_at(&d, d.bar[3].addr));
+    g_assert(test_bar_mapped_at(&d, d.bar[2].addr));
+    g_assert(test_bar_mapped_at(&d, d.bar[4].addr));
+    qpci_config_writew(d.dev[3], PCI_COMMAND, PCI_COMMAND_MEMORY);
+
+    for (i = 0; i < d.count; i++) {
+        g_assert(test_bar_mapped_at(&d, d.bar[i].addr));
+    }
+
+    test_devices_cleanup(&d);
+}
+
+/* A patched FlatView must match the one rendered from scratch */
+static void test_patch_vs_render(void)
+{
+    g_autofree char *patched = NULL;
+    g_autofree char *rendered = NULL;
+    TestDevices d;
+    unsigned i;
+
+    test_devices_init(&d, 16);
+
+    /* Overlap, disable and move BARs, so that windows split other ranges */
+    for (i = 0; i < d.count; i += 2) {
+        qpci_config_writel(d.dev[i], PCI_BASE_ADDRESS_0,
+                           d.bar[(i + 5) % d.count].addr);
+    }
+    for (i = 1; i < d.count; i += 4) {
+        qpci_config_writew(d.dev[i], PCI_COMMAND, 0);
+    }
+    qpci_config_writel(d.dev[3], PCI_BASE_ADDRESS_0, d.bar[1].addr);
+
+    patched = test_memory_flatview(&d);
+    test_flatviews_regenerate(&d);
+    rendered = test_memory_flatview(&d);
+    g_assert_cmpstr(patched, ==, rendered);
+
+    test_devices_cleanup(&d);
+}
+
+/*
+ * Each toggle of the memory enable bit maps or unmaps a BAR, which
+ * commits a memory transaction.  The time includes the qtest protocol
+ * round trip, which does not depend on the number of devices.
+ */
+static void perf_bar_toggle(const void *opaque)
+{
+    unsigned count = GPOINTER_TO_UINT(opaque);
+    unsigned i, max = 2000;
+    TestDevices d;
+    double duration;
+
+    test_devices_init(&d, count);
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        qpci_config_writew(d.dev[0], PCI_COMMAND,
+                           i & 1 ? PCI_COMMAND_MEMORY : 0);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("%u devices: %u commits in %f s, %f us per commit",
+                   count, max, duration, duration * 1e6 / max);
+
+    test_devices_cleanup(&d);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned counts[] = { 8, 32, 128, MAX_DEVICES };
+    unsigned i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/memory-topology/bar-remap", test_bar_remap);
+    qtest_add_func("/memory-topology/patch-vs-render", test_patch_vs_render);
+
+    if (g_test_perf()) {
+        for (i = 0; i < ARRAY_SIZE(counts); i++) {
+            g_autofree char *path =
+                g_strdup_printf("/perf/memory-topology/bar-toggle/%u",
+                                counts[i]);
+
+            qtest_add_data_func(path, GUINT_TO_POINTER(counts[i]),
+                                perf_bar_toggle);
+        }
+    }
+
+    return g_test_run();
+}
@@ -1962,6 +1962,30 @@ static void test_precopy_unix_dirty_ring(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_precopy_dirty_sync_threads_start(QTestState *from,
+                                              QTestState *to)
+{
+    /* Helper threads are otherwise only used for hundreds of GiB */
+    migrate_set_parameter_int(from, "x-dirty-sync-threads", 2);
+
+    return NULL;
+}
+
+static void test_precopy_unix_dirty_sync_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_precopy_dirty_sync_threads_start,
+        /* Synchronize the dirty bitmap while the guest dirties memory */
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_unix_tls_psk(void)
 {
@@ -2287,6 +2311,52 @@ static void test_multifd_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+static void *migrate_postcopy_from_file_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+
+    migrate_set_capability(to, "postcopy-from-file", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_postcopy_from_file(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_postcopy_from_file_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void *migrate_multifd_postcopy_from_file_start(QTestState *from,
+                                                      QTestState *to)
+{
+    migrate_multifd_mapped_ram_start(from, to);
+
+    migrate_set_capability(to, "postcopy-from-file", true);
+
+    return NULL;
+}
+
+static void test_multifd_file_postcopy_from_file(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_multifd_postcopy_from_file_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 
 static void test_precopy_tcp_plain(void)
 {
@@ -2324,6 +2394,205 @@ static void test_precopy_tcp_switchover_ack(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_concurrent_device_state_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "concurrent-device-state", true);
+    migrate_set_capability(to, "concurrent-device-state", true);
+
+    return NULL;
+}
+
+/* Check that the state of device @id was handled by a worker thread */
+static void check_device_state_concurrent(QTestState *who, const char *id)
+{
+    QDict *rsp = migrate_query(who);
+    QList *list = qdict_get_qlist(rsp, "device-state");
+    const QListEntry *entry;
+    bool found = false;
+
+    g_assert(list);
+    QLIST_FOREACH_ENTRY(list, entry) {
+        QDict *stats = qobject_to(QDict, qlist_entry_obj(entry));
+
+        if (g_str_has_suffix(qdict_get_str(stats, "id"), id)) {
+            g_assert(qdict_get_bool(stats, "concurrent"));
+            found = true;
+        }
+    }
+    g_assert(found);
+    qobject_unref(rsp);
+}
+
+static void
+test_migrate_concurrent_device_state_finish(QTestState *from, QTestState *to,
+                                            void *opaque)
+{
+    const char *arch = qtest_get_arch();
+
+    /* port92 is the only independent device of the test machines so far */
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        return;
+    }
+
+    check_device_state_concurrent(from, "port92");
+    check_device_state_concurrent(to, "port92");
+}
+
+static void test_precopy_tcp_concurrent_device_state(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_concurrent_device_state_start,
+        .finish_hook = test_migrate_concurrent_device_state_finish,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_predictive_switchover_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "predictive-switchover", true);
+
+    return NULL;
+}
+
+static void
+test_migrate_predictive_switchover_finish(QTestState *from, QTestState *to,
+                                          void *opaque)
+{
+    QDict *rsp = migrate_query(from);
+    QDict *prediction = qdict_get_qdict(rsp, "switchover-prediction");
+
+    g_assert(prediction);
+    g_assert(qdict_haskey(prediction, "downtime-error"));
+    /* The prediction that decided the switchover was within the limit */
+    g_assert_cmpint(qdict_get_int(prediction, "downtime"), <=,
+                    migrate_get_parameter_int(from, "downtime-limit"));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_tcp_predictive_switchover(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_predictive_switchover_start,
+        .finish_hook = test_migrate_predictive_switchover_finish,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_device_state_compression_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "device-state-zero-run", true);
+    migrate_set_parameter_str(from, "device-state-compression", "zlib");
+
+    return NULL;
+}
+
+static void
+test_migrate_device_state_compression_finish(QTestState *from,
+                                             QTestState *to, void *opaque)
+{
+    QDict *rsp = migrate_query(from);
+    QDict *stats = qdict_get_qdict(rsp, "device-state-compression");
+
+    g_assert(stats);
+    g_assert_cmpint(qdict_get_int(stats, "raw-bytes"), >,
+                    qdict_get_int(stats, "compressed-bytes"));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_tcp_device_state_compression(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_device_state_compression_start,
+        .finish_hook = test_migrate_device_state_compression_finish,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+/*
+ * qtest writes go through address_space_write(), like the DMA of emulated
+ * devices, so the pages they dirty are batched by the thread doing them.
+ * Write to a small part of many pages, away from the bytes written by
+ * the guest workload, both before and during the migration.
+ */
+#define DMA_DIRTY_OFFSET    (TEST_MEM_PAGE_SIZE / 2)
+#define DMA_DIRTY_STRIDE    (16 * TEST_MEM_PAGE_SIZE)
+#define DMA_DIRTY_LEN       64
+
+static void dma_dirty_write(QTestState *who, uint8_t value)
+{
+    uint8_t buf[DMA_DIRTY_LEN];
+    unsigned address;
+
+    memset(buf, value, sizeof(buf));
+    for (address = start_address + DMA_DIRTY_OFFSET; address < end_address;
+         address += DMA_DIRTY_STRIDE) {
+        qtest_memwrite(who, address, buf, sizeof(buf));
+    }
+}
+
+static void dma_dirty_check(QTestState *who, uint8_t value)
+{
+    uint8_t buf[DMA_DIRTY_LEN];
+    unsigned address;
+    int i;
+
+    for (address = start_address + DMA_DIRTY_OFFSET; address < end_address;
+         address += DMA_DIRTY_STRIDE) {
+        qtest_memread(who, address, buf, sizeof(buf));
+        for (i = 0; i < DMA_DIRTY_LEN; i++) {
+            g_assert_cmphex(buf[i], ==, value);
+        }
+    }
+}
+
+static void test_precopy_tcp_dma_dirty(void)
+{
+    MigrateStart args = {};
+    QTestState *from, *to;
+    g_autofree char *uri = NULL;
+
+    if (test_migrate_start(&from, &to, "tcp:127.0.0.1:0", &args)) {
+        return;
+    }
+
+    wait_for_serial("src_serial");
+    migrate_ensure_non_converge(from);
+    migrate_prepare_for_dirty_mem(from);
+    dma_dirty_write(from, 0x5a);
+
+    uri = migrate_get_socket_address(to, "socket-address");
+    migrate_qmp(from, uri, "{}");
+
+    /*
+     * Some of the pages were already sent: they must be sent again, even
+     * if the last writes are still batched when the dirty log is synced.
+     */
+    migrate_wait_for_dirty_mem(from, to);
+    dma_dirty_write(from, 0xa5);
+
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    wait_for_stop(from, &src_state);
+    wait_for_resume(to, &dst_state);
+    wait_for_serial("dest_serial");
+
+    dma_dirty_check(to, 0xa5);
+
+    test_migrate_end(from, to, true);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_tcp_tls_psk_match(void)
 {
@@ -2752,6 +3021,14 @@ test_migration_precopy_tcp_multifd_start_no_zero_page(QTestState *from,
     return NULL;
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    return test_migrate_xbzrle_start(from, to);
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -2766,6 +3043,62 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <linux/io_uring.h>
+
+/* The host can disable io_uring, e.g. with kernel.io_uring_disabled */
+static bool io_uring_available(void)
+{
+    struct io_uring_params params = { 0 };
+    int fd = syscall(__NR_io_uring_setup, 1, &params);
+
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_io_uring_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_set_capability(to, "multifd", true);
+    migrate_set_capability(to, "io-uring-recv", true);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
+static void
+test_migrate_precopy_tcp_multifd_io_uring_finish(QTestState *from,
+                                                 QTestState *to,
+                                                 void *opaque)
+{
+    QDict *rsp = migrate_query(to);
+
+    /* The pages were received with io_uring, not with the QIOChannel */
+    g_assert(qdict_haskey(rsp, "io-uring-recv-bytes"));
+    g_assert_cmpint(qdict_get_int(rsp, "io-uring-recv-bytes"), >, 0);
+    qobject_unref(rsp);
+}
+
+static void test_multifd_tcp_io_uring(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_io_uring_start,
+        .finish_hook = test_migrate_precopy_tcp_multifd_io_uring_finish,
+        .live = true,
+    };
+
+    if (!io_uring_available()) {
+        g_test_skip("io_uring not available");
+        return;
+    }
+    test_precopy_common(&args);
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -2823,6 +3156,21 @@ static void test_multifd_tcp_no_zero_page(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        .iterations = 2,
+        /*
+         * XBZRLE needs pages to be modified when doing the 2nd+ round
+         * iteration to have real data pushed to the stream.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -3615,6 +3963,11 @@ int main(int argc, char **argv)
                        test_precopy_unix_plain);
     migration_test_add("/migration/precopy/unix/xbzrle",
                        test_precopy_unix_xbzrle);
+    /* TCG never synchronizes the dirty bitmap in parallel */
+    if (has_kvm) {
+        migration_test_add("/migration/precopy/unix/dirty-sync-threads",
+                           test_precopy_unix_dirty_sync_threads);
+    }
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -3651,6 +4004,13 @@ int main(int argc, char **argv)
     migration_test_add("/migration/multifd/file/mapped-ram/live",
                        test_multifd_file_mapped_ram_live);
 
+    if (has_uffd) {
+        migration_test_add("/migration/precopy/file/postcopy-from-file",
+                           test_precopy_file_postcopy_from_file);
+        migration_test_add("/migration/multifd/file/postcopy-from-file",
+                           test_multifd_file_postcopy_from_file);
+    }
+
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/precopy/unix/tls/psk",
                        test_precopy_unix_tls_psk);
@@ -3682,6 +4042,14 @@ int main(int argc, char **argv)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/tcp/plain/concurrent-device-state",
+                       test_precopy_tcp_concurrent_device_state);
+    migration_test_add("/migration/precopy/tcp/plain/predictive-switchover",
+                       test_precopy_tcp_predictive_switchover);
+    migration_test_add("/migration/precopy/tcp/plain/device-state-compression",
+                       test_precopy_tcp_device_state_compression);
+    migration_test_add("/migration/precopy/tcp/plain/dma-dirty",
+                       test_precopy_tcp_dma_dirty);
 
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/precopy/tcp/tls/psk/match",
@@ -3740,8 +4108,14 @@ int main(int argc, char **argv)
                        test_multifd_tcp_no_zero_page);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
                        test_multifd_tcp_zlib);
+#ifdef CONFIG_LINUX_IO_URING
+    migration_test_add("/migration/multifd/tcp/plain/io-uring",
+                       test_multifd_tcp_io_uring);
+#endif
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
@@ -0,0 +1,123 @@
+/*
+ * QTest testcase for the TCG sampling profiler
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+/* A BIOS whose reset vector, at the end of the image, jumps to itself */
+#define BIOS_SIZE       (64 * 1024)
+#define RESET_VECTOR    "0xfffffff0"
+
+static QTestState *test_profiler_init(void)
+{
+    g_autofree char *bios_path = NULL;
+    g_autofree uint8_t *bios = g_malloc0(BIOS_SIZE);
+    QTestState *qts;
+    int fd;
+
+    bios[BIOS_SIZE - 16] = 0xeb;            /* jmp . */
+    bios[BIOS_SIZE - 15] = 0xfe;
+
+    fd = g_file_open_tmp("qtest-tcg-profiler-XXXXXX", &bios_path, NULL);
+    g_assert(fd != -1);
+    g_assert(write(fd, bios, BIOS_SIZE) == BIOS_SIZE);
+    close(fd);
+
+    qts = qtest_initf("-machine pc -nodefaults -accel tcg -bios %s",
+                      bios_path);
+    unlink(bios_path);
+
+    return qts;
+}
+
+static char *test_profile_query(QTestState *qts, const char *format)
+{
+    QDict *ret;
+    char *text;
+
+    ret = qtest_qmp_assert_success_ref(qts,
+        "{'execute': 'x-query-tcg-profile', 'arguments': {'format': %s}}",
+        format);
+    text = g_strdup(qdict_get_str(ret, "human-readable-text"));
+    qobject_unref(ret);
+
+    return text;
+}
+
+static void test_profiler_sample(void)
+{
+    QTestState *qts = test_profiler_init();
+    g_autofree char *text = NULL;
+    g_autofree char *folded = NULL;
+    g_auto(GStrv) fields = NULL;
+    int i;
+
+    qtest_qmp_assert_success(qts,
+        "{'execute': 'x-tcg-profiler-start', 'arguments': {'interval': 100}}");
+
+    /* The vCPU spins on the reset vector, all samples are taken there */
+    for (i = 0; i < 1000; i++) {
+        folded = test_profile_query(qts, "folded");
+        if (*folded) {
+            break;
+        }
+        g_clear_pointer(&folded, g_free);
+        g_usleep(10 * 1000);
+    }
+    g_assert(folded);
+
+    qtest_qmp_assert_success(qts, "{'execute': 'x-tcg-profiler-stop'}");
+    g_free(folded);
+    folded = test_profile_query(qts, "folded");
+
+    /* A single line: mmu<index>;<pc>@<ram-addr> <count> */
+    fields = g_strsplit_set(g_strchomp(folded), ";@ ", -1);
+    g_assert_cmpuint(g_strv_length(fields), ==, 4);
+    g_assert(g_str_has_prefix(fields[0], "mmu"));
+    g_assert_cmpstr(fields[1], ==, RESET_VECTOR);
+    g_assert_cmpstr(fields[2], !=, "0xffffffffffffffff");
+    g_assert_cmpint(atoi(fields[3]), >, 0);
+
+    text = test_profile_query(qts, "text");
+    g_assert(strstr(text, "Profiler            stopped, interval 100 us\n"));
+    g_assert(strstr(text, "Distinct locations  1\n"));
+    g_assert(strstr(text, "ram-addr\n"));
+
+    qtest_quit(qts);
+}
+
+static void test_profiler_errors(void)
+{
+    QTestState *qts = test_profiler_init();
+
+    qobject_unref(qtest_qmp_assert_failure_ref(qts,
+        "{'execute': 'x-tcg-profiler-stop'}"));
+    qobject_unref(qtest_qmp_assert_failure_ref(qts,
+        "{'execute': 'x-tcg-profiler-start', 'arguments': {'interval': 0}}"));
+
+    qtest_qmp_assert_success(qts, "{'execute': 'x-tcg-profiler-start'}");
+    qobject_unref(qtest_qmp_assert_failure_ref(qts,
+        "{'execute': 'x-tcg-profiler-start'}"));
+    qtest_qmp_assert_success(qts, "{'execute': 'x-tcg-profiler-stop'}");
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return 0;
+    }
+
+    qtest_add_func("/tcg-profiler/sample", test_profiler_sample);
+    qtest_add_func("/tcg-profiler/errors", test_profiler_errors);
+
+    return g_test_run();
+}
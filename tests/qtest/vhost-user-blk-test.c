@@ -764,6 +764,109 @@ static void multiqueue(void *obj, void *data, QGuestAllocator *t_alloc)
     qpci_unplug_acpi_device_test(qts, "drv1", PCI_SLOT_HP);
 }
 
+/* Write @pattern to @sector through @vq and read it back */
+static void test_rw_vq(QVirtioDevice *dev, QGuestAllocator *alloc,
+                       QVirtQueue *vq, uint64_t sector, const char *pattern)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+    char *data;
+    QTestState *qts = global_qtest;
+
+    /* Write request */
+    req.type = VIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    strcpy(req.data, pattern);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    guest_free(alloc, req_addr);
+
+    /* Read request */
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    data = g_malloc0(512);
+    qtest_memread(qts, req_addr + 16, data, 512);
+    g_assert_cmpstr(data, ==, pattern);
+    g_free(data);
+
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * The export processes each virtqueue in its own iothread. Stop and restart
+ * the vrings a few times, with I/O on all virtqueues in between.
+ */
+static void iothreads(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVhostUserBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QVirtQueue *vq[2];
+    uint64_t features;
+    char pattern[16];
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        features = qvirtio_get_features(dev);
+        features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                        (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                        (1u << VIRTIO_RING_F_EVENT_IDX) |
+                        (1u << VIRTIO_BLK_F_SCSI));
+        qvirtio_set_features(dev, features);
+
+        for (j = 0; j < ARRAY_SIZE(vq); j++) {
+            vq[j] = qvirtqueue_setup(dev, t_alloc, j);
+        }
+        qvirtio_set_driver_ok(dev);
+
+        for (j = 0; j < ARRAY_SIZE(vq); j++) {
+            snprintf(pattern, sizeof(pattern), "TEST%d-%d", i, j);
+            test_rw_vq(dev, t_alloc, vq[j], j, pattern);
+        }
+
+        /* Resetting the device stops the vrings with GET_VRING_BASE */
+        qvirtio_start_device(dev);
+        for (j = 0; j < ARRAY_SIZE(vq); j++) {
+            qvirtqueue_cleanup(dev->bus, vq[j], t_alloc);
+        }
+    }
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -893,7 +996,7 @@ static void quit_storage_daemon(void *data)
 }
 
 static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
-                                 int num_queues)
+                                 int num_queues, int num_iothreads)
 {
     const char *vhost_user_blk_bin = qtest_qemu_storage_daemon_binary();
     int i;
@@ -909,8 +1012,13 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
             " -object memory-backend-memfd,id=mem,size=256M,share=on "
             " -M memory-backend=mem -m 256M ");
 
+    for (i = 0; i < num_iothreads; i++) {
+        g_string_append_printf(storage_daemon_command,
+                               "--object iothread,id=iothread%d ", i);
+    }
+
     for (i = 0; i < vus_instances; i++) {
-        int fd;
+        int fd, j;
         char *sock_path = create_listen_socket(&fd);
 
         /* create image file */
@@ -918,8 +1026,13 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
         g_string_append_printf(storage_daemon_command,
             "--blockdev driver=file,node-name=disk%d,filename=%s "
             "--export type=vhost-user-blk,id=disk%d,addr.type=fd,addr.str=%d,"
-            "node-name=disk%i,writable=on,num-queues=%d ",
+            "node-name=disk%i,writable=on,num-queues=%d",
             i, img_path, i, fd, i, num_queues);
+        for (j = 0; j < num_iothreads; j++) {
+            g_string_append_printf(storage_daemon_command,
+                                   ",iothreads.%d=iothread%d", j, j);
+        }
+        g_string_append_c(storage_daemon_command, ' ');
 
         g_string_append_printf(cmd_line, "-chardev socket,id=char%d,path=%s ",
                                i + 1, sock_path);
@@ -953,7 +1066,7 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
 
 static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 1, 1);
+    start_vhost_user_blk(cmd_line, 1, 1, 0);
     return arg;
 }
 
@@ -967,13 +1080,19 @@ static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 static void *vhost_user_blk_hotplug_test_setup(GString *cmd_line, void *arg)
 {
     /* "-chardev socket,id=char2" is used for pci_hotplug*/
-    start_vhost_user_blk(cmd_line, 2, 1);
+    start_vhost_user_blk(cmd_line, 2, 1, 0);
     return arg;
 }
 
 static void *vhost_user_blk_multiqueue_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 2, 8);
+    start_vhost_user_blk(cmd_line, 2, 8, 0);
+    return arg;
+}
+
+static void *vhost_user_blk_iothreads_test_setup(GString *cmd_line, void *arg)
+{
+    start_vhost_user_blk(cmd_line, 1, 2, 2);
     return arg;
 }
 
@@ -1009,6 +1128,10 @@ static void register_vhost_user_blk_test(void)
 
     opts.before = vhost_user_blk_multiqueue_test_setup;
     qos_add_test("multiqueue", "vhost-user-blk-pci", multiqueue, &opts);
+
+    opts.before = vhost_user_blk_iothreads_test_setup;
+    opts.edge.extra_device_opts = "num-queues=2";
+    qos_add_test("iothreads", "vhost-user-blk", iothreads, &opts);
 }
 
 libqos_init(register_vhost_user_blk_test);
@@ -0,0 +1,223 @@
+/*
+ * Test statx() and getdents64() against stat() and readdir().
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define NR_FILES 32
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct entry {
+    char name[64];
+    uint64_t ino;
+};
+
+static char dirname[] = "/tmp/.cstatxXXXXXX";
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return strcmp(((const struct entry *)a)->name,
+                  ((const struct entry *)b)->name);
+}
+
+/* Names of different lengths give records of different sizes */
+static void file_path(char *path, size_t size, int i)
+{
+    snprintf(path, size, "%s/%.*s%d", dirname, i,
+             "abcdefghijklmnopqrstuvwxyzabcdef", i);
+}
+
+static void create_files(void)
+{
+    char path[128];
+    int i, fd;
+
+    assert(mkdtemp(dirname));
+
+    for (i = 0; i < NR_FILES; i++) {
+        file_path(path, sizeof(path), i);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+        assert(fd != -1);
+        assert(ftruncate(fd, i * 1000) == 0);
+        assert(close(fd) == 0);
+    }
+}
+
+static void remove_files(void)
+{
+    char path[128];
+    int i;
+
+    for (i = 0; i < NR_FILES; i++) {
+        file_path(path, sizeof(path), i);
+        assert(unlink(path) == 0);
+    }
+    assert(rmdir(dirname) == 0);
+}
+
+static void check_statx(const char *path)
+{
+    struct statx stx;
+    struct stat st;
+
+    memset(&stx, 0xff, sizeof(stx));
+    assert(syscall(__NR_statx, AT_FDCWD, path, 0, STATX_BASIC_STATS,
+                   &stx) == 0);
+    assert(stat(path, &st) == 0);
+
+    assert((stx.stx_mask & STATX_BASIC_STATS) == STATX_BASIC_STATS);
+    assert(stx.stx_ino == st.st_ino);
+    assert(stx.stx_mode == st.st_mode);
+    assert(stx.stx_nlink == st.st_nlink);
+    assert(stx.stx_uid == st.st_uid);
+    assert(stx.stx_gid == st.st_gid);
+    assert(stx.stx_size == (uint64_t)st.st_size);
+    assert(stx.stx_blocks == (uint64_t)st.st_blocks);
+    assert(stx.stx_mtime.tv_sec == st.st_mtim.tv_sec);
+    assert(stx.stx_mtime.tv_nsec == st.st_mtim.tv_nsec);
+}
+
+static void test_statx(void)
+{
+    int pagesize = getpagesize();
+    char path[128];
+    char *page;
+    int i;
+
+    check_statx(dirname);
+    for (i = 0; i < NR_FILES; i++) {
+        file_path(path, sizeof(path), i);
+        check_statx(path);
+    }
+
+    /* A buffer that runs off the end of the mapping */
+    page = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE,
+                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    assert(page != MAP_FAILED);
+    assert(munmap(page + pagesize, pagesize) == 0);
+
+    errno = 0;
+    assert(syscall(__NR_statx, AT_FDCWD, dirname, 0, STATX_BASIC_STATS,
+                   page + pagesize - sizeof(struct statx) / 2) == -1);
+    assert(errno == EFAULT);
+    errno = 0;
+    assert(syscall(__NR_statx, AT_FDCWD, dirname, 0, STATX_BASIC_STATS,
+                   page + pagesize) == -1);
+    assert(errno == EFAULT);
+
+    assert(munmap(page, pagesize) == 0);
+}
+
+static int read_readdir(struct entry *entries, int max)
+{
+    struct dirent *de;
+    DIR *dir;
+    int n = 0;
+
+    dir = opendir(dirname);
+    assert(dir);
+    while ((de = readdir(dir))) {
+        assert(n < max);
+        assert(strlen(de->d_name) < sizeof(entries[n].name));
+        strcpy(entries[n].name, de->d_name);
+        entries[n].ino = de->d_ino;
+        n++;
+    }
+    assert(closedir(dir) == 0);
+
+    return n;
+}
+
+static int read_getdents64(struct entry *entries, int max, size_t bufsize)
+{
+    /* Keep the records 8-byte aligned, as the kernel does */
+    uint64_t buf[64];
+    int fd, off, n = 0;
+    long len;
+
+    assert(bufsize <= sizeof(buf));
+
+    fd = open(dirname, O_RDONLY | O_DIRECTORY);
+    assert(fd != -1);
+    while ((len = syscall(__NR_getdents64, fd, buf, bufsize)) > 0) {
+        assert((size_t)len <= bufsize);
+        for (off = 0; off < len; ) {
+            struct linux_dirent64 *de = (void *)((char *)buf + off);
+
+            assert(de->d_reclen % 8 == 0);
+            assert(off + de->d_reclen <= len);
+            assert(n < max);
+            assert(strlen(de->d_name) < sizeof(entries[n].name));
+            strcpy(entries[n].name, de->d_name);
+            entries[n].ino = de->d_ino;
+            n++;
+            off += de->d_reclen;
+        }
+    }
+    assert(len == 0);
+    assert(close(fd) == 0);
+
+    return n;
+}
+
+static void test_getdents64(void)
+{
+    struct entry expected[NR_FILES + 2], entries[NR_FILES + 2];
+    /* From one record per call up to the whole directory at once */
+    static const size_t bufsizes[] = { 64, 96, 256, 512 };
+    uint64_t buf[2];
+    size_t i;
+    int j, n, fd;
+
+    n = read_readdir(expected, NR_FILES + 2);
+    assert(n == NR_FILES + 2);
+    qsort(expected, n, sizeof(*expected), cmp_entry);
+
+    for (i = 0; i < sizeof(bufsizes) / sizeof(bufsizes[0]); i++) {
+        assert(read_getdents64(entries, NR_FILES + 2, bufsizes[i]) == n);
+        qsort(entries, n, sizeof(*entries), cmp_entry);
+        for (j = 0; j < n; j++) {
+            assert(strcmp(entries[j].name, expected[j].name) == 0);
+            assert(entries[j].ino == expected[j].ino);
+        }
+    }
+
+    /* A buffer too small for a single record */
+    fd = open(dirname, O_RDONLY | O_DIRECTORY);
+    assert(fd != -1);
+    errno = 0;
+    assert(syscall(__NR_getdents64, fd, buf, sizeof(buf)) == -1);
+    assert(errno == EINVAL);
+    assert(close(fd) == 0);
+}
+
+int main(void)
+{
+    create_files();
+    test_statx();
+    test_getdents64();
+    remove_files();
+
+    return EXIT_SUCCESS;
+}
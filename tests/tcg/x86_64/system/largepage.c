@@ -0,0 +1,111 @@
+/*
+ * Large page TLB invalidation test
+ *
+ * Map more 2 MiB pages than QEMU's large page TLB holds, touch a few
+ * small pages in each so that they are in the TLB, then remap the large
+ * pages one by one and invalidate them with invlpg.  The invalidated page
+ * must be walked again in its entirety, and the others must still
+ * translate to their frames.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       4096
+#define LARGE_PAGE_SIZE (2 * 1024 * 1024)
+/* More than the 8 entries of the large page TLB */
+#define NR_PAGES        12
+#define SMALL_PAGES     4
+
+/* The second page directory of boot.S maps 1-2 GiB */
+#define VIRT_BASE       (1UL << 30)
+/* Frames within the default 128 MiB of RAM, past the kernel */
+#define PHYS_BASE       (32UL << 20)
+/* Present, writable, user, accessed, dirty, large, as in boot.S */
+#define PDE_FLAGS       0xe7
+
+#define VIRT(i, k)      (VIRT_BASE + (i) * LARGE_PAGE_SIZE + (k) * PAGE_SIZE)
+/* Low memory is identity mapped */
+#define PHYS(p, k)      (PHYS_BASE + (p) * LARGE_PAGE_SIZE + (k) * PAGE_SIZE)
+#define TAG(p, k)       (0x1a600000 | (p) << 8 | (k))
+
+static uint64_t *get_pd(void)
+{
+    uint64_t cr3, *pml4, *pdpt;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    pml4 = (uint64_t *)(cr3 & ~0xfffUL);
+    pdpt = (uint64_t *)(pml4[0] & ~0xfffUL);
+    return (uint64_t *)(pdpt[1] & ~0xfffUL);
+}
+
+static void map_large_page(uint64_t *pd, int i, int p, int k)
+{
+    pd[i] = PHYS(p, 0) | PDE_FLAGS;
+    /* Any address within the large page invalidates all of it */
+    asm volatile("invlpg (%0)" : : "r"(VIRT(i, k)) : "memory");
+}
+
+static int check_large_page(int i, int p)
+{
+    int k;
+
+    for (k = 0; k < SMALL_PAGES; k++) {
+        uint32_t val = *(volatile uint32_t *)VIRT(i, k); /* via the TLB */
+
+        if (val != TAG(p, k)) {
+            ml_printf("FAIL: page %d.%d reads %x, expected %x\n",
+                      i, k, val, TAG(p, k));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    uint64_t *pd = get_pd();
+    int frame[NR_PAGES];
+    int spare = NR_PAGES;
+    int i, j, p, k;
+
+    ml_printf("Large page TLB invalidation test\n");
+
+    for (p = 0; p <= NR_PAGES; p++) {
+        for (k = 0; k < SMALL_PAGES; k++) {
+            *(volatile uint32_t *)PHYS(p, k) = TAG(p, k); /* read via alias */
+        }
+    }
+
+    for (i = 0; i < NR_PAGES; i++) {
+        frame[i] = i;
+        map_large_page(pd, i, i, 0);
+    }
+
+    /* Fill the TLB, the first large pages are evicted by the last ones */
+    for (i = 0; i < NR_PAGES; i++) {
+        if (check_large_page(i, frame[i])) {
+            return 1;
+        }
+    }
+
+    /* Move each large page to the spare frame in turn */
+    for (j = 0; j < NR_PAGES; j++) {
+        int old = frame[j];
+
+        map_large_page(pd, j, spare, j % SMALL_PAGES);
+        frame[j] = spare;
+        spare = old;
+
+        for (i = 0; i < NR_PAGES; i++) {
+            if (check_large_page(i, frame[i])) {
+                return 1;
+            }
+        }
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Block-status cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+
+#define TEST_CLUSTER_SIZE   65536
+#define TEST_CLUSTERS       16
+#define TEST_IMAGE_SIZE     (TEST_CLUSTERS * TEST_CLUSTER_SIZE)
+
+typedef struct BDRVTestState {
+    /* Whether each cluster holds data */
+    bool data[TEST_CLUSTERS];
+    /* Number of calls to .bdrv_co_block_status() */
+    int block_status_calls;
+    bool may_cache_zero;
+} BDRVTestState;
+
+static void bdrv_test_set_data(BlockDriverState *bs, int64_t offset,
+                               int64_t bytes, bool data)
+{
+    BDRVTestState *s = bs->opaque;
+    int64_t i;
+
+    for (i = offset / TEST_CLUSTER_SIZE;
+         i < DIV_ROUND_UP(offset + bytes, TEST_CLUSTER_SIZE); i++) {
+        s->data[i] = data;
+    }
+}
+
+static int coroutine_fn bdrv_test_co_preadv(BlockDriverState *bs,
+                                            int64_t offset, int64_t bytes,
+                                            QEMUIOVector *qiov,
+                                            BdrvRequestFlags flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwritev(BlockDriverState *bs,
+                                             int64_t offset, int64_t bytes,
+                                             QEMUIOVector *qiov,
+                                             BdrvRequestFlags flags)
+{
+    bdrv_test_set_data(bs, offset, bytes, true);
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pdiscard(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes)
+{
+    bdrv_test_set_data(bs, offset, bytes, false);
+    return 0;
+}
+
+static int64_t coroutine_fn bdrv_test_co_getlength(BlockDriverState *bs)
+{
+    return TEST_IMAGE_SIZE;
+}
+
+static int coroutine_fn bdrv_test_co_block_status(BlockDriverState *bs,
+                                                  bool want_zero,
+                                                  int64_t offset, int64_t count,
+                                                  int64_t *pnum, int64_t *map,
+                                                  BlockDriverState **file)
+{
+    BDRVTestState *s = bs->opaque;
+    int64_t cluster = offset / TEST_CLUSTER_SIZE;
+    int64_t end = cluster + 1;
+
+    s->block_status_calls++;
+
+    while (end < TEST_CLUSTERS && s->data[end] == s->data[cluster]) {
+        end++;
+    }
+
+    *pnum = end * TEST_CLUSTER_SIZE - offset;
+    *map = offset;
+    *file = bs;
+    return (s->data[cluster] ? BDRV_BLOCK_DATA : BDRV_BLOCK_ZERO) |
+           BDRV_BLOCK_OFFSET_VALID;
+}
+
+/* Like file-posix, don't cache holes of inactive images */
+static bool bdrv_test_block_status_may_cache_zero(BlockDriverState *bs)
+{
+    BDRVTestState *s = bs->opaque;
+
+    return s->may_cache_zero && !(bdrv_get_flags(bs) & BDRV_O_INACTIVE);
+}
+
+static BlockDriver bdrv_test = {
+    .format_name            = "test",
+    .instance_size          = sizeof(BDRVTestState),
+
+    .bdrv_co_preadv         = bdrv_test_co_preadv,
+    .bdrv_co_pwritev        = bdrv_test_co_pwritev,
+    .bdrv_co_pdiscard       = bdrv_test_co_pdiscard,
+    .bdrv_co_getlength      = bdrv_test_co_getlength,
+    .bdrv_co_block_status   = bdrv_test_co_block_status,
+
+    .bdrv_block_status_may_cache_zero = bdrv_test_block_status_may_cache_zero,
+};
+
+/*
+ * Create a test node with data in its first half, and a BlockBackend that
+ * shares @shared_perm on it.
+ */
+static BlockBackend *test_blk_new(uint64_t shared_perm, bool may_cache_zero)
+{
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    BDRVTestState *s;
+
+    blk = blk_new(qemu_get_aio_context(),
+                  BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, shared_perm);
+    bs = bdrv_new_open_driver(&bdrv_test, "test", BDRV_O_RDWR | BDRV_O_UNMAP,
+                              &error_abort);
+    blk_insert_bs(blk, bs, &error_abort);
+    bdrv_unref(bs);
+
+    s = bs->opaque;
+    s->may_cache_zero = may_cache_zero;
+    bdrv_test_set_data(bs, 0, TEST_IMAGE_SIZE / 2, true);
+
+    return blk;
+}
+
+static int test_block_status(BlockDriverState *bs, int64_t offset,
+                             int64_t *pnum)
+{
+    int ret;
+
+    ret = bdrv_block_status(bs, offset, TEST_IMAGE_SIZE - offset, pnum,
+                            NULL, NULL);
+    g_assert_cmpint(ret, >=, 0);
+    return ret & (BDRV_BLOCK_DATA | BDRV_BLOCK_ZERO);
+}
+
+static void test_cache_data(void)
+{
+    BlockBackend *blk = test_blk_new(BLK_PERM_CONSISTENT_READ, true);
+    BlockDriverState *bs = blk_bs(blk);
+    BDRVTestState *s = bs->opaque;
+    int64_t pnum;
+
+    g_assert_cmpint(test_block_status(bs, 0, &pnum), ==, BDRV_BLOCK_DATA);
+    g_assert_cmpint(pnum, ==, TEST_IMAGE_SIZE / 2);
+    g_assert_cmpint(s->block_status_calls, ==, 1);
+
+    /* Answered from the cache, even in the middle of the region */
+    g_assert_cmpint(test_block_status(bs, TEST_CLUSTER_SIZE, &pnum), ==,
+                    BDRV_BLOCK_DATA);
+    g_assert_cmpint(pnum, ==, TEST_IMAGE_SIZE / 2 - TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->block_status_calls, ==, 1);
+
+    /* A discard turns part of it into a hole */
+    g_assert_cmpint(blk_pdiscard(blk, TEST_CLUSTER_SIZE, TEST_CLUSTER_SIZE),
+                    ==, 0);
+    g_assert_cmpint(test_block_status(bs, TEST_CLUSTER_SIZE, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(pnum, ==, TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    /* The rest of the data region is still cached */
+    g_assert_cmpint(test_block_status(bs, 0, &pnum), ==, BDRV_BLOCK_DATA);
+    g_assert_cmpint(pnum, ==, TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    blk_unref(blk);
+}
+
+static void test_cache_zero(void)
+{
+    BlockBackend *blk = test_blk_new(BLK_PERM_CONSISTENT_READ, true);
+    BlockDriverState *bs = blk_bs(blk);
+    BDRVTestState *s = bs->opaque;
+    uint8_t buf[512] = { 0 };
+    int64_t pnum;
+
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(pnum, ==, TEST_IMAGE_SIZE / 2);
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(s->block_status_calls, ==, 1);
+
+    /* A write must invalidate the cached hole */
+    g_assert_cmpint(blk_pwrite(blk, TEST_IMAGE_SIZE - TEST_CLUSTER_SIZE,
+                               sizeof(buf), buf, 0), ==, 0);
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE - TEST_CLUSTER_SIZE,
+                                      &pnum), ==, BDRV_BLOCK_DATA);
+    g_assert_cmpint(pnum, ==, TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    /* Only the written cluster was dropped */
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(pnum, ==, TEST_IMAGE_SIZE / 2 - TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    blk_unref(blk);
+}
+
+/* Holes must not be cached if something else may fill them */
+static void test_no_cache_zero(bool shared_write, bool may_cache_zero)
+{
+    uint64_t shared_perm = BLK_PERM_CONSISTENT_READ |
+                           (shared_write ? BLK_PERM_WRITE : 0);
+    BlockBackend *blk = test_blk_new(shared_perm, may_cache_zero);
+    BlockDriverState *bs = blk_bs(blk);
+    BDRVTestState *s = bs->opaque;
+    int64_t pnum;
+
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(s->block_status_calls, ==, 1);
+
+    /* An external writer fills the hole */
+    bdrv_test_set_data(bs, TEST_IMAGE_SIZE / 2, TEST_CLUSTER_SIZE, true);
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_DATA);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    blk_unref(blk);
+}
+
+static void test_no_cache_zero_driver(void)
+{
+    test_no_cache_zero(false, false);
+}
+
+static void test_no_cache_zero_shared_write(void)
+{
+    test_no_cache_zero(true, true);
+}
+
+/* Someone else may write to the image while it is inactive */
+static void test_inactivate(void)
+{
+    BlockBackend *blk = test_blk_new(BLK_PERM_CONSISTENT_READ, true);
+    BlockDriverState *bs = blk_bs(blk);
+    BDRVTestState *s = bs->opaque;
+    int64_t pnum;
+
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(s->block_status_calls, ==, 1);
+
+    blk_set_force_allow_inactivate(blk);
+    g_assert_cmpint(bdrv_inactivate_all(), ==, 0);
+
+    /* Inactivation dropped the cached hole, and no new one is cached */
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(s->block_status_calls, ==, 2);
+
+    /* The other owner of the image, e.g. a migration peer, fills the hole */
+    bdrv_test_set_data(bs, TEST_IMAGE_SIZE / 2, TEST_CLUSTER_SIZE, true);
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_DATA);
+    g_assert_cmpint(s->block_status_calls, ==, 3);
+
+    /* Data cached while inactive may be stale too, e.g. after a discard */
+    bdrv_test_set_data(bs, TEST_IMAGE_SIZE / 2, TEST_CLUSTER_SIZE, false);
+    bdrv_activate_all(&error_abort);
+
+    g_assert_cmpint(test_block_status(bs, TEST_IMAGE_SIZE / 2, &pnum), ==,
+                    BDRV_BLOCK_ZERO);
+    g_assert_cmpint(pnum, ==, TEST_IMAGE_SIZE / 2);
+    g_assert_cmpint(s->block_status_calls, ==, 4);
+
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-status-cache/data", test_cache_data);
+    g_test_add_func("/block-status-cache/zero", test_cache_zero);
+    g_test_add_func("/block-status-cache/no-zero/driver",
+                    test_no_cache_zero_driver);
+    g_test_add_func("/block-status-cache/no-zero/shared-write",
+                    test_no_cache_zero_shared_write);
+    g_test_add_func("/block-status-cache/inactivate", test_inactivate);
+
+    return g_test_run();
+}
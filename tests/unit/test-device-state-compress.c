@@ -0,0 +1,176 @@
+/*
+ * Device state zero-run encoding unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "../migration/device-state-compress.h"
+
+/* These match migration/device-state-compress.c */
+#define ZERO_RUN_FLAG       0x80000000U
+#define ZERO_RUN_BLOCK      64
+#define ZERO_RUN_MAX_LEN    (1U << 30)
+
+/* Encode @len bytes of @in and check that they decode to the same data */
+static size_t encode_decode(const uint8_t *in, size_t len, uint8_t **out)
+{
+    g_autofree uint8_t *decoded = g_malloc(len + 1);
+    size_t out_len;
+
+    *out = g_malloc(zero_run_encode_bound(len));
+    out_len = zero_run_encode(in, len, *out);
+    g_assert_cmpuint(out_len, <=, zero_run_encode_bound(len));
+
+    g_assert_cmpint(zero_run_decode(*out, out_len, decoded, len), ==, 0);
+    g_assert(!memcmp(in, decoded, len));
+
+    return out_len;
+}
+
+static void test_encode_decode(void)
+{
+    size_t len = 16 * ZERO_RUN_BLOCK;
+    g_autofree uint8_t *in = g_malloc0(len);
+    g_autofree uint8_t *out = NULL;
+    size_t out_len;
+    int i;
+
+    /* Nothing to encode */
+    out_len = encode_decode(in, 0, &out);
+    g_assert_cmpuint(out_len, ==, 0);
+    g_free(out);
+
+    /* A single run of zeroes */
+    out_len = encode_decode(in, len, &out);
+    g_assert_cmpuint(out_len, ==, sizeof(uint32_t));
+    g_assert_cmphex(ldl_be_p(out), ==, len | ZERO_RUN_FLAG);
+    g_free(out);
+
+    /* A single run of data */
+    for (i = 0; i < len; i++) {
+        in[i] = i | 1;
+    }
+    out_len = encode_decode(in, len, &out);
+    g_assert_cmpuint(out_len, ==, sizeof(uint32_t) + len);
+    g_assert_cmphex(ldl_be_p(out), ==, len);
+    g_free(out);
+
+    /* Random data with runs of zeroes in between */
+    for (i = 0; i < len / ZERO_RUN_BLOCK; i++) {
+        if (g_test_rand_bit()) {
+            memset(in + i * ZERO_RUN_BLOCK, 0, ZERO_RUN_BLOCK);
+        } else {
+            in[i * ZERO_RUN_BLOCK + g_test_rand_int_range(0, ZERO_RUN_BLOCK)] =
+                g_test_rand_int_range(1, 256);
+        }
+    }
+    encode_decode(in, len, &out);
+}
+
+static void test_encode_decode_partial_block(void)
+{
+    size_t len = 3 * ZERO_RUN_BLOCK + 5;
+    g_autofree uint8_t *in = g_malloc0(len);
+    g_autofree uint8_t *out = NULL;
+    size_t out_len;
+
+    /* zeroes, data, zeroes, and 5 bytes of data in the last block */
+    memset(in + ZERO_RUN_BLOCK, 0xaa, ZERO_RUN_BLOCK);
+    memset(in + 3 * ZERO_RUN_BLOCK, 0x55, 5);
+
+    out_len = encode_decode(in, len, &out);
+    g_assert_cmpuint(out_len, ==, 4 * sizeof(uint32_t) + ZERO_RUN_BLOCK + 5);
+    g_assert_cmphex(ldl_be_p(out), ==, ZERO_RUN_BLOCK | ZERO_RUN_FLAG);
+    g_assert_cmphex(ldl_be_p(out + 4), ==, ZERO_RUN_BLOCK);
+    g_assert_cmphex(ldl_be_p(out + 8 + ZERO_RUN_BLOCK), ==,
+                    ZERO_RUN_BLOCK | ZERO_RUN_FLAG);
+    g_assert_cmphex(ldl_be_p(out + 12 + ZERO_RUN_BLOCK), ==, 5);
+    g_free(out);
+
+    /* A trailing partial block of zeroes joins the previous run */
+    memset(in + 3 * ZERO_RUN_BLOCK, 0, 5);
+    out_len = encode_decode(in, len, &out);
+    g_assert_cmpuint(out_len, ==, 3 * sizeof(uint32_t) + ZERO_RUN_BLOCK);
+    g_assert_cmphex(ldl_be_p(out + 8 + ZERO_RUN_BLOCK), ==,
+                    (2 * ZERO_RUN_BLOCK + 5) | ZERO_RUN_FLAG);
+}
+
+static void test_encode_long_run(void)
+{
+    size_t len = ZERO_RUN_MAX_LEN + ZERO_RUN_BLOCK;
+    g_autofree uint8_t *in = g_try_malloc0(len);
+    g_autofree uint8_t *decoded = NULL;
+    /* Only the headers are written for zeroes */
+    uint8_t out[2 * sizeof(uint32_t)];
+
+    if (!in) {
+        g_test_skip("not enough memory");
+        return;
+    }
+
+    g_assert_cmpuint(zero_run_encode(in, len, out), ==, sizeof(out));
+    g_assert_cmphex(ldl_be_p(out), ==, ZERO_RUN_MAX_LEN | ZERO_RUN_FLAG);
+    g_assert_cmphex(ldl_be_p(out + 4), ==, ZERO_RUN_BLOCK | ZERO_RUN_FLAG);
+
+    /* Decoding writes all of it, which is slow */
+    if (g_test_slow()) {
+        decoded = g_malloc(len);
+        g_assert_cmpint(zero_run_decode(out, sizeof(out), decoded, len), ==, 0);
+        g_assert(buffer_is_zero(decoded, len));
+    }
+}
+
+static void test_decode_invalid(void)
+{
+    size_t len = 2 * ZERO_RUN_BLOCK + 5;
+    g_autofree uint8_t *in = g_malloc0(len);
+    g_autofree uint8_t *decoded = g_malloc(len + 1);
+    g_autofree uint8_t *out = NULL;
+    size_t out_len;
+
+    /* zeroes, data, and 5 bytes of data in the last block */
+    memset(in + ZERO_RUN_BLOCK, 0xaa, ZERO_RUN_BLOCK + 5);
+    out_len = encode_decode(in, len, &out);
+    g_assert_cmpuint(out_len, ==, 2 * sizeof(uint32_t) + ZERO_RUN_BLOCK + 5);
+
+    /* Truncated in the data of a run */
+    g_assert_cmpint(zero_run_decode(out, out_len - 1, decoded, len), ==,
+                    -EINVAL);
+    /* Truncated in a header */
+    g_assert_cmpint(zero_run_decode(out, 2, decoded, len), ==, -EINVAL);
+    /* Decodes to less than expected */
+    g_assert_cmpint(zero_run_decode(out, sizeof(uint32_t), decoded, len), ==,
+                    -EINVAL);
+    g_assert_cmpint(zero_run_decode(out, out_len, decoded, len + 1), ==,
+                    -EINVAL);
+    /* Decodes to more than expected */
+    g_assert_cmpint(zero_run_decode(out, out_len, decoded, len - 1), ==,
+                    -EINVAL);
+
+    /* A run of zeroes past the end of the output */
+    stl_be_p(out, (len + 1) | ZERO_RUN_FLAG);
+    g_assert_cmpint(zero_run_decode(out, sizeof(uint32_t), decoded, len), ==,
+                    -EINVAL);
+    /* A run of data longer than the input */
+    stl_be_p(out, len);
+    g_assert_cmpint(zero_run_decode(out, out_len, decoded, len), ==, -EINVAL);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/device-state-compress/zero-run/encode_decode",
+                    test_encode_decode);
+    g_test_add_func("/device-state-compress/zero-run/partial_block",
+                    test_encode_decode_partial_block);
+    g_test_add_func("/device-state-compress/zero-run/long_run",
+                    test_encode_long_run);
+    g_test_add_func("/device-state-compress/zero-run/decode_invalid",
+                    test_decode_invalid);
+
+    return g_test_run();
+}
@@ -1042,6 +1042,94 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+static void test_hbitmap_dirty_areas_check(TestHBitmapData *data,
+                                           int64_t start, int64_t end,
+                                           size_t max_areas)
+{
+    g_autofree HBitmapRange *areas = g_new(HBitmapRange, max_areas);
+    int64_t offset = start;
+    int64_t dirty_start, dirty_count;
+    size_t i, n;
+
+    do {
+        n = hbitmap_dirty_areas(data->hb, offset, end, areas, max_areas);
+        g_assert_cmpint(n, <=, max_areas);
+        for (i = 0; i < n; i++) {
+            g_assert_true(hbitmap_next_dirty_area(data->hb, offset, end,
+                                                  INT64_MAX, &dirty_start,
+                                                  &dirty_count));
+            g_assert_cmpint(areas[i].start, ==, dirty_start);
+            g_assert_cmpint(areas[i].count, ==, dirty_count);
+            offset = dirty_start + dirty_count;
+        }
+    } while (n == max_areas);
+
+    g_assert_false(hbitmap_next_dirty_area(data->hb, offset, end, INT64_MAX,
+                                           &dirty_start, &dirty_count));
+}
+
+static void test_hbitmap_dirty_areas_do(TestHBitmapData *data,
+                                        int granularity)
+{
+    hbitmap_test_init(data, L3, granularity);
+    test_hbitmap_dirty_areas_check(data, 0, INT64_MAX, 1);
+
+    hbitmap_set(data->hb, L2, 1);
+    hbitmap_set(data->hb, L2 + 5, L1);
+    hbitmap_set(data->hb, L2 + L1 * 2, L1 * 3);
+    hbitmap_set(data->hb, L2 * 2 + 3, 1);
+    hbitmap_set(data->hb, L2 * 3 - 1, L2 + 2);
+    test_hbitmap_dirty_areas_check(data, 0, INT64_MAX, 1);
+    test_hbitmap_dirty_areas_check(data, 0, INT64_MAX, 2);
+    test_hbitmap_dirty_areas_check(data, 0, INT64_MAX, 16);
+    test_hbitmap_dirty_areas_check(data, L2 + 1, L2 + 7, 1);
+    test_hbitmap_dirty_areas_check(data, L2 + 6, L2 + L1 * 3, 2);
+    test_hbitmap_dirty_areas_check(data, L2 * 3, L2 * 3 + L1, 2);
+    test_hbitmap_dirty_areas_check(data, L2 * 3 - 2, L3, 16);
+
+    hbitmap_set(data->hb, 0, L3);
+    test_hbitmap_dirty_areas_check(data, 0, INT64_MAX, 1);
+    test_hbitmap_dirty_areas_check(data, L1 + 1, L3 - 1, 1);
+}
+
+static void test_hbitmap_dirty_areas_0(TestHBitmapData *data,
+                                       const void *unused)
+{
+    test_hbitmap_dirty_areas_do(data, 0);
+}
+
+static void test_hbitmap_dirty_areas_4(TestHBitmapData *data,
+                                       const void *unused)
+{
+    test_hbitmap_dirty_areas_do(data, 4);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data, const void *unused)
+{
+    HBitmap *hb = hbitmap_alloc(L3, 0);
+    HBitmap *sparse = hbitmap_alloc(L3, 2);
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, L2 - 3, L1 + 7);
+    hbitmap_test_set(data, L2 * 5, L2 * 3);
+
+    hbitmap_set(hb, L2, L1);
+    hbitmap_set(hb, L3 - L1, L1);
+    hbitmap_merge(data->hb, hb, data->hb);
+    bitmap_set(data->bits, L2, L1);
+    bitmap_set(data->bits, L3 - L1, L1);
+    hbitmap_test_check(data, 0);
+
+    /* Different granularities use hbitmap_dirty_areas() */
+    hbitmap_set(sparse, L2 * 10 + 8, 1);
+    hbitmap_merge(data->hb, sparse, data->hb);
+    bitmap_set(data->bits, L2 * 10 + 8, 4);
+    hbitmap_test_check(data, 0);
+
+    hbitmap_free(sparse);
+    hbitmap_free(hb);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1113,6 +1201,13 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    hbitmap_test_add("/hbitmap/dirty_areas/dirty_areas_0",
+                     test_hbitmap_dirty_areas_0);
+    hbitmap_test_add("/hbitmap/dirty_areas/dirty_areas_4",
+                     test_hbitmap_dirty_areas_4);
+
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+
     g_test_run();
 
     return 0;
@@ -801,6 +801,188 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+static void test_group_weights(void)
+{
+    BlockBackend *blk1, *blk2;
+    ThrottleGroupMember *tgm1, *tgm2;
+    BlockStatsSpecificThrottle stats1, stats2;
+
+    /* No actual I/O is performed on these devices */
+    blk1 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    blk2 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+
+    tgm1 = &blk_get_public(blk1)->throttle_group_member;
+    tgm2 = &blk_get_public(blk2)->throttle_group_member;
+
+    throttle_group_register_tgm(tgm1, "weighted", blk_get_aio_context(blk1));
+    throttle_group_register_tgm(tgm2, "weighted", blk_get_aio_context(blk2));
+
+    /* New members get the default weight */
+    throttle_group_get_member_stats(tgm1, &stats1);
+    g_assert(stats1.scheduler == THROTTLE_GROUP_SCHEDULER_ROUND_ROBIN);
+    g_assert_cmpuint(stats1.weight, ==, THROTTLE_GROUP_DEFAULT_WEIGHT);
+    g_assert(!stats1.has_latency_target);
+    g_assert(stats1.share == 0.5);
+    g_assert(stats1.usage == 0);
+    g_assert_cmpuint(stats1.queue_depth_read, ==, 0);
+    g_assert_cmpuint(stats1.queue_depth_write, ==, 0);
+
+    /* The shares follow the weights */
+    throttle_group_set_weight(tgm1, 300, 2 * SCALE_MS);
+    throttle_group_get_member_stats(tgm1, &stats1);
+    throttle_group_get_member_stats(tgm2, &stats2);
+    g_assert_cmpuint(stats1.weight, ==, 300);
+    g_assert(stats1.has_latency_target);
+    g_assert_cmpuint(stats1.latency_target, ==, 2000);
+    g_assert(stats1.share == 0.75);
+    g_assert(stats2.share == 0.25);
+
+    throttle_group_unregister_tgm(tgm1);
+    throttle_group_unregister_tgm(tgm2);
+}
+
+/* A member of a throttle group, and the requests that the test issued on it */
+typedef struct TestMember {
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm;
+    unsigned queued;
+    unsigned dispatched;
+} TestMember;
+
+/*
+ * Create a throttle group with the weighted scheduler and a limit of
+ * 1000 IOPS, and two members of it.
+ */
+static Object *test_weighted_group_new(const char *name,
+                                       TestMember *m1, TestMember *m2)
+{
+    TestMember *members[] = { m1, m2 };
+    ThrottleConfig cfg1;
+    Object *group;
+    BlockBackend *blk;
+    unsigned i;
+
+    group = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                  object_get_objects_root(), name,
+                                  &error_abort, "scheduler", "weighted",
+                                  NULL);
+
+    for (i = 0; i < ARRAY_SIZE(members); i++) {
+        blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+        *members[i] = (TestMember) {
+            .blk = blk,
+            .tgm = &blk_get_public(blk)->throttle_group_member,
+        };
+        throttle_group_register_tgm(members[i]->tgm, name, ctx);
+    }
+
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_TOTAL].avg = 1000;
+    throttle_group_config(m1->tgm, &cfg1);
+
+    return group;
+}
+
+static void test_weighted_group_free(Object *group,
+                                     TestMember *m1, TestMember *m2)
+{
+    /* Let all queued requests run before leaving the group */
+    while (m1->dispatched < m1->queued || m2->dispatched < m2->queued) {
+        aio_poll(ctx, true);
+    }
+
+    throttle_group_unregister_tgm(m1->tgm);
+    throttle_group_unregister_tgm(m2->tgm);
+    blk_unref(m1->blk);
+    blk_unref(m2->blk);
+    object_unparent(group);
+}
+
+static void coroutine_fn test_member_read_entry(void *opaque)
+{
+    TestMember *m = opaque;
+
+    throttle_group_co_io_limits_intercept(m->tgm, 4096, THROTTLE_READ);
+    m->dispatched++;
+}
+
+/* Issue @count requests, those that are not throttled run immediately */
+static void test_member_submit(TestMember *m, unsigned count)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++) {
+        Coroutine *co = qemu_coroutine_create(test_member_read_entry, m);
+
+        m->queued++;
+        qemu_coroutine_enter(co);
+    }
+}
+
+static void test_group_weighted_share(void)
+{
+    TestMember m1, m2;
+    Object *group;
+    unsigned i, start1, start2;
+
+    group = test_weighted_group_new("weighted-share", &m1, &m2);
+    throttle_group_set_weight(m1.tgm, 2 * THROTTLE_GROUP_DEFAULT_WEIGHT, 0);
+
+    /*
+     * The first requests use up the burst of the group, the others are
+     * throttled.  Both members keep requests queued for the whole test.
+     */
+    for (i = 0; i < 150; i++) {
+        test_member_submit(&m1, 1);
+        test_member_submit(&m2, 1);
+    }
+    g_assert_cmpuint(m1.dispatched, <, m1.queued);
+    g_assert_cmpuint(m2.dispatched, <, m2.queued);
+
+    /* Under contention, the member with twice the weight runs twice as often */
+    start1 = m1.dispatched;
+    start2 = m2.dispatched;
+    while (m1.dispatched + m2.dispatched < start1 + start2 + 90) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpuint(m1.dispatched, <, m1.queued);
+    g_assert_cmpuint(m2.dispatched, <, m2.queued);
+    g_assert_cmpuint(m1.dispatched - start1, >=, 56);
+    g_assert_cmpuint(m1.dispatched - start1, <=, 64);
+
+    test_weighted_group_free(group, &m1, &m2);
+}
+
+static void test_group_latency_target(void)
+{
+    TestMember m1, m2;
+    Object *group;
+    int64_t start;
+
+    group = test_weighted_group_new("weighted-latency", &m1, &m2);
+    throttle_group_set_weight(m1.tgm, THROTTLE_GROUP_MAX_WEIGHT, 0);
+    throttle_group_set_weight(m2.tgm, 1, 20 * SCALE_MS);
+
+    test_member_submit(&m1, 200);
+    g_assert_cmpuint(m1.dispatched, <, m1.queued);
+
+    /*
+     * The weights alone would make the second and third request of m2 wait
+     * until all requests of m1 have run.  The latency target lets them run
+     * once they have waited 20 ms.
+     */
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    test_member_submit(&m2, 3);
+    while (m2.dispatched < m2.queued) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start, >=,
+                    20 * SCALE_MS);
+    g_assert_cmpuint(m1.dispatched, <, m1.queued);
+
+    test_weighted_group_free(group, &m1, &m2);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -830,6 +1012,11 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/group_weights",      test_group_weights);
+    g_test_add_func("/throttle/group_weighted_share",
+                    test_group_weighted_share);
+    g_test_add_func("/throttle/group_latency_target",
+                    test_group_latency_target);
     return g_test_run();
 }
 
@@ -50,8 +50,16 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * Operations that have to look at every word of the last level (scanning for
+ * zero bits, merging, serialization) process the words in blocks of
+ * HBITMAP_SCAN_WORDS with straight-line code that the compiler can vectorize,
+ * and the count of set bits is updated in the same pass that modifies the
+ * words.
  */
 
+#define HBITMAP_SCAN_WORDS 8
+
 struct HBitmap {
     /*
      * Size of the bitmap, as requested in hbitmap_alloc or in hbitmap_truncate.
@@ -217,6 +225,32 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
     return MAX(start, first_dirty_off);
 }
 
+/*
+ * Return the index of the first word in [@pos, @end) that has a zero bit,
+ * or @end if there is none.
+ */
+static uint64_t hb_find_not_full(const unsigned long *words, uint64_t pos,
+                                 uint64_t end)
+{
+    while (end - pos >= HBITMAP_SCAN_WORDS) {
+        unsigned long acc = ~0UL;
+        int i;
+
+        for (i = 0; i < HBITMAP_SCAN_WORDS; i++) {
+            acc &= words[pos + i];
+        }
+        if (acc != ~0UL) {
+            break;
+        }
+        pos += HBITMAP_SCAN_WORDS;
+    }
+
+    while (pos < end && words[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
@@ -245,10 +279,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_not_full(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -408,10 +439,82 @@ static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
     return count;
 }
 
+size_t hbitmap_dirty_areas(const HBitmap *hb, int64_t start, int64_t end,
+                           HBitmapRange *areas, size_t max_areas)
+{
+    HBitmapIter hbi;
+    uint64_t end_bit, run_start = 0, run_end = 0;
+    bool open = false;
+    size_t n = 0;
+
+    assert(start >= 0 && end >= 0);
+
+    end = MIN(end, hb->orig_size);
+    if (start >= end || max_areas == 0) {
+        return 0;
+    }
+    end_bit = ((end - 1) >> hb->granularity) + 1;
+
+    /*
+     * Extract the runs of set bits from each nonzero word, merging them
+     * across word boundaries.  Stop when a run starts past @end or when all
+     * of @areas are used, but always complete the last run.
+     */
+    hbitmap_iter_init(&hbi, hb, start);
+    for (;;) {
+        unsigned long cur;
+        uint64_t base = (uint64_t)hbitmap_iter_next_word(&hbi, &cur)
+                        << BITS_PER_LEVEL;
+
+        if (cur == 0 || base >= end_bit) {
+            break;
+        }
+
+        while (cur) {
+            unsigned bit = ctzl(cur);
+            unsigned len = ctol(cur >> bit);
+
+            cur = bit + len < BITS_PER_LONG ? cur & (~0UL << (bit + len)) : 0;
+            if (open && run_end == base + bit) {
+                run_end += len;
+                continue;
+            }
+            if (open) {
+                areas[n].start = MAX(run_start << hb->granularity, start);
+                areas[n].count = MIN(run_end << hb->granularity, end) -
+                                 areas[n].start;
+                open = false;
+                if (++n == max_areas) {
+                    return n;
+                }
+            }
+            if (base + bit >= end_bit) {
+                return n;
+            }
+            run_start = base + bit;
+            run_end = run_start + len;
+            open = true;
+        }
+
+        if (open && run_end >= end_bit) {
+            break;
+        }
+    }
+
+    if (open) {
+        areas[n].start = MAX(run_start << hb->granularity, start);
+        areas[n].count = MIN(run_end << hb->granularity, end) -
+                         areas[n].start;
+        n++;
+    }
+    return n;
+}
+
 /* Setting starts at the last layer and propagates up if an element
- * changes.
+ * changes.  The number of bits that were newly set is added to @count.
  */
-static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline bool hb_set_elem(unsigned long *elem, uint64_t start,
+                               uint64_t last, uint64_t *count)
 {
     unsigned long mask;
     unsigned long old;
@@ -423,40 +526,52 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     old = *elem;
     *elem |= mask;
+    *count += ctpopl(mask & ~old);
     return old != *elem;
 }
 
-/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
+/*
+ * The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
+ * Returns true if at least one bit is changed.  The number of bits that
+ * were set in level @level is added to @count.
+ */
 static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
-                           uint64_t last)
+                           uint64_t last, uint64_t *count)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
+    uint64_t upper_count = 0;
     size_t i;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        uint64_t was_set = 0;
+
+        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1, count);
         for (;;) {
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
+            if (hb->levels[level][i]) {
+                was_set += ctpopl(hb->levels[level][i]);
+            } else {
+                changed = true;
+            }
             hb->levels[level][i] = ~0UL;
         }
+        *count += (lastpos - pos - 1) * BITS_PER_LONG - was_set;
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(&hb->levels[level][i], start, last, count);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
      */
     if (level > 0 && changed) {
-        hb_set_between(hb, level - 1, pos, lastpos);
+        hb_set_between(hb, level - 1, pos, lastpos, &upper_count);
     }
     return changed;
 }
@@ -464,7 +579,7 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 {
     /* Compute range in the last layer.  */
-    uint64_t first, n;
+    uint64_t first;
     uint64_t last = start + count - 1;
 
     if (count == 0) {
@@ -477,19 +592,19 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     first = start >> hb->granularity;
     last >>= hb->granularity;
     assert(last < hb->size);
-    n = last - first + 1;
 
-    hb->count += n - hb_count_between(hb, first, last);
-    if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last) &&
+    if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last, &hb->count) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
 }
 
 /* Resetting works the other way round: propagate up if the new
- * value is zero.
+ * value is zero.  The number of bits that were cleared is subtracted
+ * from @count.
  */
-static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline bool hb_reset_elem(unsigned long *elem, uint64_t start,
+                                 uint64_t last, uint64_t *count)
 {
     unsigned long mask;
     bool blanked;
@@ -500,18 +615,23 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
+    *count -= ctpopl(*elem & mask);
     *elem &= ~mask;
     return blanked;
 }
 
-/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
+/*
+ * The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
+ * Returns true if at least one bit is changed.  The number of bits that
+ * were cleared in level @level is subtracted from @count.
+ */
 static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
-                             uint64_t last)
+                             uint64_t last, uint64_t *count)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
+    uint64_t upper_count = 0;
     size_t i;
 
     i = pos;
@@ -523,7 +643,9 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        uint64_t was_set = 0;
+
+        if (hb_reset_elem(&hb->levels[level][i], start, next - 1, count)) {
             changed = true;
         } else {
             pos++;
@@ -535,20 +657,24 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
+            if (hb->levels[level][i]) {
+                was_set += ctpopl(hb->levels[level][i]);
+                changed = true;
+            }
             hb->levels[level][i] = 0UL;
         }
+        *count -= was_set;
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(&hb->levels[level][i], start, last, count)) {
         changed = true;
     } else {
         lastpos--;
     }
 
     if (level > 0 && changed) {
-        hb_reset_between(hb, level - 1, pos, lastpos);
+        hb_reset_between(hb, level - 1, pos, lastpos, &upper_count);
     }
 
     return changed;
@@ -576,8 +702,7 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     last >>= hb->granularity;
     assert(last < hb->size);
 
-    hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
+    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last, &hb->count) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
@@ -682,6 +807,12 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    /* The serialized format is the in-memory layout of little endian hosts */
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(buf, cur, el_count * sizeof(unsigned long));
+        return;
+    }
+
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -705,6 +836,11 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(cur, buf, el_count * sizeof(unsigned long));
+        cur = end;
+    }
+
     while (cur != end) {
         memcpy(cur, buf, sizeof(*cur));
 
@@ -880,16 +1016,42 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
  */
 static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 {
-    int64_t offset;
-    int64_t count;
+    HBitmapRange areas[64];
+    int64_t offset = 0;
+    size_t i, n;
+
+    while ((n = hbitmap_dirty_areas(src, offset, src->orig_size,
+                                    areas, ARRAY_SIZE(areas)))) {
+        for (i = 0; i < n; i++) {
+            hbitmap_set(dst, areas[i].start, areas[i].count);
+        }
+        offset = areas[n - 1].start + areas[n - 1].count;
+    }
+}
+
+/*
+ * Compute @dst = @a | @b over @n words and return the number of bits set
+ * in @dst.  @dst may alias @a or @b.
+ */
+static uint64_t hb_or_words(unsigned long *dst, const unsigned long *a,
+                            const unsigned long *b, uint64_t n)
+{
+    uint64_t count = 0;
+    uint64_t j = 0;
 
-    for (offset = 0;
-         hbitmap_next_dirty_area(src, offset, src->orig_size, INT64_MAX,
-                                 &offset, &count);
-         offset += count)
-    {
-        hbitmap_set(dst, offset, count);
+    for (; n - j >= HBITMAP_SCAN_WORDS; j += HBITMAP_SCAN_WORDS) {
+        int k;
+
+        for (k = 0; k < HBITMAP_SCAN_WORDS; k++) {
+            dst[j + k] = a[j + k] | b[j + k];
+            count += ctpopl(dst[j + k]);
+        }
     }
+    for (; j < n; j++) {
+        dst[j] = a[j] | b[j];
+        count += ctpopl(dst[j]);
+    }
+    return count;
 }
 
 /**
@@ -901,7 +1063,6 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -932,16 +1093,17 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * The dirty count is recomputed while merging the last level.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
-        }
+    result->count = hb_or_words(result->levels[HBITMAP_LEVELS - 1],
+                                a->levels[HBITMAP_LEVELS - 1],
+                                b->levels[HBITMAP_LEVELS - 1],
+                                a->sizes[HBITMAP_LEVELS - 1]);
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
+        hb_or_words(result->levels[i], a->levels[i], b->levels[i],
+                    a->sizes[i]);
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -27,7 +27,19 @@
  * protocol messages over the UNIX domain socket.
  *
  * When virtqueues are set up libvhost-user calls set_watch() to monitor kick
- * fds. These fds are also handled in the VuServer->ctx AioContext.
+ * fds. These fds are also handled in the VuServer->ctx AioContext, or in the
+ * virtqueue's AioContext if VuServer->queue_ctx is set. In the latter case
+ * virtqueues are processed in parallel by several threads. libvhost-user
+ * keeps the state of each virtqueue separate, so this only requires that the
+ * device's virtqueue handlers do not share state between queues either.
+ *
+ * The virtqueues and the guest memory table are changed by vhost-user
+ * messages in vu_client_trip(), however. Before such a message is handled,
+ * vu_queues_quiesce() stops monitoring the kick fds in each virtqueue's
+ * AioContext, from that AioContext so that no kick_handler() is still running,
+ * and waits for the requests that are in flight. vu_queues_resume() monitors
+ * the kick fds again when the next message is read. remove_watch() quiesces
+ * the virtqueues in the same way before it frees a VuFdWatch.
  *
  * Both vu_client_trip() and kick fd monitoring can be stopped by shutting down
  * the socket connection. Shutting down the socket connection causes
@@ -77,14 +89,15 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
-    assert(!server->wait_idle);
+    assert(!qatomic_read(&server->wait_idle));
     qatomic_inc(&server->in_flight);
 }
 
 void vhost_user_server_dec_in_flight(VuServer *server)
 {
     if (qatomic_fetch_dec(&server->in_flight) == 1) {
-        if (server->wait_idle) {
+        /* Requests may complete in any queue AioContext, wake only once */
+        if (qatomic_xchg(&server->wait_idle, false)) {
             aio_co_wake(server->co_trip);
         }
     }
@@ -95,6 +108,150 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+/* Wait for requests to complete, called from vu_client_trip() */
+static void coroutine_fn vu_wait_idle(VuServer *server)
+{
+    qatomic_set(&server->wait_idle, true);
+
+    /* Pairs with qatomic_fetch_dec() in vhost_user_server_dec_in_flight() */
+    smp_mb();
+
+    /*
+     * If the last request completed in the meantime and took wait_idle, it
+     * has woken or is about to wake us.
+     */
+    if (vhost_user_server_has_in_flight(server) ||
+        !qatomic_xchg(&server->wait_idle, false)) {
+        qemu_coroutine_yield();
+    }
+    assert(!vhost_user_server_has_in_flight(server));
+}
+
+/*
+ * a wrapper for vu_kick_cb
+ *
+ * since aio_dispatch can only pass one user data pointer to the
+ * callback function, pack VuDev and pvt into a struct. Then unpack it
+ * and pass them to vu_kick_cb
+ */
+static void kick_handler(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+    VuDev *vu_dev = vu_fd_watch->vu_dev;
+
+    vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
+
+    /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
+    if (vu_dev->broken) {
+        VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+
+        qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    }
+}
+
+typedef struct {
+    VuServer *server;
+    AioContext *ctx;
+    Coroutine *co;
+} VuQueueCtxDetach;
+
+static void vu_queue_ctx_detach_bh(void *opaque)
+{
+    VuQueueCtxDetach *data = opaque;
+    VuFdWatch *vu_fd_watch;
+
+    QTAILQ_FOREACH(vu_fd_watch, &data->server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx == data->ctx) {
+            aio_set_fd_handler(data->ctx, vu_fd_watch->fd,
+                               NULL, NULL, NULL, NULL, NULL);
+        }
+    }
+    aio_co_wake(data->co);
+}
+
+/*
+ * Stop virtqueue processing in the queue AioContexts so that libvhost-user
+ * can change the virtqueues and the memory table, or so that a VuFdWatch can
+ * be freed. The kick fds are detached from within each AioContext, which
+ * guarantees that kick_handler() has returned there, and the requests that
+ * are in flight are completed.
+ */
+static void coroutine_fn vu_queues_quiesce(VuServer *server)
+{
+    int i, j;
+
+    if (!server->queue_ctx || server->queues_quiesced) {
+        return;
+    }
+    server->queues_quiesced = true;
+
+    for (i = 0; i < server->max_queues; i++) {
+        VuQueueCtxDetach data = {
+            .server = server,
+            .ctx = server->queue_ctx[i],
+            .co = qemu_coroutine_self(),
+        };
+
+        /* Several virtqueues may share an AioContext */
+        for (j = 0; j < i; j++) {
+            if (server->queue_ctx[j] == data.ctx) {
+                break;
+            }
+        }
+        if (j < i) {
+            continue;
+        }
+
+        aio_bh_schedule_oneshot(data.ctx, vu_queue_ctx_detach_bh, &data);
+        qemu_coroutine_yield();
+    }
+
+    vu_wait_idle(server);
+}
+
+/* Monitor the kick fds in the queue AioContexts again */
+static void vu_queues_resume(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->queues_quiesced) {
+        return;
+    }
+    server->queues_quiesced = false;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx) {
+            aio_set_fd_handler(vu_fd_watch->ctx, vu_fd_watch->fd,
+                               kick_handler, NULL, NULL, NULL, vu_fd_watch);
+        }
+    }
+}
+
+/* Messages after which libvhost-user may change virtqueues or guest memory */
+static bool vu_message_changes_queues(VhostUserMsg *vmsg)
+{
+    switch (vmsg->request) {
+    case VHOST_USER_SET_FEATURES:
+    case VHOST_USER_RESET_OWNER:
+    case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_SET_LOG_BASE:
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_ADDR:
+    case VHOST_USER_SET_VRING_BASE:
+    case VHOST_USER_GET_VRING_BASE:
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+    case VHOST_USER_SET_VRING_ERR:
+    case VHOST_USER_SET_VRING_ENABLE:
+    case VHOST_USER_SET_INFLIGHT_FD:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -108,6 +265,8 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
     QIOChannel *ioc = server->ioc;
 
+    vu_queues_resume(server);
+
     vmsg->fd_num = 0;
     if (!ioc) {
         error_report_err(local_err);
@@ -187,6 +346,10 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    if (vu_message_changes_queues(vmsg)) {
+        vu_queues_quiesce(server);
+    }
+
     return true;
 
 fail:
@@ -212,18 +375,15 @@ static coroutine_fn void vu_client_trip(void *opaque)
         }
     }
 
-    if (vhost_user_server_has_in_flight(server)) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
-    }
-    assert(!vhost_user_server_has_in_flight(server));
+    /* Wait for requests to complete before we can unmap the memory */
+    vu_queues_quiesce(server);
+    vu_wait_idle(server);
 
     vu_deinit(vu_dev);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
+    server->queues_quiesced = false;
 
     object_unref(OBJECT(server->sioc));
     server->sioc = NULL;
@@ -238,28 +398,6 @@ static coroutine_fn void vu_client_trip(void *opaque)
     aio_wait_kick();
 }
 
-/*
- * a wrapper for vu_kick_cb
- *
- * since aio_dispatch can only pass one user data pointer to the
- * callback function, pack VuDev and pvt into a struct. Then unpack it
- * and pass them to vu_kick_cb
- */
-static void kick_handler(void *opaque)
-{
-    VuFdWatch *vu_fd_watch = opaque;
-    VuDev *vu_dev = vu_fd_watch->vu_dev;
-
-    vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
-
-    /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
-    if (vu_dev->broken) {
-        VuServer *server = container_of(vu_dev, VuServer, vu_dev);
-
-        qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
-    }
-}
-
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -272,7 +410,42 @@ static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
     return NULL;
 }
 
-static void
+static AioContext *vu_fd_watch_get_ctx(VuServer *server,
+                                       VuFdWatch *vu_fd_watch)
+{
+    return vu_fd_watch->ctx ?: server->ctx;
+}
+
+/* The AioContext of the virtqueue whose kick fd is @fd, or NULL */
+static AioContext *vu_fd_get_queue_ctx(VuServer *server, int fd)
+{
+    VuDev *vu_dev = &server->vu_dev;
+    int i;
+
+    if (!server->queue_ctx) {
+        return NULL;
+    }
+
+    for (i = 0; i < vu_dev->max_queues; i++) {
+        if (vu_dev->vq[i].kick_fd == fd) {
+            return server->queue_ctx[i];
+        }
+    }
+    return NULL;
+}
+
+/* Start monitoring a kick fd, unless its virtqueue is quiesced */
+static void vu_fd_watch_attach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    if (vu_fd_watch->ctx && server->queues_quiesced) {
+        return;
+    }
+    aio_set_fd_handler(vu_fd_watch_get_ctx(server, vu_fd_watch),
+                       vu_fd_watch->fd, kick_handler, NULL, NULL, NULL,
+                       vu_fd_watch);
+}
+
+static void coroutine_fn
 set_watch(VuDev *vu_dev, int fd, int vu_evt,
           vu_watch_cb cb, void *pvt)
 {
@@ -281,8 +454,10 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
     g_assert(vu_dev);
     g_assert(fd >= 0);
     g_assert(cb);
+    assert(qemu_in_coroutine());
 
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
+    AioContext *ctx = vu_fd_get_queue_ctx(server, fd);
 
     if (!vu_fd_watch) {
         vu_fd_watch = g_new0(VuFdWatch, 1);
@@ -291,20 +466,29 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
+        vu_fd_watch->ctx = ctx;
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        vu_fd_watch_attach(server, vu_fd_watch);
+    } else if (vu_fd_watch->ctx != ctx) {
+        /* The fd was reused for a virtqueue in another AioContext */
+        vu_queues_quiesce(server);
+        if (!vu_fd_watch->ctx) {
+            aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+        }
+        vu_fd_watch->ctx = ctx;
+        vu_fd_watch_attach(server, vu_fd_watch);
     }
 }
 
 
-static void remove_watch(VuDev *vu_dev, int fd)
+static void coroutine_fn remove_watch(VuDev *vu_dev, int fd)
 {
     VuServer *server;
     g_assert(vu_dev);
     g_assert(fd >= 0);
+    assert(qemu_in_coroutine());
 
     server = container_of(vu_dev, VuServer, vu_dev);
 
@@ -313,7 +497,13 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+
+    if (vu_fd_watch->ctx) {
+        /* kick_handler() may still be running in the virtqueue's thread */
+        vu_queues_quiesce(server);
+    } else {
+        aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    }
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -373,8 +563,9 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            aio_set_fd_handler(vu_fd_watch_get_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd, NULL, NULL, NULL, NULL,
+                               vu_fd_watch);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -412,8 +603,7 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     }
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+        vu_fd_watch_attach(server, vu_fd_watch);
     }
 
     if (server->co_trip) {
@@ -444,8 +634,9 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            aio_set_fd_handler(vu_fd_watch_get_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd, NULL, NULL, NULL, NULL,
+                               vu_fd_watch);
         }
     }
 
@@ -463,6 +654,7 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctx,
                              const VuDevIface *vu_iface,
                              Error **errp)
 {
@@ -491,6 +683,7 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .queue_ctx             = queue_ctx,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");